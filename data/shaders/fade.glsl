@@ -0,0 +1,23 @@
+#version 460 core
+out vec4 FragColor;
+
+// the raw frame, one bit per pixel, and what was on screen the frame before.
+// Both cover the same pixels as the target, so they are read texel for texel.
+uniform usampler2D u_frame;
+uniform sampler2D u_previous;
+uniform float u_fade_rate;
+
+void main() {
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+
+  // each texel of u_frame holds 64 pixels of a row, the leftmost pixel in
+  // the top bit of .g
+  uvec2 words = texelFetch(u_frame, ivec2(texel.x / 64, texel.y), 0).rg;
+  int bit = 63 - (texel.x % 64);
+  uint word = (bit >= 32) ? words.g : words.r;
+  float current = float((word >> (bit % 32)) & 1u);
+
+  float previous = texelFetch(u_previous, texel, 0).r;
+
+  FragColor = vec4(max(current, previous - u_fade_rate), 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Compare the throughput of the `switch` and `threaded` dispatch modes.
+#
+# Builds kate-headless once per mode and runs every rom given on the command
+# line with each binary, keeping the best of several runs to reduce noise.
+#
+# usage: scripts/bench_dispatch.sh [-n runs] [-f frames] rom [rom...]
+set -e
+
+runs=5
+frames=1000000
+while getopts "n:f:" opt; do
+  case ${opt} in
+    n) runs=${OPTARG} ;;
+    f) frames=${OPTARG} ;;
+    *) exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -eq 0 ]; then
+  echo "usage: $0 [-n runs] [-f frames] rom [rom...]" >&2
+  exit 1
+fi
+
+CXX_FLAGS=${CXX_FLAGS:--O2}
+tmp=$(mktemp -d)
+trap 'rm -r "${tmp}"' EXIT
+
+for mode in switch threaded; do
+  make clean >/dev/null 2>&1 || true
+  make DISPATCH=${mode} CXX_FLAGS="${CXX_FLAGS}" headless >/dev/null
+  cp out/kate-headless "${tmp}/kate-headless-${mode}"
+done
+make clean >/dev/null 2>&1 || true
+
+best() {
+  i=0
+  while [ ${i} -lt ${runs} ]; do
+    "$1" --rom "$2" --frames "${frames}" | awk '/cycles\/sec/ { print $3 }'
+    i=$((i + 1))
+  done | sort -n | tail -n 1
+}
+
+printf "%-32s %14s %14s %8s\n" "rom" "switch" "threaded" "speedup"
+for rom in "$@"; do
+  s=$(best "${tmp}/kate-headless-switch" "${rom}")
+  t=$(best "${tmp}/kate-headless-threaded" "${rom}")
+  printf "%-32s %14s %14s %8s\n" "$(basename "${rom}")" "${s}" "${t}" \
+    "$(awk -v s="${s}" -v t="${t}" 'BEGIN { printf "%.2fx", t / s }')"
+done
@@ -0,0 +1,181 @@
+#include <algorithm> // std::max, std::min
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+#include <cmath> // std::llround
+
+#include "beeper.hpp"
+
+// an edge this far past what has been synthesised can only come from the
+// emulated clock jumping (a reset, a restored state), so it is played now
+constexpr double max_lead_seconds = 1.0;
+
+audio::audio_error::audio_error(const std::string &msg) : msg(msg) {}
+audio::audio_error::audio_error(const char *msg) : msg(msg) {}
+audio::audio_error::~audio_error() noexcept {}
+
+const char *audio::audio_error::what() const noexcept {
+  return msg.c_str();
+}
+
+audio::Beeper::Beeper(
+  const BeeperConfig &config, std::function<bool(Edge &)> source
+) : config(config), source(std::move(source)), device(nullptr),
+    context(nullptr), al_source(0), stopping(false), position(0),
+    anchor_time(0), anchor_sample(0), gate(false), gain(0), phase(0) {
+  if ((config.buffer_samples == 0) || (config.buffer_count < 2)) {
+    throw audio_error("audio needs at least two buffers of samples");
+  }
+
+  device = alcOpenDevice(nullptr);
+  if (device == nullptr) {
+    throw audio_error("unable to open audio device");
+  }
+
+  context = alcCreateContext(device, nullptr);
+  if ((context == nullptr) || !alcMakeContextCurrent(context)) {
+    if (context != nullptr) {
+      alcDestroyContext(context);
+    }
+    alcCloseDevice(device);
+    throw audio_error("unable to create audio context");
+  }
+
+  alGenSources(1, &al_source);
+  buffers.resize(config.buffer_count);
+  alGenBuffers(buffers.size(), buffers.data());
+  samples.resize(config.buffer_samples);
+}
+
+audio::Beeper::~Beeper() {
+  stop();
+
+  alDeleteSources(1, &al_source);
+  alDeleteBuffers(buffers.size(), buffers.data());
+  alcMakeContextCurrent(nullptr);
+  alcDestroyContext(context);
+  alcCloseDevice(device);
+}
+
+void audio::Beeper::start() {
+  if (thread.joinable()) {
+    return;
+  }
+
+  stopping = false;
+  thread = std::thread(&Beeper::thread_main, this);
+}
+
+void audio::Beeper::stop() {
+  if (!thread.joinable()) {
+    return;
+  }
+
+  stopping = true;
+  thread.join();
+}
+
+void audio::Beeper::thread_main() {
+  for (ALuint buffer : buffers) {
+    fill(buffer);
+  }
+  alSourceQueueBuffers(al_source, buffers.size(), buffers.data());
+  alSourcePlay(al_source);
+
+  // check often enough that a buffer is refilled well before the queue
+  // runs dry
+  auto poll_interval = std::chrono::microseconds(
+    config.buffer_samples * 1000000 / config.sample_rate / 4
+  );
+
+  while (!stopping) {
+    poll_edges();
+
+    ALint processed = 0;
+    alGetSourcei(al_source, AL_BUFFERS_PROCESSED, &processed);
+    for (ALint i = 0; i < processed; ++i) {
+      ALuint buffer;
+      alSourceUnqueueBuffers(al_source, 1, &buffer);
+      fill(buffer);
+      alSourceQueueBuffers(al_source, 1, &buffer);
+    }
+
+    // the queue ran dry and playback stopped, a failed query restarts it
+    ALint state = AL_STOPPED;
+    alGetSourcei(al_source, AL_SOURCE_STATE, &state);
+    if (state != AL_PLAYING) {
+      std::cout << "WARNING: audio underrun" << std::endl;
+      alSourcePlay(al_source);
+    }
+
+    std::this_thread::sleep_for(poll_interval);
+  }
+
+  alSourceStop(al_source);
+  alSourcei(al_source, AL_BUFFER, 0);
+}
+
+void audio::Beeper::poll_edges() {
+  Edge edge;
+
+  while (source(edge)) {
+    bool idle = !gate && scheduled.empty();
+    if (edge.on && idle) {
+      anchor_time = edge.time;
+      anchor_sample = position;
+    }
+
+    double offset = (edge.time - anchor_time) * config.sample_rate;
+    std::uint64_t earliest = scheduled.empty() ?
+      position : std::max(position, scheduled.back().sample);
+
+    std::uint64_t sample = earliest;
+    if ((offset > 0) && (offset < max_lead_seconds * config.sample_rate)) {
+      std::uint64_t placed = anchor_sample + std::llround(offset);
+      sample = std::max(earliest, placed);
+    }
+
+    scheduled.push_back({sample, edge.on});
+  }
+}
+
+void audio::Beeper::render() {
+  double attack_step = 1.0 / std::max(1.0, config.attack * config.sample_rate);
+  double release_step =
+    1.0 / std::max(1.0, config.release * config.sample_rate);
+  double phase_step = config.frequency / config.sample_rate;
+
+  std::size_t next = 0;
+  for (std::int16_t &sample : samples) {
+    while ((next < scheduled.size()) && (scheduled[next].sample <= position)) {
+      gate = scheduled[next].on;
+      ++next;
+    }
+
+    if (gate) {
+      gain = std::min(1.0, gain + attack_step);
+    } else {
+      gain = std::max(0.0, gain - release_step);
+    }
+
+    double wave = (phase < 0.5) ? 1.0 : -1.0;
+    sample = static_cast<std::int16_t>(wave * gain * config.volume * 32767);
+
+    phase += phase_step;
+    if (phase >= 1.0) {
+      phase -= 1.0;
+    }
+    ++position;
+  }
+
+  scheduled.erase(scheduled.begin(), scheduled.begin() + next);
+}
+
+void audio::Beeper::fill(ALuint buffer) {
+  render();
+  alBufferData(
+    buffer, AL_FORMAT_MONO16, samples.data(),
+    samples.size() * sizeof(std::int16_t), config.sample_rate
+  );
+}
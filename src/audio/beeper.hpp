@@ -0,0 +1,109 @@
+#ifndef __AUDIO_BEEPER__
+#define __AUDIO_BEEPER__
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <AL/al.h>
+#include <AL/alc.h>
+
+namespace audio {
+  class audio_error : public std::exception {
+  public:
+    explicit audio_error(const std::string &msg);
+    explicit audio_error(const char *msg);
+    virtual ~audio_error() noexcept;
+
+    virtual const char *what() const noexcept;
+  protected:
+    std::string msg;
+  };
+
+  // the tone turning on or off, `time` is in seconds of emulated time
+  struct Edge {
+    double time;
+    bool on;
+  };
+
+  struct BeeperConfig {
+    unsigned int sample_rate;
+    // latency is roughly buffer_samples * buffer_count, fewer samples in
+    // flight means a busy host is more likely to leave a gap
+    std::size_t buffer_samples;
+    std::size_t buffer_count;
+
+    double frequency;
+    double volume;
+    // seconds to ramp up at the start of a tone and down at the end
+    double attack;
+    double release;
+  };
+
+  // A square wave tone, synthesised on its own thread and streamed through
+  // a small queue of OpenAL buffers.
+  //
+  // `source` is polled from that thread for the edges that gate the tone.
+  // The first edge to turn the tone on is played as soon as possible, the
+  // edges after it are placed relative to it, so a tone lasts exactly as
+  // long as it did in the emulator rather than however long it took the
+  // edges to arrive. Edges that arrive too late for their place are played
+  // straight away.
+  class Beeper {
+  public:
+    Beeper(const BeeperConfig &config, std::function<bool(Edge &)> source);
+    ~Beeper();
+
+    // delete copy constructor/asignment
+    Beeper(Beeper &other) = delete;
+    Beeper &operator=(Beeper &other) = delete;
+
+    void start();
+    // stops the thread and waits for it
+    void stop();
+
+  private:
+    void thread_main();
+    void poll_edges();
+    // synthesise the next `buffer_samples` samples into `samples`
+    void render();
+    void fill(ALuint buffer);
+
+    BeeperConfig config;
+    std::function<bool(Edge &)> source;
+
+    ALCdevice *device;
+    ALCcontext *context;
+    ALuint al_source;
+    std::vector<ALuint> buffers;
+    std::vector<std::int16_t> samples;
+
+    std::thread thread;
+    std::atomic<bool> stopping;
+
+    // edges waiting to be played, in order, by the sample they start at
+    struct Scheduled {
+      std::uint64_t sample;
+      bool on;
+    };
+    std::vector<Scheduled> scheduled;
+
+    // samples synthesised so far, the next one rendered is this one
+    std::uint64_t position;
+    // the emulated time `anchor_time` is played at sample `anchor_sample`
+    double anchor_time;
+    std::uint64_t anchor_sample;
+
+    bool gate;
+    double gain;
+    double phase;
+  };
+}
+
+#endif // __AUDIO_BEEPER__
@@ -0,0 +1,304 @@
+#include <algorithm> // std::min
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "kate/batch.hpp"
+#include "kate/interpreter.hpp"
+#include "util/io.hpp"
+#include "util/options.hpp"
+#include "util/timer.hpp"
+
+// Microbenchmarks for the interpreter's hot paths.
+//
+// Each workload is a small synthetic rom that loops forever over one kind of
+// instruction, run for a fixed number of cycles. The best of several runs is
+// kept, and reported as ns/instruction and instructions/second. Results are
+// saved as a CSV baseline, and later runs are compared against it so that a
+// change which slows the interpreter down shows up as a failure.
+
+struct BENCHMARK {
+  std::string name;
+  std::string description;
+  // does the work and returns how many instructions (or decodes) it did
+  std::function<std::uint64_t()> run;
+};
+
+struct RESULT {
+  std::string name;
+  double ns_per_instruction;
+};
+
+// enough instructions that a run takes a noticeable fraction of a second
+constexpr std::uint64_t bench_cycles = 20000000;
+// lanes of the kate::Batch benchmarks, which run bench_cycles in total
+constexpr std::size_t bench_lanes = 256;
+constexpr std::uint64_t decode_rounds = 200;
+
+static std::vector<std::uint8_t> assemble(
+  const std::vector<std::uint16_t> &program
+) {
+  std::vector<std::uint8_t> rom;
+  for (std::uint16_t op : program) {
+    rom.push_back(op >> 8);
+    rom.push_back(op & 0xff);
+  }
+  return rom;
+}
+
+// every 8XYN, with a few register loads and adds, jumping back to 0x206
+static const std::vector<std::uint16_t> alu_program {
+  0x6001, 0x6103, 0x6207,
+  0x8014, 0x8121, 0x8012, 0x8213, 0x8024, 0x8105, 0x8216, 0x8027, 0x801E,
+  0x7101,
+  0x1206
+};
+
+// a random font character at a random position, forever
+static const std::vector<std::uint16_t> draw_program {
+  0xC00F, 0xF029, 0xC13F, 0xC21F, 0xD125,
+  0x1200
+};
+
+// two levels of subroutine per loop
+static const std::vector<std::uint16_t> call_program {
+  0x2206, 0x1200, 0x0000,
+  0x220A, 0x00EE,
+  0x7001, 0x00EE
+};
+
+// copies 16 bytes from 0x300 to 0x400 through the registers
+static const std::vector<std::uint16_t> memcpy_program {
+  0xA300, 0xFF65, 0xA400, 0xFF55,
+  0x1200
+};
+
+// only superinstructions: a sprite drawn from a table entry, then a delay
+// timer wait that never waits (nothing sets the timer)
+static const std::vector<std::uint16_t> fused_program {
+  0xA300, 0xF31E, 0xF165, 0x6008, 0x6104, 0xD015, 0xF207, 0x3200, 0x120C,
+  0x1200
+};
+
+static std::uint64_t run_rom(
+  const std::vector<std::uint16_t> &program, kate::QUIRKS quirks
+) {
+  kate::Interpreter chip8 {quirks};
+  chip8.seed(0);
+  chip8.load_rom(assemble(program));
+  chip8.run(bench_cycles);
+
+  return chip8.get_cycle_counter();
+}
+
+static std::uint64_t step_rom(
+  const std::vector<std::uint16_t> &program, kate::QUIRKS quirks
+) {
+  kate::Interpreter chip8 {quirks};
+  chip8.seed(0);
+  chip8.load_rom(assemble(program));
+  for (std::uint64_t i = 0; i < bench_cycles; ++i) {
+    chip8.step();
+  }
+
+  return chip8.get_cycle_counter();
+}
+
+// counts every lane's instructions, so the result compares directly with
+// the same rom in a single interpreter
+static std::uint64_t run_batch(
+  const std::vector<std::uint16_t> &program, kate::QUIRKS quirks
+) {
+  kate::Batch batch {bench_lanes, quirks};
+  batch.seed(0);
+  batch.load_rom(assemble(program));
+  batch.run(bench_cycles / bench_lanes);
+
+  return batch.get_cycle_counter() * batch.size();
+}
+
+static std::uint64_t decode_all() {
+  // summed so the decoding can't be optimised away
+  std::uint64_t sum = 0;
+  for (std::uint64_t round = 0; round < decode_rounds; ++round) {
+    for (std::uint32_t raw = 0; raw <= 0xffff; ++raw) {
+      sum += static_cast<std::uint8_t>(kate::decode_instruction(raw).handler);
+    }
+  }
+
+  volatile std::uint64_t sink = sum;
+  (void)sink;
+  return decode_rounds * 0x10000;
+}
+
+static std::vector<BENCHMARK> benchmarks() {
+  // DXYN waits for vblank with the COSMAC VIP quirks, which nothing triggers
+  // here, so the draw loop uses SUPER-CHIP
+  return {
+    {
+      "alu", "8XYN and 7XNN in a loop, run()",
+      [] { return run_rom(alu_program, kate::QUIRKS::COSMAC_VIP); }
+    },
+    {
+      "alu-step", "the same loop, one step() per instruction",
+      [] { return step_rom(alu_program, kate::QUIRKS::COSMAC_VIP); }
+    },
+    {
+      "draw", "CXNN, FX29 and a 5 row DXYN in a loop",
+      [] { return run_rom(draw_program, kate::QUIRKS::SUPER_CHIP); }
+    },
+    {
+      "alu-lanes", "the alu loop in a 256 lane kate::Batch, per lane",
+      [] { return run_batch(alu_program, kate::QUIRKS::COSMAC_VIP); }
+    },
+    {
+      "draw-lanes", "the draw loop in a 256 lane kate::Batch, per lane",
+      [] { return run_batch(draw_program, kate::QUIRKS::SUPER_CHIP); }
+    },
+    {
+      "fused", "6XNN 6YNN DXYN, FX07 3X00 1NNN and FX1E FX65",
+      [] { return run_rom(fused_program, kate::QUIRKS::SUPER_CHIP); }
+    },
+    {
+      "call-ret", "nested 2NNN and 00EE",
+      [] { return run_rom(call_program, kate::QUIRKS::COSMAC_VIP); }
+    },
+    {
+      "memcpy", "FX65 and FX55 of all 16 registers",
+      [] { return run_rom(memcpy_program, kate::QUIRKS::COSMAC_VIP); }
+    },
+    {
+      "decode", "decode_instruction() of every opcode",
+      decode_all
+    }
+  };
+}
+
+static RESULT measure(const BENCHMARK &bench, std::size_t runs) {
+  // one untimed run to warm the caches
+  bench.run();
+
+  double best = 0;
+  for (std::size_t i = 0; i < runs; ++i) {
+    utils::Clock clock;
+    std::uint64_t count = bench.run();
+    double ns = clock.get().count() * 1e9 / count;
+
+    best = (i == 0) ? ns : std::min(best, ns);
+  }
+
+  return {bench.name, best};
+}
+
+static std::map<std::string, double> read_baseline(
+  const std::filesystem::path &path
+) {
+  std::map<std::string, double> baseline;
+  std::stringstream ss(utils::read_file(path));
+
+  std::string line;
+  std::getline(ss, line); // header
+  while (std::getline(ss, line)) {
+    std::size_t comma = line.find(',');
+    if (comma == std::string::npos) {
+      continue;
+    }
+
+    try {
+      baseline[line.substr(0, comma)] = std::stod(line.substr(comma + 1));
+    } catch (std::exception &e) {
+      std::cerr << path.string() << ": bad line: " << line << std::endl;
+    }
+  }
+
+  return baseline;
+}
+
+static std::string baseline_csv(const std::vector<RESULT> &results) {
+  std::stringstream ss;
+  ss << "benchmark,ns_per_instruction\n";
+  for (const RESULT &r : results) {
+    ss << r.name << ',' << std::setprecision(6) << r.ns_per_instruction;
+    ss << '\n';
+  }
+  return ss.str();
+}
+
+int main(int argc, const char *argv[]) {
+  utils::BENCH_OPTIONS options = utils::parse_bench_command_line(argc, argv);
+
+  if (options.err) {
+    return options.err;
+  } else if (options.called_for_help) {
+    return 0;
+  }
+
+  std::map<std::string, double> baseline;
+  bool compare = !options.baseline_path.empty() && !options.save &&
+                 std::filesystem::exists(options.baseline_path);
+  if (compare) {
+    baseline = read_baseline(options.baseline_path);
+  }
+
+  std::cout << std::left << std::setw(10) << "benchmark" << std::right;
+  std::cout << std::setw(10) << "ns/inst" << std::setw(14) << "inst/sec";
+  if (compare) {
+    std::cout << std::setw(10) << "baseline" << std::setw(9) << "change";
+  }
+  std::cout << std::endl;
+
+  std::vector<RESULT> results;
+  std::size_t regressions = 0;
+  for (const BENCHMARK &bench : benchmarks()) {
+    if (bench.name.find(options.filter) == std::string::npos) {
+      continue;
+    }
+
+    RESULT r = measure(bench, options.runs);
+    results.push_back(r);
+
+    std::cout << std::left << std::setw(10) << r.name << std::right;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << std::setw(10) << r.ns_per_instruction;
+    std::cout << std::setw(13) << std::setprecision(1);
+    std::cout << 1000.0 / r.ns_per_instruction << "M";
+
+    auto it = baseline.find(r.name);
+    if (compare && (it != baseline.end())) {
+      double change = 100.0 * (r.ns_per_instruction / it->second - 1.0);
+      bool regressed = change > options.tolerance;
+      regressions += regressed;
+
+      std::cout << std::setw(10) << std::setprecision(2) << it->second;
+      std::cout << std::setw(8) << std::setprecision(1) << std::showpos;
+      std::cout << change << '%' << std::noshowpos;
+      if (regressed) {
+        std::cout << "  REGRESSION";
+      }
+    } else if (compare) {
+      std::cout << std::setw(10) << "-" << std::setw(9) << "new";
+    }
+    std::cout << "  " << bench.description << std::endl;
+  }
+
+  if (!options.baseline_path.empty() && !compare) {
+    if (utils::write_file(
+      options.baseline_path, baseline_csv(results), true
+    ) == 0) {
+      std::cout << "Saved baseline to " << options.baseline_path << std::endl;
+    }
+  }
+
+  if (regressions) {
+    std::cout << regressions << " benchmark(s) more than ";
+    std::cout << options.tolerance << "% slower than the baseline";
+    std::cout << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
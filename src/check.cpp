@@ -0,0 +1,657 @@
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <cstring> // std::memcmp
+
+#include "kate/batch.hpp"
+#include "kate/interpreter.hpp"
+#include "kate/movie.hpp"
+#include "kate/rewind.hpp"
+#include "kate/savestate.hpp"
+
+// Checks of the interpreter core, run by `make check`. Prints one line per
+// check and fails if any of them did.
+//
+// kate::Batch has to behave exactly like kate::Interpreter. Each case is a
+// small rom that does the work being checked and then draws the registers it
+// cares about as digits, so comparing the framebuffers compares the
+// registers too. Every lane of a batch has to end up with the framebuffer an
+// interpreter given the same rom (and the same seed as that lane) ends up
+// with.
+
+struct CASE {
+  std::string name;
+  std::vector<std::uint16_t> program;
+};
+
+constexpr std::size_t check_frames = 10;
+// more than one vector's worth, and not a multiple of any vector width
+constexpr std::size_t check_lanes = 37;
+
+constexpr kate::QUIRKS all_quirks[] = {
+  kate::QUIRKS::COSMAC_VIP, kate::QUIRKS::SUPER_CHIP, kate::QUIRKS::XO_CHIP
+};
+
+static int failures = 0;
+
+static void report(const std::string &name, bool ok) {
+  std::cout << (ok ? "ok   " : "FAIL ") << name << '\n';
+  if (!ok) {
+    ++failures;
+  }
+}
+
+static std::vector<std::uint8_t> assemble(
+  const std::vector<std::uint16_t> &program
+) {
+  std::vector<std::uint8_t> rom;
+  for (std::uint16_t op : program) {
+    rom.push_back(op >> 8);
+    rom.push_back(op & 0xff);
+  }
+  return rom;
+}
+
+// V0 = `value`, V1 = 0x3C, then `op`. Draws V0 in decimal and VF, then
+// halts.
+static std::vector<std::uint16_t> alu_program(
+  std::uint8_t value, std::uint16_t op
+) {
+  return {
+    static_cast<std::uint16_t>(0x6000 | value), 0x613C, op,
+    0x83F0,                  // V3 = VF
+    0xA300, 0xF033, 0xF265,  // V0-V2 = the digits of V0
+    0x6A00, 0x6B00, 0xF029, 0xDAB5,
+    0x6A05, 0xF129, 0xDAB5,
+    0x6A0A, 0xF229, 0xDAB5,
+    0x6A0F, 0xF329, 0xDAB5,
+    0x1228
+  };
+}
+
+static kate::Framebuffer run_interpreter(
+  const std::vector<std::uint8_t> &rom, kate::QUIRKS quirks,
+  std::uint64_t seed
+) {
+  kate::Interpreter chip8 {quirks};
+  chip8.seed(seed);
+  chip8.load_rom(rom);
+
+  for (std::size_t frame = 0; frame < check_frames; ++frame) {
+    chip8.run(kate::instructions_per_frame);
+    chip8.vblank_trigger();
+    chip8.decrement_timers();
+  }
+
+  return chip8.get_output_buffer();
+}
+
+// the number of lanes that ended up differently, each lane is seeded with
+// its index
+static std::size_t run_batch(
+  const std::vector<std::uint8_t> &rom, kate::QUIRKS quirks
+) {
+  kate::Batch batch {check_lanes, quirks};
+  batch.load_rom(rom);
+  for (std::size_t lane = 0; lane < batch.size(); ++lane) {
+    batch.seed(lane, lane);
+  }
+
+  for (std::size_t frame = 0; frame < check_frames; ++frame) {
+    batch.run(kate::instructions_per_frame);
+    batch.vblank_trigger();
+    batch.decrement_timers();
+  }
+
+  std::size_t mismatched = 0;
+  for (std::size_t lane = 0; lane < batch.size(); ++lane) {
+    kate::Framebuffer expected = run_interpreter(rom, quirks, lane);
+    if (
+      batch.is_faulted(lane) || (batch.get_output_buffer(lane) != expected)
+    ) {
+      ++mismatched;
+    }
+  }
+
+  return mismatched;
+}
+
+static std::string decode_STOP_REASON(kate::STOP_REASON reason) {
+  switch (reason) {
+    case kate::STOP_REASON::BUDGET      : return "BUDGET";
+    case kate::STOP_REASON::VBLANK_WAIT : return "VBLANK_WAIT";
+    case kate::STOP_REASON::KEY_WAIT    : return "KEY_WAIT";
+    case kate::STOP_REASON::HALTED      : return "HALTED";
+    case kate::STOP_REASON::ERROR       : return "ERROR";
+  }
+
+  return "?";
+}
+
+// reports whether the machine is at `pc` after `cycles` instructions
+static void expect_at(
+  const std::string &name, const kate::Interpreter &chip8,
+  std::uint64_t cycles, std::uint16_t pc
+) {
+  static kate::State state;
+  chip8.save_state(state);
+
+  std::string at = " at cycle " + std::to_string(state.cycle_counter);
+  at += ", PC " + kate::hex_string(state.program_counter, 4);
+  report(
+    name + at,
+    (state.cycle_counter == cycles) && (state.program_counter == pc)
+  );
+}
+
+// as expect_at(), after run_for() returned `got` instead of `reason`
+static void expect_stop(
+  const std::string &name, const kate::Interpreter &chip8,
+  kate::STOP_REASON got, kate::STOP_REASON reason, std::uint64_t cycles,
+  std::uint16_t pc
+) {
+  std::string stopped = name + ": " + decode_STOP_REASON(got);
+  if (got != reason) {
+    report(stopped + ", expected " + decode_STOP_REASON(reason), false);
+    return;
+  }
+  expect_at(stopped, chip8, cycles, pc);
+}
+
+// A waiting FX0A or DXYN isn't run again until the host wakes it. Until then
+// run_for() returns straight away, while run() and step() only count the
+// cycles.
+static void check_waits() {
+  using kate::STOP_REASON;
+  constexpr STOP_REASON key = STOP_REASON::KEY_WAIT;
+  constexpr STOP_REASON vblank = STOP_REASON::VBLANK_WAIT;
+
+  // 0x200: FX0A, then V1 = 1 and back to wait again
+  kate::Interpreter chip8;
+  chip8.load_rom(assemble({0xF00A, 0x6101, 0x1200}));
+
+  expect_stop("FX0A run_for", chip8, chip8.run_for(100), key, 1, 0x200);
+  expect_stop("FX0A run_for", chip8, chip8.run_for(100), key, 1, 0x200);
+  chip8.run(50);
+  expect_at("FX0A run", chip8, 51, 0x200);
+  chip8.step();
+  expect_at("FX0A step", chip8, 52, 0x200);
+  chip8.keypress(5);
+  expect_stop("FX0A pressed", chip8, chip8.run_for(100), key, 52, 0x200);
+  // wakes, runs to the next FX0A and counts the rest
+  chip8.keyrelease(5);
+  chip8.run(10);
+  expect_at("FX0A released, run", chip8, 62, 0x200);
+
+  kate::State state;
+  chip8.save_state(state);
+  report(
+    "FX0A released: V0 = the key",
+    (state.registers[0] == 5) && (state.registers[1] == 1)
+  );
+
+  // 0x202: DXYN waits for vblank, draws, then waits again
+  chip8.set_quirks(kate::QUIRKS::COSMAC_VIP);
+  chip8.load_rom(assemble({0xA300, 0xD005, 0x1202}));
+
+  expect_stop("DXYN run_for", chip8, chip8.run_for(100), vblank, 2, 0x202);
+  expect_stop("DXYN run_for", chip8, chip8.run_for(100), vblank, 2, 0x202);
+  chip8.run(20);
+  expect_at("DXYN run", chip8, 22, 0x202);
+  chip8.step();
+  expect_at("DXYN step", chip8, 23, 0x202);
+  chip8.vblank_trigger();
+  expect_stop("DXYN vblank", chip8, chip8.run_for(100), vblank, 26, 0x202);
+  chip8.vblank_trigger();
+  chip8.run(10);
+  expect_at("DXYN vblank, run", chip8, 36, 0x202);
+}
+
+// An instruction at 0x3FFF would run past the end of ram, so a PC there has
+// to fault, in the interpreter and in every lane of a batch alike. The rom
+// jumps to an odd address and runs 7070 from there, which reaches 0x3FFF
+// after 7934 more instructions.
+static void check_pc_range() {
+  std::vector<std::uint8_t> rom(0x4000 - kate::entry_point, 0x70);
+  rom[0] = 0xB2;
+  rom[1] = 0x03;
+  constexpr std::uint64_t cycles = 1 + ((0x3fff - 0x203) / 2);
+
+  kate::Interpreter chip8;
+  chip8.load_rom(rom);
+  kate::STOP_REASON reason = chip8.run_for(2 * cycles);
+  report(
+    "PC 0x3FFF faults (Interpreter)",
+    (reason == kate::STOP_REASON::ERROR) &&
+    (chip8.get_cycle_counter() == cycles)
+  );
+
+  // and only there, one instruction later
+  kate::Batch batch {check_lanes};
+  batch.load_rom(rom);
+  std::size_t early = 0;
+  batch.run(cycles);
+  for (std::size_t lane = 0; lane < batch.size(); ++lane) {
+    early += batch.is_faulted(lane);
+  }
+  std::size_t faulted = 0;
+  batch.run(1);
+  for (std::size_t lane = 0; lane < batch.size(); ++lane) {
+    faulted += batch.is_faulted(lane);
+  }
+  report(
+    "PC 0x3FFF faults (Batch)", (early == 0) && (faulted == batch.size())
+  );
+}
+
+// State can't be compared with memcmp, it has padding
+static bool same_state(const kate::State &a, const kate::State &b) {
+  return (a.ram == b.ram) && (a.registers == b.registers) &&
+    (a.key_states == b.key_states) && (a.stack == b.stack) &&
+    (a.program_counter == b.program_counter) &&
+    (a.stack_pointer == b.stack_pointer) &&
+    (a.index_register == b.index_register) &&
+    (a.delay_timer == b.delay_timer) && (a.sound_timer == b.sound_timer) &&
+    (a.output_buffer == b.output_buffer) &&
+    (a.is_blocking == b.is_blocking) && (a.is_vblank == b.is_vblank) &&
+    (a.cur_inst.raw == b.cur_inst.raw) &&
+    (a.cur_inst.handler == b.cur_inst.handler) &&
+    (a.cycle_counter == b.cycle_counter) &&
+    (a.prev_program_counter == b.prev_program_counter) &&
+    (a.last_key_event.key == b.last_key_event.key) &&
+    (a.last_key_event.event == b.last_key_event.event) &&
+    (a.rng_state == b.rng_state);
+}
+
+// Runs `rom` for `frames` frames of `cycles` each, once through run() and
+// once through step(), which never fuses instructions, fast-forwards an
+// idle loop or enters a JIT block. Returns the first frame after which the
+// two differ, `frames` if they never did.
+static std::size_t compare_run_step(
+  const std::vector<std::uint8_t> &rom, kate::QUIRKS quirks,
+  std::size_t frames, std::uint64_t cycles
+) {
+  kate::Interpreter run {quirks};
+  kate::Interpreter step {quirks};
+  run.seed(0);
+  step.seed(0);
+  run.load_rom(rom);
+  step.load_rom(rom);
+
+  static kate::State a;
+  static kate::State b;
+  for (std::size_t frame = 0; frame < frames; ++frame) {
+    run.run(cycles);
+    for (std::uint64_t i = 0; i < cycles; ++i) {
+      step.step();
+    }
+
+    run.save_state(a);
+    step.save_state(b);
+    if (!same_state(a, b)) {
+      return frame;
+    }
+
+    run.vblank_trigger();
+    run.decrement_timers();
+    step.vblank_trigger();
+    step.decrement_timers();
+  }
+
+  return frames;
+}
+
+// A fast-forwarded idle loop has to end up exactly where running every pass
+// of it would. The frames aren't a multiple of the three instructions of a
+// pass, so passes are cut short, and the delay timer runs out part way
+// through some of them.
+static void check_idle() {
+  // 0x204: FX07 3X00 1NNN waiting for the delay timer
+  std::vector<std::uint8_t> rom = assemble({
+    0x6005, 0xF015, 0xF107, 0x3100, 0x1204, 0x7201, 0x1200
+  });
+
+  for (std::uint64_t cycles : {7, 11, 100}) {
+    constexpr std::size_t frames = 50;
+    std::size_t frame = compare_run_step(
+      rom, kate::QUIRKS::COSMAC_VIP, frames, cycles
+    );
+
+    std::string name = "idle loop, frames of " + std::to_string(cycles);
+    if (frame < frames) {
+      name += ": differs after frame " + std::to_string(frame);
+    }
+    report(name, frame == frames);
+  }
+
+#ifdef KATE_PROFILE
+  // and that it was fast-forwarded at all
+  kate::Interpreter chip8;
+  chip8.load_rom(rom);
+  chip8.run(100);
+  report(
+    "idle loop fast-forwarded", chip8.get_profile()->idle_instructions > 0
+  );
+#endif
+}
+
+// A JIT block has to do exactly what stepping through its instructions
+// does, and has to be dropped when the code it was compiled from is
+// rewritten. Without the JIT these check the interpreter's run() against
+// step() all the same.
+static void check_jit() {
+  std::vector<CASE> cases;
+  for (std::uint8_t value : {0x00, 0x05, 0xff}) {
+    std::string v = kate::hex_string(value, 2);
+    for (std::uint16_t op : {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xe}) {
+      std::uint16_t inst = 0x8010 | op;
+      cases.push_back({
+        kate::hex_string(inst, 4, false) + " V0=" + v,
+        alu_program(value, inst)
+      });
+    }
+  }
+
+  // 0x202 is compiled, then 0x212 writes 7005 over its first instruction
+  cases.push_back({"FX55 over a block", {
+    0x6100,
+    0x7001, 0x7201, 0x7101, 0x3103, 0x1202,
+    0x6070, 0x6105, 0xA202, 0xF155,
+    0x6100, 0x1202
+  }});
+
+  for (const CASE &c : cases) {
+    std::vector<std::uint8_t> rom = assemble(c.program);
+
+    for (kate::QUIRKS quirks : all_quirks) {
+      std::size_t frame = compare_run_step(
+        rom, quirks, check_frames, kate::instructions_per_frame
+      );
+
+      std::string name = "run = step: " + c.name;
+      name += " (" + kate::decode_QUIRKS(quirks) + ")";
+      if (frame < check_frames) {
+        name += ": differs after frame " + std::to_string(frame);
+      }
+      report(name, frame == check_frames);
+    }
+  }
+}
+
+// draws random digits from a subroutine, so a state has a stack, timers and
+// random number generator worth saving
+static const std::vector<std::uint16_t> state_program = {
+  0xC03F, 0xC11F, 0xF029, 0x220C, 0xF215, 0x1200,
+  0xD015, 0x00EE
+};
+
+static bool rejects_state(const std::vector<std::uint8_t> &data) {
+  kate::QUIRKS quirks;
+  try {
+    kate::deserialize_state(data, quirks);
+  } catch (kate::invalid_state &) {
+    return true;
+  }
+
+  return false;
+}
+
+// A state saved part way through a frame, written out and read back into
+// another interpreter, has to carry on exactly as the original does. Any
+// prefix of it, and a state with a field no machine could have, has to be
+// rejected.
+static void check_savestate() {
+  kate::Interpreter chip8;
+  chip8.seed(1);
+  chip8.load_rom(assemble(state_program));
+  for (std::size_t frame = 0; frame < check_frames; ++frame) {
+    chip8.run(kate::instructions_per_frame);
+    chip8.vblank_trigger();
+    chip8.decrement_timers();
+  }
+  chip8.run(5);
+
+  static kate::State saved;
+  chip8.save_state(saved);
+  std::vector<std::uint8_t> data = kate::serialize_state(
+    saved, chip8.get_quirks()
+  );
+
+  kate::QUIRKS quirks;
+  kate::State state = kate::deserialize_state(data, quirks);
+  kate::Interpreter loaded;
+  loaded.set_quirks(quirks);
+  loaded.load_state(state);
+
+  static kate::State a;
+  static kate::State b;
+  bool same = (quirks == chip8.get_quirks());
+  for (std::size_t frame = 0; same && (frame < check_frames); ++frame) {
+    chip8.run(kate::instructions_per_frame);
+    loaded.run(kate::instructions_per_frame);
+    chip8.save_state(a);
+    loaded.save_state(b);
+    same = same_state(a, b);
+
+    chip8.vblank_trigger();
+    chip8.decrement_timers();
+    loaded.vblank_trigger();
+    loaded.decrement_timers();
+  }
+  report("save state: load and run", same);
+
+  std::size_t accepted = 0;
+  for (std::size_t size = 0; size < data.size(); ++size) {
+    accepted += !rejects_state({data.begin(), data.begin() + size});
+  }
+  report("save state: truncated", accepted == 0);
+
+  // the header is "KATESAVE", the version and the quirks
+  std::vector<std::uint8_t> bad = data;
+  bad[0] ^= 0x20;
+  report("save state: bad magic", rejects_state(bad));
+  bad = data;
+  ++bad[8];
+  report("save state: other version", rejects_state(bad));
+  bad = data;
+  bad[10] = 0xff;
+  report("save state: unknown quirks", rejects_state(bad));
+  bad = data;
+  bad.push_back(0);
+  report("save state: trailing data", rejects_state(bad));
+
+  state = saved;
+  state.stack_pointer = state.stack.size() + 1;
+  bad = kate::serialize_state(state, quirks);
+  report("save state: stack pointer", rejects_state(bad));
+  state = saved;
+  state.last_key_event.event = static_cast<kate::KEY_EVENT>(0xff);
+  bad = kate::serialize_state(state, quirks);
+  report("save state: key event", rejects_state(bad));
+  state = saved;
+  state.rng_state = 0;
+  bad = kate::serialize_state(state, quirks);
+  report("save state: rng state", rejects_state(bad));
+}
+
+// Pushes frames of `chip8` into a rewind ring until it has dropped some,
+// popping `back` of them part way through. Every frame popped has to be
+// byte for byte the state that was pushed for it.
+static void check_rewind() {
+  kate::Interpreter chip8;
+  chip8.seed(2);
+  chip8.load_rom(assemble(state_program));
+
+  // small enough to wrap around many times
+  kate::Rewind rewind {8 * sizeof(kate::State), 10};
+  // every frame pushed and not yet popped, which outlives the ring
+  std::vector<kate::State> pushed;
+  static kate::State state;
+
+  std::size_t popped = 0;
+  std::size_t mismatched = 0;
+  auto pop = [&]() {
+    if (!rewind.pop(state)) {
+      return false;
+    }
+    mismatched += std::memcmp(&state, &pushed.back(), sizeof(state)) != 0;
+    pushed.pop_back();
+    ++popped;
+    return true;
+  };
+
+  for (std::size_t frame = 0; frame < 400; ++frame) {
+    chip8.run(kate::instructions_per_frame);
+    chip8.vblank_trigger();
+    chip8.decrement_timers();
+
+    chip8.save_state(state);
+    pushed.push_back(state);
+    rewind.push(state);
+
+    // rewind and carry on from there, as `kate` does
+    if (frame == 300) {
+      for (std::size_t i = 0; i < 25; ++i) {
+        pop();
+      }
+      chip8.load_state(pushed.back());
+    }
+  }
+
+  std::size_t frames = rewind.frames();
+  std::size_t rewound = popped;
+  while (pop()) {}
+  report(
+    "rewind: " + std::to_string(popped) + " frames popped",
+    (rewound == 25) && (mismatched == 0) && (popped - rewound == frames) &&
+    (pushed.size() > 0)
+  );
+}
+
+// A session recorded frame by frame, as `kate` runs it, has to end up in the
+// same state when its movie is written out, read back and played into a
+// fresh interpreter.
+static void check_movie() {
+  // 0x200: waits for a key and draws it at a random position, counting the
+  // frames it is held for in V2
+  std::vector<std::uint8_t> rom = assemble({
+    0xF00A, 0xC13F, 0xF029, 0xD125, 0xE09E, 0x1200, 0x7201, 0x1208
+  });
+
+  kate::Movie movie {kate::QUIRKS::COSMAC_VIP, 3, 0, {}};
+  kate::Interpreter chip8 {movie.quirks};
+  chip8.seed(movie.seed);
+  chip8.load_rom(rom);
+  chip8.record(&movie);
+
+  for (std::size_t frame = 0; frame < 200; ++frame) {
+    // a key goes down every 20 frames and comes up 7 frames later
+    std::uint8_t key = (frame / 20) % 16;
+    if (frame % 20 == 3) {
+      chip8.keypress(key);
+    } else if (frame % 20 == 10) {
+      chip8.keyrelease(key);
+    }
+
+    chip8.run_frame();
+    chip8.vblank_trigger();
+    chip8.decrement_timers();
+  }
+  chip8.record(nullptr);
+
+  kate::Movie loaded = kate::deserialize_movie(kate::serialize_movie(movie));
+  kate::Interpreter replay {loaded.quirks};
+  replay.seed(loaded.seed);
+  replay.load_rom(rom);
+  kate::MoviePlayer player {loaded, replay};
+  player.run(chip8.get_cycle_counter());
+
+  static kate::State a;
+  static kate::State b;
+  chip8.save_state(a);
+  replay.save_state(b);
+  report(
+    "movie: " + std::to_string(movie.events.size()) + " events replayed",
+    player.finished() && same_state(a, b) &&
+    (replay.get_output_buffer() == chip8.get_output_buffer())
+  );
+}
+
+// The JIT has to stop a block short of a sequence the interpreter fuses, or
+// the superinstruction would never run. A profiling build never uses the
+// JIT, so there the superinstructions run are counted instead.
+static void check_fusion() {
+  // 0x204: 6XNN 6YNN DXYN
+  std::vector<std::uint8_t> rom = assemble({
+    0xA300, 0x7201, 0x6001, 0x6102, 0xD015, 0x1200
+  });
+
+#ifdef KATE_USE_JIT
+  std::array<std::uint8_t, 0x4000> ram {};
+  std::copy(rom.begin(), rom.end(), ram.begin() + 0x200);
+
+  kate::Jit jit;
+  const kate::Jit::Block *block = jit.lookup<kate::COSMAC_VIP>(ram, 0x200);
+  report(
+    "JIT block stops before 6XNN 6YNN DXYN",
+    block && (block->count == 2) && (block->end == 0x204)
+  );
+#endif
+
+#ifdef KATE_PROFILE
+  kate::Interpreter chip8 {kate::QUIRKS::SUPER_CHIP};
+  chip8.load_rom(rom);
+  for (std::size_t frame = 0; frame < check_frames; ++frame) {
+    chip8.run(kate::instructions_per_frame);
+  }
+
+  const kate::Profile *profile = chip8.get_profile();
+  std::size_t draw = static_cast<std::size_t>(kate::HANDLER::FUSED_DRAW);
+  report("6XNN 6YNN DXYN runs fused", profile->fused[draw] > 0);
+#endif
+}
+
+int main() {
+  std::vector<CASE> cases;
+  for (std::uint8_t value : {0x00, 0x05, 0xff}) {
+    std::string v = kate::hex_string(value, 2);
+    cases.push_back({"8005 V0=" + v, alu_program(value, 0x8005)});
+    cases.push_back({"8007 V0=" + v, alu_program(value, 0x8007)});
+    cases.push_back({"8015 V0=" + v, alu_program(value, 0x8015)});
+    cases.push_back({"8017 V0=" + v, alu_program(value, 0x8017)});
+  }
+  cases.push_back({"C0FF", alu_program(0x00, 0xC0FF)});
+  // random font characters at random positions, every lane's differ
+  cases.push_back({"CXNN FX29 DXYN", {
+    0xC00F, 0xF029, 0xC13F, 0xC21F, 0xD125, 0x1200
+  }});
+
+  for (const CASE &c : cases) {
+    std::vector<std::uint8_t> rom = assemble(c.program);
+
+    for (kate::QUIRKS quirks : all_quirks) {
+      std::size_t mismatched = run_batch(rom, quirks);
+
+      std::string name = c.name + " (" + kate::decode_QUIRKS(quirks) + ")";
+      if (mismatched) {
+        name += ": " + std::to_string(mismatched) + " of ";
+        name += std::to_string(check_lanes) + " lanes differ";
+      }
+      report(name, mismatched == 0);
+    }
+  }
+
+  check_waits();
+  check_pc_range();
+  check_idle();
+  check_jit();
+  check_fusion();
+  check_savestate();
+  check_rewind();
+  check_movie();
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,368 @@
+#include <algorithm> // std::min, std::max
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+
+#include "kate/batch.hpp"
+#include "kate/interpreter.hpp"
+#include "kate/movie.hpp"
+#include "kate/native.hpp"
+#include "kate/profile.hpp"
+#include "kate/rewind.hpp"
+#include "util/corpus.hpp"
+#include "util/hash.hpp"
+#include "util/io.hpp"
+#include "util/options.hpp"
+#include "util/thread_pool.hpp"
+#include "util/timer.hpp"
+
+struct RESULT {
+  std::uint64_t cycles;
+  utils::seconds elapsed;
+  std::uint64_t hash;
+  std::string error; // empty unless the interpreter threw
+};
+
+// only written by builds with KATE_PROFILE defined
+static const std::filesystem::path profile_directory = "output";
+
+static void report_profile(const kate::Interpreter &chip8) {
+  const kate::Profile *profile = chip8.get_profile();
+  if (profile && (kate::save_profile(*profile, profile_directory) == 0)) {
+    std::cout << "Saved profile to " << profile_directory << std::endl;
+  }
+}
+
+// Runs a single interpreter for `cycles`, or until it throws. If `rewind` is
+// given a snapshot is pushed to it every frame. With `profile` set, a
+// profiling build saves its report at the end. `native` is attached once the
+// rom is loaded.
+static RESULT run_rom(
+  const std::vector<std::uint8_t> &rom, kate::QUIRKS quirks,
+  std::uint64_t cycles, kate::Rewind *rewind=nullptr, bool profile=false,
+  const kate::NativeModule *native=nullptr
+) {
+  kate::Interpreter chip8 {quirks};
+  chip8.load_rom(rom);
+  chip8.attach_native(native);
+  kate::State snapshot;
+
+  RESULT result;
+  utils::Clock clock;
+  while (chip8.get_cycle_counter() < cycles) {
+    // frames start on multiples of instructions_per_frame, so only a budget
+    // that isn't a whole number of frames ends part way through one
+    std::uint64_t remaining = cycles - chip8.get_cycle_counter();
+    kate::STOP_REASON reason = chip8.run_frame(
+      std::min<std::uint64_t>(remaining, kate::instructions_per_frame)
+    );
+
+    if (reason == kate::STOP_REASON::ERROR) {
+      result.error = chip8.get_error();
+      break;
+    }
+
+    if ((chip8.get_cycle_counter() % kate::instructions_per_frame) == 0) {
+      chip8.vblank_trigger();
+      chip8.decrement_timers();
+
+      if (rewind) {
+        chip8.save_state(snapshot);
+        rewind->push(snapshot);
+      }
+    }
+  }
+  result.elapsed = clock.get();
+
+  result.cycles = chip8.get_cycle_counter();
+  result.hash = utils::fnv1a(
+    kate::unpack_framebuffer(chip8.get_output_buffer())
+  );
+
+  if (profile) {
+    report_profile(chip8);
+  }
+
+  return result;
+}
+
+// Runs every rom in a corpus on a pool of threads and prints one line per
+// rom, in corpus order. Crash dumps are printed afterwards.
+static int run_corpus(const utils::HEADLESS_OPTIONS &options) {
+  std::vector<utils::CORPUS_ENTRY> corpus = utils::read_corpus(
+    options.corpus_path, options.frames
+  );
+  if (corpus.empty()) {
+    std::cerr << "no roms found in " << options.corpus_path << std::endl;
+    return 1;
+  }
+
+  kate::QUIRKS quirks = kate::quirks_from_string(options.quirks);
+  std::vector<RESULT> results(corpus.size());
+
+  utils::Clock clock;
+  utils::work_stealing_for(corpus.size(), options.jobs, [&](std::size_t i) {
+    std::vector<std::uint8_t> rom = utils::read_binary(corpus[i].rom_path);
+    if (rom.empty()) {
+      results[i] = {0, utils::seconds(0), 0, "failed to read rom"};
+      return;
+    }
+
+    results[i] = run_rom(
+      rom, quirks, corpus[i].frames * kate::instructions_per_frame
+    );
+  });
+  utils::seconds elapsed = clock.get();
+
+  std::size_t failed = 0;
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "cycles\tseconds\tfb hash\t\t\trom\terror\n";
+  for (std::size_t i = 0; i < corpus.size(); ++i) {
+    const RESULT &r = results[i];
+
+    // only the first line of a crash dump fits in the table
+    std::string summary = r.error.substr(0, r.error.find('\n'));
+    failed += !r.error.empty();
+
+    std::cout << r.cycles << '\t' << r.elapsed.count() << '\t';
+    std::cout << kate::hex_string(r.hash, 16) << '\t';
+    std::cout << corpus[i].rom_path.string() << '\t' << summary << '\n';
+  }
+  std::cout << corpus.size() << " roms, " << failed << " failed, ";
+  std::cout << elapsed.count() << " s" << std::endl;
+
+  for (std::size_t i = 0; i < corpus.size(); ++i) {
+    if (!results[i].error.empty()) {
+      std::cerr << corpus[i].rom_path.string() << ":\n";
+      std::cerr << results[i].error << std::endl;
+    }
+  }
+
+  return failed ? 1 : 0;
+}
+
+// Loads the library given with --native, nullptr if there wasn't one.
+// Throws kate::invalid_native if it can't be loaded.
+static std::unique_ptr<kate::NativeCode> load_native(
+  const utils::HEADLESS_OPTIONS &options,
+  const std::vector<std::uint8_t> &rom
+) {
+  if (options.native_path.empty()) {
+    return nullptr;
+  }
+
+  auto native = std::make_unique<kate::NativeCode>(options.native_path);
+  if (!native->matches(rom)) {
+    // still safe, blocks are only run where the ram matches
+    std::cerr << "WARNING: native code was compiled from a different rom";
+    std::cerr << std::endl;
+  }
+  return native;
+}
+
+// Plays a movie back at full speed. The movie supplies the input and the
+// vblank/timer events, so nothing else is triggered here.
+static int run_replay(
+  const utils::HEADLESS_OPTIONS &options,
+  const std::vector<std::uint8_t> &rom, const kate::NativeModule *native
+) {
+  kate::Movie movie;
+  try {
+    movie = kate::deserialize_movie(utils::read_binary(options.replay_path));
+  } catch (kate::invalid_movie &e) {
+    std::cerr << options.replay_path.string() << ": " << e.what() << std::endl;
+    return 1;
+  }
+
+  if (movie.rom_hash != utils::fnv1a(rom)) {
+    std::cerr << "WARNING: movie was recorded with a different rom" << std::endl;
+  }
+
+  kate::Interpreter chip8 {movie.quirks};
+  chip8.load_rom(rom);
+  chip8.seed(movie.seed);
+  kate::MoviePlayer player {movie, chip8};
+
+  std::uint64_t cycles = options.cycles ? options.cycles : player.length();
+
+  int err = 0;
+  utils::Clock clock;
+  try {
+    chip8.attach_native(native);
+    player.run(cycles);
+  } catch (kate::interpreter_error &e) {
+    std::cerr << e.what() << std::endl;
+    err = 1;
+  }
+  utils::seconds elapsed = clock.get();
+
+  std::uint64_t cycles_run = chip8.get_cycle_counter();
+  std::uint64_t hash = utils::fnv1a(
+    kate::unpack_framebuffer(chip8.get_output_buffer())
+  );
+
+  std::cout << "rom        : " << options.rom_path.string() << '\n';
+  std::cout << "movie      : " << options.replay_path.string() << '\n';
+  std::cout << "quirks     : " << kate::decode_QUIRKS(movie.quirks) << '\n';
+  std::cout << "events     : " << movie.events.size() << '\n';
+  std::cout << "cycles     : " << cycles_run << '\n';
+  std::cout << "elapsed    : " << elapsed.count() << " s\n";
+  std::cout << "cycles/sec : " << std::fixed << std::setprecision(0);
+  std::cout << (cycles_run / elapsed.count()) << '\n';
+  std::cout << "fb hash    : " << kate::hex_string(hash, 16) << std::endl;
+
+  report_profile(chip8);
+
+  return err;
+}
+
+// Runs `lanes` copies of the rom in lockstep. There is no input, so unless the
+// rom uses random numbers every lane ends up identical.
+static int run_batch(
+  const utils::HEADLESS_OPTIONS &options,
+  const std::vector<std::uint8_t> &rom, std::uint64_t cycles
+) {
+  kate::Batch batch {options.lanes, kate::quirks_from_string(options.quirks)};
+  batch.load_rom(rom);
+
+  utils::Clock clock;
+  while (batch.get_cycle_counter() < cycles) {
+    std::uint64_t cycle = batch.get_cycle_counter();
+    std::uint64_t frame_remaining =
+      kate::instructions_per_frame - (cycle % kate::instructions_per_frame);
+    std::uint64_t n = std::min(frame_remaining, cycles - cycle);
+    batch.run(n);
+
+    if (batch.get_cycle_counter() != cycle + n) {
+      // every lane has faulted
+      break;
+    }
+
+    if ((batch.get_cycle_counter() % kate::instructions_per_frame) == 0) {
+      batch.vblank_trigger();
+      batch.decrement_timers();
+    }
+  }
+  utils::seconds elapsed = clock.get();
+
+  std::size_t faulted = 0;
+  for (std::size_t lane = 0; lane < batch.size(); ++lane) {
+    if (batch.is_faulted(lane)) {
+      if (faulted == 0) {
+        std::cerr << batch.get_error(lane) << std::endl;
+      }
+      ++faulted;
+    }
+  }
+
+  std::uint64_t cycles_run = batch.get_cycle_counter();
+  std::uint64_t hash = utils::fnv1a(
+    kate::unpack_framebuffer(batch.get_output_buffer(0))
+  );
+  double lockstep = 100.0 * batch.get_lockstep_cycles();
+  lockstep /= std::max<std::uint64_t>(cycles_run, 1);
+
+  std::cout << "rom        : " << options.rom_path.string() << '\n';
+  std::cout << "quirks     : " << options.quirks << '\n';
+  std::cout << "lanes      : " << batch.size() << '\n';
+  std::cout << "frames     : ";
+  std::cout << cycles_run / kate::instructions_per_frame << '\n';
+  std::cout << "cycles     : " << cycles_run << '\n';
+  std::cout << "elapsed    : " << elapsed.count() << " s\n";
+  std::cout << std::fixed << std::setprecision(0);
+  std::cout << "cycles/sec : " << (cycles_run * batch.size() / elapsed.count());
+  std::cout << " (all lanes)\n";
+  std::cout << std::setprecision(1);
+  std::cout << "lockstep   : " << lockstep << " %\n";
+  std::cout << "faulted    : " << faulted << '\n';
+  std::cout << "fb hash    : " << kate::hex_string(hash, 16) << " (lane 0)";
+  std::cout << std::endl;
+
+  return faulted ? 1 : 0;
+}
+
+// Runs a rom (or a whole corpus of them) without a window or audio device, as
+// fast as the host allows.
+// The emulated timing is kept intact: the timers and vblank are triggered
+// every `instructions_per_frame` cycles, exactly as they would be at 60Hz.
+int main(int argc, const char *argv[]) {
+  utils::HEADLESS_OPTIONS options = utils::parse_headless_command_line(
+    argc, argv
+  );
+
+  if (options.err) {
+    return options.err;
+  } else if (options.called_for_help) {
+    return 0;
+  }
+
+  if (!options.corpus_path.empty()) {
+    return run_corpus(options);
+  }
+
+  std::vector<std::uint8_t> rom = utils::read_binary(options.rom_path);
+  if (rom.empty()) {
+    return 1;
+  }
+
+  std::unique_ptr<kate::NativeCode> native;
+  try {
+    native = load_native(options, rom);
+  } catch (kate::invalid_native &e) {
+    std::cerr << options.native_path.string() << ": " << e.what() << std::endl;
+    return 1;
+  }
+  const kate::NativeModule *module = native ? &native->get_module() : nullptr;
+
+  if (!options.replay_path.empty()) {
+    return run_replay(options, rom, module);
+  }
+
+  std::uint64_t cycles = options.cycles;
+  if (cycles == 0) {
+    cycles = options.frames * kate::instructions_per_frame;
+  }
+
+  if (options.lanes > 1) {
+    return run_batch(options, rom, cycles);
+  }
+
+  kate::QUIRKS quirks = kate::quirks_from_string(options.quirks);
+  if (module && (module->quirks != quirks)) {
+    std::cerr << options.native_path.string() << ": compiled for ";
+    std::cerr << kate::decode_QUIRKS(module->quirks) << std::endl;
+    return 1;
+  }
+
+  kate::Rewind rewind;
+  RESULT result = run_rom(
+    rom, quirks, cycles,
+    options.rewind ? &rewind : nullptr, true, module
+  );
+  if (!result.error.empty()) {
+    std::cerr << result.error << std::endl;
+  }
+
+  std::uint64_t cycles_run = result.cycles;
+  utils::seconds elapsed = result.elapsed;
+  std::uint64_t hash = result.hash;
+
+  std::cout << "rom        : " << options.rom_path.string() << '\n';
+  std::cout << "quirks     : " << options.quirks << '\n';
+  std::cout << "frames     : ";
+  std::cout << cycles_run / kate::instructions_per_frame << '\n';
+  std::cout << "cycles     : " << cycles_run << '\n';
+  std::cout << "elapsed    : " << elapsed.count() << " s\n";
+  std::cout << "cycles/sec : " << std::fixed << std::setprecision(0);
+  std::cout << (cycles_run / elapsed.count()) << '\n';
+  std::cout << "fb hash    : " << kate::hex_string(hash, 16) << std::endl;
+
+  if (options.rewind) {
+    std::cout << "rewind     : " << rewind.frames() << " frames, ";
+    std::cout << rewind.memory_used() / 1024 << " of ";
+    std::cout << rewind.capacity() / 1024 << " KiB" << std::endl;
+  }
+
+  return result.error.empty() ? 0 : 1;
+}
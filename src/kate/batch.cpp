@@ -0,0 +1,941 @@
+#include <algorithm> // std::copy, std::fill
+#include <random> // std::random_device
+#include <sstream>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "batch.hpp"
+
+/******************************************************************************
+/ SIMD                                                                        /
+******************************************************************************/
+// The handful of byte-wise operations needed by the register instructions,
+// operating on as many lanes as the target allows at once.
+namespace simd {
+#if defined(__AVX2__)
+  using vec = __m256i;
+
+  static inline vec load(const std::uint8_t *p) {
+    return _mm256_loadu_si256(reinterpret_cast<const vec *>(p));
+  }
+  static inline void store(std::uint8_t *p, vec v) {
+    _mm256_storeu_si256(reinterpret_cast<vec *>(p), v);
+  }
+  static inline vec splat(std::uint8_t b) { return _mm256_set1_epi8(b); }
+  static inline vec add(vec a, vec b) { return _mm256_add_epi8(a, b); }
+  static inline vec sub(vec a, vec b) { return _mm256_sub_epi8(a, b); }
+  static inline vec bit_or(vec a, vec b) { return _mm256_or_si256(a, b); }
+  static inline vec bit_and(vec a, vec b) { return _mm256_and_si256(a, b); }
+  static inline vec bit_xor(vec a, vec b) { return _mm256_xor_si256(a, b); }
+  static inline vec max(vec a, vec b) { return _mm256_max_epu8(a, b); }
+  static inline vec eq(vec a, vec b) { return _mm256_cmpeq_epi8(a, b); }
+  // bytes of `a` where `mask` is 0x00, bytes of `b` where it is 0xff
+  static inline vec select(vec a, vec b, vec mask) {
+    return _mm256_blendv_epi8(a, b, mask);
+  }
+  static inline vec shr1(vec a) {
+    return _mm256_and_si256(_mm256_srli_epi16(a, 1), splat(0x7f));
+  }
+  static inline vec shr7(vec a) {
+    return _mm256_and_si256(_mm256_srli_epi16(a, 7), splat(0x01));
+  }
+  // number of bytes in `mask` that are 0xff
+  static inline int count(vec mask) {
+    return __builtin_popcount(_mm256_movemask_epi8(mask));
+  }
+#elif defined(__SSE2__)
+  using vec = __m128i;
+
+  static inline vec load(const std::uint8_t *p) {
+    return _mm_loadu_si128(reinterpret_cast<const vec *>(p));
+  }
+  static inline void store(std::uint8_t *p, vec v) {
+    _mm_storeu_si128(reinterpret_cast<vec *>(p), v);
+  }
+  static inline vec splat(std::uint8_t b) { return _mm_set1_epi8(b); }
+  static inline vec add(vec a, vec b) { return _mm_add_epi8(a, b); }
+  static inline vec sub(vec a, vec b) { return _mm_sub_epi8(a, b); }
+  static inline vec bit_or(vec a, vec b) { return _mm_or_si128(a, b); }
+  static inline vec bit_and(vec a, vec b) { return _mm_and_si128(a, b); }
+  static inline vec bit_xor(vec a, vec b) { return _mm_xor_si128(a, b); }
+  static inline vec max(vec a, vec b) { return _mm_max_epu8(a, b); }
+  static inline vec eq(vec a, vec b) { return _mm_cmpeq_epi8(a, b); }
+  static inline vec select(vec a, vec b, vec mask) {
+    return _mm_or_si128(_mm_and_si128(mask, b), _mm_andnot_si128(mask, a));
+  }
+  static inline vec shr1(vec a) {
+    return _mm_and_si128(_mm_srli_epi16(a, 1), splat(0x7f));
+  }
+  static inline vec shr7(vec a) {
+    return _mm_and_si128(_mm_srli_epi16(a, 7), splat(0x01));
+  }
+  static inline int count(vec mask) {
+    return __builtin_popcount(_mm_movemask_epi8(mask));
+  }
+#else
+  // no SIMD available, one lane at a time
+  struct vec { std::uint8_t b; };
+
+  static inline vec load(const std::uint8_t *p) { return {*p}; }
+  static inline void store(std::uint8_t *p, vec v) { *p = v.b; }
+  static inline vec splat(std::uint8_t b) { return {b}; }
+  static inline vec add(vec a, vec b) { return {std::uint8_t(a.b + b.b)}; }
+  static inline vec sub(vec a, vec b) { return {std::uint8_t(a.b - b.b)}; }
+  static inline vec bit_or(vec a, vec b) { return {std::uint8_t(a.b | b.b)}; }
+  static inline vec bit_and(vec a, vec b) { return {std::uint8_t(a.b & b.b)}; }
+  static inline vec bit_xor(vec a, vec b) { return {std::uint8_t(a.b ^ b.b)}; }
+  static inline vec max(vec a, vec b) { return {std::max(a.b, b.b)}; }
+  static inline vec eq(vec a, vec b) {
+    return {std::uint8_t((a.b == b.b) ? 0xff : 0x00)};
+  }
+  static inline vec select(vec a, vec b, vec mask) {
+    return {std::uint8_t((mask.b & b.b) | (~mask.b & a.b))};
+  }
+  static inline vec shr1(vec a) { return {std::uint8_t(a.b >> 1)}; }
+  static inline vec shr7(vec a) { return {std::uint8_t(a.b >> 7)}; }
+  static inline int count(vec mask) { return mask.b & 1; }
+#endif
+
+  constexpr std::size_t width = sizeof(vec);
+}
+
+// every lane array is padded to a multiple of the widest vector used
+constexpr std::size_t lane_alignment = 32;
+
+// XORs the `n` rows at `sprite` onto `fb` at (`x`, `y`), returning whether
+// any pixel was turned off
+template <typename Q>
+static bool draw_sprite(
+  kate::Framebuffer &fb, const std::uint8_t *sprite, std::size_t n,
+  std::uint8_t x, std::uint8_t y
+) {
+  std::size_t h_offset = x % kate::SCR_W;
+  std::size_t v_offset = y % kate::SCR_H;
+
+  bool collision = false;
+  for (std::size_t i = 0; i < n; ++i) {
+    std::uint64_t row = std::uint64_t(sprite[i]) << (kate::SCR_W - 8);
+    std::size_t ypos = v_offset + i;
+
+    if constexpr (Q::sprite_clipping) {
+      if (ypos >= kate::SCR_H) {
+        break;
+      }
+      row >>= h_offset;
+    } else {
+      ypos %= kate::SCR_H;
+      row = (row >> h_offset) |
+            (row << ((kate::SCR_W - h_offset) % kate::SCR_W));
+    }
+
+    collision |= (fb[ypos] & row) != 0;
+    fb[ypos] ^= row;
+  }
+
+  return collision;
+}
+
+/******************************************************************************
+/ Batch                                                                       /
+******************************************************************************/
+kate::Batch::Batch(std::size_t lanes, QUIRKS quirks)
+: lanes(lanes),
+  stride(((lanes + lane_alignment - 1) / lane_alignment) * lane_alignment),
+  quirks(quirks) {
+  switch (quirks) {
+    case QUIRKS::COSMAC_VIP : run_fn = &Batch::run_impl<COSMAC_VIP>; break;
+    case QUIRKS::SUPER_CHIP : run_fn = &Batch::run_impl<SUPER_CHIP>; break;
+    case QUIRKS::XO_CHIP    : run_fn = &Batch::run_impl<XO_CHIP>;    break;
+  }
+
+  std::random_device rd;
+  rng_state.resize(lanes);
+  for (std::size_t lane = 0; lane < lanes; ++lane) {
+    seed(lane, (static_cast<std::uint64_t>(rd()) << 32) | rd());
+  }
+
+  ram.resize(0x4000 * lanes);
+  registers.resize(16 * stride);
+  key_states.resize(16 * stride);
+  stack.resize(16 * stride);
+  program_counter.resize(stride);
+  stack_pointer.resize(stride);
+  index_register.resize(stride);
+  delay_timer.resize(stride);
+  sound_timer.resize(stride);
+
+  output_buffer.resize(lanes);
+  is_blocking.resize(stride);
+  is_vblank.resize(stride);
+  last_key_event.resize(stride);
+  active.resize(stride);
+  errors.resize(lanes);
+
+  reset();
+}
+
+void kate::Batch::reset() {
+  std::fill(ram.begin(), ram.end(), 0);
+  std::fill(registers.begin(), registers.end(), 0);
+  std::fill(key_states.begin(), key_states.end(), 0);
+  std::fill(stack.begin(), stack.end(), 0);
+  std::fill(program_counter.begin(), program_counter.end(), entry_point);
+  std::fill(stack_pointer.begin(), stack_pointer.end(), 0);
+  std::fill(index_register.begin(), index_register.end(), 0);
+  std::fill(delay_timer.begin(), delay_timer.end(), 0);
+  std::fill(sound_timer.begin(), sound_timer.end(), 0);
+
+  for (auto &fb : output_buffer) {
+    fb.fill(0);
+  }
+  std::fill(is_blocking.begin(), is_blocking.end(), false);
+  std::fill(is_vblank.begin(), is_vblank.end(), false);
+  std::fill(
+    last_key_event.begin(), last_key_event.end(),
+    std::pair<int, KEY_EVENT>{0, KEY_EVENT::NONE}
+  );
+  cycle_counter = 0;
+  lockstep_cycles = 0;
+
+  std::fill(active.begin(), active.end(), 0x00);
+  std::fill(active.begin(), active.begin() + lanes, 0xff);
+  active_count = lanes;
+  std::fill(errors.begin(), errors.end(), "");
+
+  converged = true;
+  shared_pc = entry_point;
+
+  decode_cache_valid.fill(false);
+  ram_written.fill(false);
+
+  for (std::size_t lane = 0; lane < lanes; ++lane) {
+    std::copy(char_data.begin(), char_data.end(), &ram[lane * 0x4000 + char_pointer]);
+  }
+}
+
+void kate::Batch::load_rom(const std::vector<std::uint8_t> &rom) {
+  reset();
+
+  for (std::size_t lane = 0; lane < lanes; ++lane) {
+    std::copy(rom.begin(), rom.end(), &ram[lane * 0x4000 + entry_point]);
+  }
+}
+
+std::size_t kate::Batch::size() const {
+  return lanes;
+}
+
+const kate::Framebuffer &kate::Batch::get_output_buffer(std::size_t lane) const {
+  return output_buffer[lane];
+}
+
+std::uint8_t kate::Batch::get_sound_timer(std::size_t lane) const {
+  return sound_timer[lane];
+}
+
+std::uint64_t kate::Batch::get_cycle_counter() const {
+  return cycle_counter;
+}
+
+std::uint64_t kate::Batch::get_lockstep_cycles() const {
+  return lockstep_cycles;
+}
+
+bool kate::Batch::is_faulted(std::size_t lane) const {
+  return !errors[lane].empty();
+}
+
+const std::string &kate::Batch::get_error(std::size_t lane) const {
+  return errors[lane];
+}
+
+void kate::Batch::seed(std::uint64_t seed) {
+  std::fill(rng_state.begin(), rng_state.end(), rng_from_seed(seed));
+}
+
+void kate::Batch::seed(std::size_t lane, std::uint64_t seed) {
+  rng_state[lane] = rng_from_seed(seed);
+}
+
+void kate::Batch::decrement_timers() {
+  for (std::size_t lane = 0; lane < stride; ++lane) {
+    delay_timer[lane] -= (delay_timer[lane] > 0) & (active[lane] & 1);
+    sound_timer[lane] -= (sound_timer[lane] > 0) & (active[lane] & 1);
+  }
+}
+
+void kate::Batch::keypress(std::size_t lane, std::uint8_t k) {
+  key_states[(k * stride) + lane] = true;
+  last_key_event[lane] = {k, KEY_EVENT::PRESS};
+}
+
+void kate::Batch::keyrelease(std::size_t lane, std::uint8_t k) {
+  key_states[(k * stride) + lane] = false;
+  last_key_event[lane] = {k, KEY_EVENT::RELEASE};
+}
+
+void kate::Batch::run(std::uint64_t cycles) {
+  (this->*run_fn)(cycles);
+}
+
+void kate::Batch::vblank_trigger() {
+  std::fill(is_vblank.begin(), is_vblank.end(), true);
+}
+
+template <typename Q>
+void kate::Batch::run_impl(std::uint64_t cycles) {
+  for (; (cycles > 0) && (active_count > 0); --cycles) {
+    if (converged) {
+      std::uint16_t address = shared_pc;
+      Instruction inst;
+
+      if (fetch_shared(address, inst)) {
+        shared_pc += 2;
+        execute_lockstep<Q>(inst);
+
+        ++lockstep_cycles;
+        ++cycle_counter;
+        continue;
+      }
+
+      // the code at this address differs between lanes
+      diverge();
+    }
+
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+      if (!active[lane]) {
+        continue;
+      }
+
+      std::uint16_t address = program_counter[lane];
+      Instruction inst;
+
+      if (!fetch_shared(address, inst)) {
+        if (address >= 0x4000 - 1) {
+          inst = decode_instruction(0);
+          fault(lane, "PC out of range", inst, address);
+          continue;
+        }
+
+        const std::uint8_t *r = &ram[(lane * 0x4000) + address];
+        inst = decode_instruction((r[0] << 8) | r[1]);
+      }
+
+      program_counter[lane] += 2;
+      execute_lane<Q>(lane, inst, address);
+    }
+
+    ++cycle_counter;
+    check_converged();
+  }
+}
+
+bool kate::Batch::fetch_shared(std::uint16_t address, Instruction &inst) {
+  if (
+    (address >= 0x4000 - 1) ||
+    ram_written[address] || ram_written[address + 1]
+  ) {
+    return false;
+  }
+
+  if (!decode_cache_valid[address]) {
+    // nothing has been written here, so every lane holds the same bytes
+    decode_cache[address] = decode_instruction(
+      (ram[address] << 8) | ram[address + 1]
+    );
+    decode_cache_valid[address] = true;
+  }
+
+  inst = decode_cache[address];
+  return true;
+}
+
+void kate::Batch::diverge() {
+  for (std::size_t lane = 0; lane < lanes; ++lane) {
+    if (active[lane]) {
+      program_counter[lane] = shared_pc;
+    }
+  }
+
+  converged = false;
+}
+
+void kate::Batch::check_converged() {
+  bool found = false;
+  std::uint16_t pc = 0;
+
+  for (std::size_t lane = 0; lane < lanes; ++lane) {
+    if (!active[lane]) {
+      continue;
+    }
+
+    if (!found) {
+      pc = program_counter[lane];
+      found = true;
+    } else if (program_counter[lane] != pc) {
+      converged = false;
+      return;
+    }
+  }
+
+  converged = true;
+  shared_pc = pc;
+}
+
+void kate::Batch::mark_written(
+  std::size_t address, std::size_t len
+) {
+  for (std::size_t i = 0; (i < len) && (address + i < 0x4000); ++i) {
+    ram_written[address + i] = true;
+  }
+}
+
+void kate::Batch::fault(
+  std::size_t lane, const std::string &msg, const Instruction &inst,
+  std::uint16_t address
+) {
+  std::stringstream ss;
+  ss << "ABORTING EXECUTION: " << msg << '\n';
+  ss << "------------------------------------------------------------------\n";
+  ss << " lane " << lane << '\n';
+  ss << " current cycle " << hex_string(cycle_counter, 8) << '\n';
+  ss << " current instruction " << hex_string(inst.raw, 4, false);
+  ss << " ( " << decode_INSTRUCTION(inst.inst) << " )\n";
+  ss << "------------------------------------------------------------------\n";
+  ss << " PC : " << hex_string(address, 4) << " . ";
+  ss << " SP : " << hex_string(stack_pointer[lane], 4) << " . ";
+  ss << " IR : " << hex_string(index_register[lane], 4) << '\n';
+  ss << "------------------------------------------------------------------\n";
+  ss << "      STACK  | REGISTERS\n";
+  for (std::size_t i = 0; i <= 0xf; ++i) {
+    ss << hex_string(i, 1) << " : ";
+    ss << hex_string(stack[(i * stride) + lane], 4) << " | ";
+    ss << hex_string(registers[(i * stride) + lane], 2) << '\n';
+  }
+  ss << "------------------------------------------------------------------\n";
+
+  errors[lane] = ss.str();
+  active[lane] = 0x00;
+  --active_count;
+}
+
+/******************************************************************************
+/ Lockstep execution                                                          /
+******************************************************************************/
+template <typename Q>
+void kate::Batch::execute_lockstep(const Instruction &inst) {
+  std::uint8_t *vx = &registers[inst.x * stride];
+  const std::uint8_t *act = active.data();
+
+  switch (inst.handler) {
+    case HANDLER::JMP:
+      shared_pc = inst.n;
+      break;
+    case HANDLER::SKIP_EQ_IMM:
+    case HANDLER::SKIP_NE_IMM:
+    case HANDLER::SKIP_EQ_REG:
+    case HANDLER::SKIP_NE_REG:
+      skip(inst);
+      break;
+    case HANDLER::MOV:
+      for (std::size_t l = 0; l < stride; l += simd::width) {
+        simd::vec a = simd::load(vx + l);
+        simd::vec m = simd::load(act + l);
+        simd::store(vx + l, simd::select(a, simd::splat(inst.n), m));
+      }
+      break;
+    case HANDLER::ADD:
+      for (std::size_t l = 0; l < stride; l += simd::width) {
+        simd::vec a = simd::load(vx + l);
+        simd::vec m = simd::load(act + l);
+        simd::vec r = simd::add(a, simd::splat(inst.n));
+        simd::store(vx + l, simd::select(a, r, m));
+      }
+      break;
+    case HANDLER::ALU_MOV:
+    case HANDLER::ALU_OR:
+    case HANDLER::ALU_AND:
+    case HANDLER::ALU_XOR:
+    case HANDLER::ALU_ADD:
+    case HANDLER::ALU_SUB:
+    case HANDLER::ALU_RSUB:
+    case HANDLER::ALU_SHR:
+    case HANDLER::ALU_SHL:
+      _8XYN<Q>(inst);
+      break;
+    case HANDLER::ALU_UNKNOWN:
+      break;
+    case HANDLER::LDI:
+      for (std::size_t lane = 0; lane < lanes; ++lane) {
+        if (active[lane]) {
+          index_register[lane] = inst.n;
+        }
+      }
+      break;
+    case HANDLER::CALL:
+      for (std::size_t lane = 0; lane < lanes; ++lane) {
+        if (!active[lane]) {
+          continue;
+        }
+
+        std::uint16_t &sp = stack_pointer[lane];
+        if (sp >= 16) {
+          fault(lane, "STACK OVERFLOW", inst, shared_pc - 2);
+          continue;
+        }
+        stack[(sp * stride) + lane] = shared_pc;
+        ++sp;
+      }
+      shared_pc = inst.n;
+      break;
+    case HANDLER::RET: {
+      // lanes that called from the same place return together
+      bool found = false;
+      for (std::size_t lane = 0; lane < lanes; ++lane) {
+        if (!active[lane]) {
+          continue;
+        }
+
+        std::uint16_t &sp = stack_pointer[lane];
+        if (sp == 0) {
+          fault(lane, "STACK UNDERFLOW", inst, shared_pc - 2);
+          continue;
+        }
+        --sp;
+        program_counter[lane] = stack[(sp * stride) + lane];
+
+        if (!found) {
+          shared_pc = program_counter[lane];
+          found = true;
+        } else if (program_counter[lane] != shared_pc) {
+          converged = false;
+        }
+      }
+      break;
+    }
+    case HANDLER::DRAW:
+      if constexpr (Q::vblank_wait) {
+        // every lane blocks or none does, unless their vblanks differ
+        std::size_t waiting = 0;
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+          waiting += active[lane] && !is_vblank[lane];
+        }
+
+        if (waiting == active_count) {
+          shared_pc -= 2;
+          break;
+        } else if (waiting != 0) {
+          execute_diverged<Q>(inst);
+          break;
+        }
+      }
+
+      // DXYN, CXNN and FX29 get loops of their own rather than dispatching
+      // the handler again for every lane, as draw-heavy roms are mostly these
+      for (std::size_t lane = 0; lane < lanes; ++lane) {
+        if (!active[lane]) {
+          continue;
+        }
+
+        std::uint16_t ir = index_register[lane];
+        if (ir + inst.n > 0x4000) {
+          fault(lane, "I out of range", inst, shared_pc - 2);
+          continue;
+        }
+
+        registers[(0xf * stride) + lane] = draw_sprite<Q>(
+          output_buffer[lane], &ram[(lane * 0x4000) + ir], inst.n,
+          vx[lane], registers[(inst.y * stride) + lane]
+        );
+        is_vblank[lane] = false;
+      }
+      break;
+    case HANDLER::RANDOM:
+      for (std::size_t lane = 0; lane < lanes; ++lane) {
+        if (active[lane]) {
+          vx[lane] = rng_next(rng_state[lane]) & inst.n;
+        }
+      }
+      break;
+    case HANDLER::GET_CHAR:
+      for (std::size_t lane = 0; lane < lanes; ++lane) {
+        if (active[lane]) {
+          index_register[lane] = char_pointer + (vx[lane] * 5);
+        }
+      }
+      break;
+    case HANDLER::CLEAR:
+    case HANDLER::GET_DT:
+    case HANDLER::SET_DT:
+    case HANDLER::SET_ST:
+    case HANDLER::ADD_IR:
+    case HANDLER::BCD:
+    case HANDLER::STORE_REG:
+    case HANDLER::LOAD_REG:
+      // these work on per-lane memory or timers but never touch the PC, so
+      // the lanes stay together
+      for (std::size_t lane = 0; lane < lanes; ++lane) {
+        if (active[lane]) {
+          execute_lane<Q>(lane, inst, shared_pc - 2);
+        }
+      }
+      break;
+    default:
+      execute_diverged<Q>(inst);
+  }
+}
+
+template <typename Q>
+void kate::Batch::execute_diverged(const Instruction &inst) {
+  // the instruction depends on per-lane state (stack, input, etc.) to decide
+  // where to go next, so it is executed lane by lane, still sharing the decode
+  diverge();
+  for (std::size_t lane = 0; lane < lanes; ++lane) {
+    if (active[lane]) {
+      execute_lane<Q>(lane, inst, shared_pc - 2);
+    }
+  }
+  check_converged();
+}
+
+void kate::Batch::skip(const Instruction &inst) {
+  const std::uint8_t *vx = &registers[inst.x * stride];
+  const std::uint8_t *vy = &registers[inst.y * stride];
+  const std::uint8_t *act = active.data();
+  bool is_imm = (inst.handler == HANDLER::SKIP_EQ_IMM) ||
+                (inst.handler == HANDLER::SKIP_NE_IMM);
+  bool is_eq = (inst.handler == HANDLER::SKIP_EQ_IMM) ||
+               (inst.handler == HANDLER::SKIP_EQ_REG);
+
+  // count the lanes for which the comparison is equal
+  std::size_t equal = 0;
+  for (std::size_t l = 0; l < stride; l += simd::width) {
+    simd::vec a = simd::load(vx + l);
+    simd::vec b = is_imm ? simd::splat(inst.n) : simd::load(vy + l);
+    equal += simd::count(simd::bit_and(simd::eq(a, b), simd::load(act + l)));
+  }
+  std::size_t taken = is_eq ? equal : active_count - equal;
+
+  if (taken == active_count) {
+    shared_pc += 2;
+  } else if (taken != 0) {
+    diverge();
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+      bool e = is_imm ? (vx[lane] == inst.n) : (vx[lane] == vy[lane]);
+      if (active[lane] && (e == is_eq)) {
+        program_counter[lane] += 2;
+      }
+    }
+  }
+}
+
+template <typename Q>
+void kate::Batch::_8XYN(const Instruction &inst) {
+  std::uint8_t *vx = &registers[inst.x * stride];
+  const std::uint8_t *vy = &registers[inst.y * stride];
+  std::uint8_t *vf = &registers[0xf * stride];
+  const std::uint8_t *act = active.data();
+
+  const simd::vec zero = simd::splat(0x00);
+  const simd::vec one = simd::splat(0x01);
+
+  for (std::size_t l = 0; l < stride; l += simd::width) {
+    simd::vec a = simd::load(vx + l);
+    simd::vec b = simd::load(vy + l);
+    simd::vec m = simd::load(act + l);
+    simd::vec r = a;
+    simd::vec f = zero;
+    bool sets_flag = true;
+
+    switch (inst.handler) {
+      case HANDLER::ALU_MOV:
+        r = b;
+        sets_flag = false;
+        break;
+      case HANDLER::ALU_OR:
+        r = simd::bit_or(a, b);
+        sets_flag = Q::enable_flags_reset;
+        break;
+      case HANDLER::ALU_AND:
+        r = simd::bit_and(a, b);
+        sets_flag = Q::enable_flags_reset;
+        break;
+      case HANDLER::ALU_XOR:
+        r = simd::bit_xor(a, b);
+        sets_flag = Q::enable_flags_reset;
+        break;
+      case HANDLER::ALU_ADD:
+        // carry if the result is less than vX
+        r = simd::add(a, b);
+        f = simd::bit_and(simd::eq(simd::max(r, a), a), one);
+        f = simd::bit_and(simd::bit_xor(simd::eq(r, a), simd::splat(0xff)), f);
+        break;
+      case HANDLER::ALU_SUB:
+        // (result <= vX) && (vY <= vX), vY read after vX was written
+        r = simd::sub(a, b);
+        b = (inst.x == inst.y) ? r : b;
+        f = simd::bit_and(
+          simd::eq(simd::max(r, a), a), simd::eq(simd::max(b, a), a)
+        );
+        f = simd::bit_and(f, one);
+        break;
+      case HANDLER::ALU_RSUB:
+        // vX <= vY, vY read after vX was written
+        r = simd::sub(b, a);
+        b = (inst.x == inst.y) ? r : b;
+        f = simd::bit_and(simd::eq(simd::max(a, b), b), one);
+        break;
+      case HANDLER::ALU_SHR:
+        if constexpr (!Q::shifting_ignores_y) {
+          a = b;
+        }
+        f = simd::bit_and(a, one);
+        r = simd::shr1(a);
+        break;
+      case HANDLER::ALU_SHL:
+        if constexpr (!Q::shifting_ignores_y) {
+          a = b;
+        }
+        f = simd::shr7(a);
+        r = simd::add(a, a);
+        break;
+      default:
+        break;
+    }
+
+    // vX is written before vF, so the flag wins when X is F
+    simd::store(vx + l, simd::select(simd::load(vx + l), r, m));
+    if (sets_flag) {
+      simd::store(vf + l, simd::select(simd::load(vf + l), f, m));
+    }
+  }
+}
+
+/******************************************************************************
+/ Per-lane execution                                                          /
+******************************************************************************/
+template <typename Q>
+void kate::Batch::execute_lane(
+  std::size_t lane, const Instruction &inst, std::uint16_t address
+) {
+  auto V = [&](std::size_t r) -> std::uint8_t & {
+    return registers[(r * stride) + lane];
+  };
+  std::uint8_t *lane_ram = &ram[lane * 0x4000];
+  std::uint16_t &pc = program_counter[lane];
+  std::uint16_t &sp = stack_pointer[lane];
+  std::uint16_t &ir = index_register[lane];
+  std::uint16_t tmp = 0;
+
+  switch (inst.handler) {
+    case HANDLER::CLEAR:
+      output_buffer[lane].fill(0);
+      break;
+    case HANDLER::RET:
+      if (sp == 0) {
+        fault(lane, "STACK UNDERFLOW", inst, address);
+        return;
+      }
+      --sp;
+      pc = stack[(sp * stride) + lane];
+      break;
+    case HANDLER::JMP:
+      pc = inst.n;
+      break;
+    case HANDLER::CALL:
+      if (sp >= 16) {
+        fault(lane, "STACK OVERFLOW", inst, address);
+        return;
+      }
+      stack[(sp * stride) + lane] = pc;
+      ++sp;
+      pc = inst.n;
+      break;
+    case HANDLER::SKIP_EQ_IMM:
+      pc += (V(inst.x) == inst.n) ? 2 : 0;
+      break;
+    case HANDLER::SKIP_NE_IMM:
+      pc += (V(inst.x) != inst.n) ? 2 : 0;
+      break;
+    case HANDLER::SKIP_EQ_REG:
+      pc += (V(inst.x) == V(inst.y)) ? 2 : 0;
+      break;
+    case HANDLER::SKIP_NE_REG:
+      pc += (V(inst.x) != V(inst.y)) ? 2 : 0;
+      break;
+    case HANDLER::MOV:
+      V(inst.x) = inst.n;
+      break;
+    case HANDLER::ADD:
+      V(inst.x) += inst.n;
+      break;
+    case HANDLER::ALU_MOV:
+      V(inst.x) = V(inst.y);
+      break;
+    case HANDLER::ALU_OR:
+      V(inst.x) |= V(inst.y);
+      if constexpr (Q::enable_flags_reset) {
+        V(0xf) = 0;
+      }
+      break;
+    case HANDLER::ALU_AND:
+      V(inst.x) &= V(inst.y);
+      if constexpr (Q::enable_flags_reset) {
+        V(0xf) = 0;
+      }
+      break;
+    case HANDLER::ALU_XOR:
+      V(inst.x) ^= V(inst.y);
+      if constexpr (Q::enable_flags_reset) {
+        V(0xf) = 0;
+      }
+      break;
+    case HANDLER::ALU_ADD:
+      tmp = V(inst.x);
+      V(inst.x) += V(inst.y);
+      V(0xf) = V(inst.x) < tmp;
+      break;
+    case HANDLER::ALU_SUB:
+      tmp = V(inst.x);
+      V(inst.x) -= V(inst.y);
+      V(0xf) = (V(inst.x) <= tmp) && (V(inst.y) <= tmp);
+      break;
+    case HANDLER::ALU_RSUB:
+      tmp = V(inst.x);
+      V(inst.x) = V(inst.y) - V(inst.x);
+      V(0xf) = tmp <= V(inst.y);
+      break;
+    case HANDLER::ALU_SHR:
+      if constexpr (!Q::shifting_ignores_y) {
+        V(inst.x) = V(inst.y);
+      }
+      tmp = V(inst.x) & 0b1;
+      V(inst.x) >>= 1;
+      V(0xf) = tmp;
+      break;
+    case HANDLER::ALU_SHL:
+      if constexpr (!Q::shifting_ignores_y) {
+        V(inst.x) = V(inst.y);
+      }
+      tmp = (V(inst.x) >> 7) & 0b1;
+      V(inst.x) <<= 1;
+      V(0xf) = tmp;
+      break;
+    case HANDLER::ALU_UNKNOWN:
+      break;
+    case HANDLER::LDI:
+      ir = inst.n;
+      break;
+    case HANDLER::JMP_OFF:
+      if constexpr (Q::jump_high_nubble_as_register) {
+        pc = inst.n + V(inst.x);
+      } else {
+        pc = inst.n + V(0);
+      }
+      break;
+    case HANDLER::RANDOM:
+      V(inst.x) = rng_next(rng_state[lane]) & inst.n;
+      break;
+    case HANDLER::DRAW: {
+      if (Q::vblank_wait && !is_vblank[lane]) {
+        // soft-block
+        pc = address;
+        break;
+      }
+
+      if (ir + inst.n > 0x4000) {
+        fault(lane, "I out of range", inst, address);
+        return;
+      }
+
+      V(0xf) = draw_sprite<Q>(
+        output_buffer[lane], &lane_ram[ir], inst.n, V(inst.x), V(inst.y)
+      );
+      is_vblank[lane] = false;
+      break;
+    }
+    case HANDLER::KEY_EQ:
+      if (key_states[(V(inst.x) * stride) + lane] == true) {
+        pc += 2;
+      }
+      break;
+    case HANDLER::KEY_NE:
+      if (key_states[(V(inst.x) * stride) + lane] == false) {
+        pc += 2;
+      }
+      break;
+    case HANDLER::GET_DT:
+      V(inst.x) = delay_timer[lane];
+      break;
+    case HANDLER::GET_KEY:
+      // if last key_event is not a release, soft-block
+      if (!is_blocking[lane]) {
+        last_key_event[lane] = {0, KEY_EVENT::NONE};
+        is_blocking[lane] = true;
+      }
+
+      if (last_key_event[lane].second != KEY_EVENT::RELEASE) {
+        pc -= 2;
+      } else {
+        V(inst.x) = last_key_event[lane].first;
+        is_blocking[lane] = false;
+        last_key_event[lane] = {0, KEY_EVENT::NONE};
+      }
+      break;
+    case HANDLER::SET_DT:
+      delay_timer[lane] = V(inst.x);
+      break;
+    case HANDLER::SET_ST:
+      sound_timer[lane] = V(inst.x);
+      break;
+    case HANDLER::GET_CHAR:
+      ir = char_pointer + (V(inst.x & 0xf) * 5);
+      break;
+    case HANDLER::ADD_IR:
+      ir += V(inst.x);
+      break;
+    case HANDLER::BCD:
+      if (ir + 3 > 0x4000) {
+        fault(lane, "I out of range", inst, address);
+        return;
+      }
+      lane_ram[ir]     =  V(inst.x)        / 100;
+      lane_ram[ir + 1] = (V(inst.x) % 100) /  10;
+      lane_ram[ir + 2] =  V(inst.x) %  10;
+      mark_written(ir, 3);
+      break;
+    case HANDLER::STORE_REG:
+      if (ir + inst.x + 1 > 0x4000) {
+        fault(lane, "I out of range", inst, address);
+        return;
+      }
+      for (std::size_t i = 0; i <= inst.x; ++i) {
+        lane_ram[ir + i] = V(i);
+      }
+      mark_written(ir, inst.x + 1);
+
+      if constexpr (Q::increment_index_register) {
+        ir += inst.x + 1;
+      }
+      break;
+    case HANDLER::LOAD_REG:
+      if (ir + inst.x + 1 > 0x4000) {
+        fault(lane, "I out of range", inst, address);
+        return;
+      }
+      for (std::size_t i = 0; i <= inst.x; ++i) {
+        V(i) = lane_ram[ir + i];
+      }
+
+      if constexpr (Q::increment_index_register) {
+        ir += inst.x + 1;
+      }
+      break;
+    default:
+      fault(lane, "NOT YET IMPLEMENTED", inst, address);
+  }
+}
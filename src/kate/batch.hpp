@@ -0,0 +1,120 @@
+#ifndef __KATE_BATCH__
+#define __KATE_BATCH__
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include "config.hpp"
+#include "interpreter.hpp"
+
+namespace kate {
+  // Runs the same rom on many machines ("lanes") at once.
+  //
+  // The machine state is kept as a structure of arrays: register vX of every
+  // lane is stored contiguously, as are the PCs, index registers and timers.
+  // While every lane is at the same address the instruction is decoded once
+  // and executed for all lanes together, using SIMD for the register
+  // instructions. When lanes diverge (a skip goes different ways, a key is
+  // only pressed in some lanes, etc.) they are stepped one at a time until
+  // their PCs meet again.
+  //
+  // Each lane behaves exactly like a kate::Interpreter given the same input.
+  // Instead of throwing, a lane that hits an error is stopped and the crash
+  // dump is kept, the other lanes carry on.
+  class Batch {
+  public:
+    Batch(std::size_t lanes, QUIRKS quirks=QUIRKS::COSMAC_VIP);
+
+    void reset();
+    void load_rom(const std::vector<std::uint8_t> &rom);
+
+    std::size_t size() const;
+    const Framebuffer &get_output_buffer(std::size_t lane) const;
+    std::uint8_t get_sound_timer(std::size_t lane) const;
+    std::uint64_t get_cycle_counter() const;
+    std::uint64_t get_lockstep_cycles() const;
+    bool is_faulted(std::size_t lane) const;
+    const std::string &get_error(std::size_t lane) const;
+
+    // As Interpreter::seed(), a lane given the same seed as an interpreter
+    // draws the same random numbers. Every lane starts with a seed of its
+    // own from std::random_device, the first form gives them all `seed`.
+    void seed(std::uint64_t seed);
+    void seed(std::size_t lane, std::uint64_t seed);
+
+    void decrement_timers();
+    void keypress(std::size_t lane, std::uint8_t k);
+    void keyrelease(std::size_t lane, std::uint8_t k);
+
+    void run(std::uint64_t cycles);
+    void vblank_trigger();
+
+  private:
+    template <typename Q> void run_impl(std::uint64_t cycles);
+    template <typename Q> void execute_lockstep(const Instruction &inst);
+    template <typename Q> void execute_diverged(const Instruction &inst);
+    template <typename Q> void execute_lane(
+      std::size_t lane, const Instruction &inst, std::uint16_t address
+    );
+    template <typename Q> void _8XYN(const Instruction &inst);
+    void skip(const Instruction &inst);
+
+    bool fetch_shared(std::uint16_t address, Instruction &inst);
+    void diverge();
+    void check_converged();
+    void mark_written(std::size_t address, std::size_t len);
+    void fault(
+      std::size_t lane, const std::string &msg, const Instruction &inst,
+      std::uint16_t address
+    );
+
+    std::size_t lanes;
+    // lanes rounded up to a whole number of vectors, the extra lanes are
+    // never active
+    std::size_t stride;
+
+    QUIRKS quirks;
+    void (Batch::*run_fn)(std::uint64_t);
+
+    // per lane, see rng_next()
+    std::vector<std::uint64_t> rng_state;
+
+    std::vector<std::uint8_t> ram;         // 0x4000 bytes per lane
+    std::vector<std::uint8_t> registers;   // [16][stride]
+    std::vector<std::uint8_t> key_states;  // [16][stride]
+    std::vector<std::uint16_t> stack;      // [16][stride]
+    std::vector<std::uint16_t> program_counter;
+    std::vector<std::uint16_t> stack_pointer;
+    std::vector<std::uint16_t> index_register;
+    std::vector<std::uint8_t> delay_timer;
+    std::vector<std::uint8_t> sound_timer;
+
+    std::vector<Framebuffer> output_buffer;
+    std::vector<std::uint8_t> is_blocking;
+    std::vector<std::uint8_t> is_vblank;
+    std::vector<std::pair<int, KEY_EVENT>> last_key_event;
+    std::uint64_t cycle_counter;
+    std::uint64_t lockstep_cycles;
+
+    // 0xff for lanes that are executing, 0x00 for faulted and padding lanes
+    std::vector<std::uint8_t> active;
+    std::size_t active_count;
+    std::vector<std::string> errors;
+
+    // while converged, `shared_pc` is the PC of every active lane and the
+    // per-lane `program_counter` entries are stale
+    bool converged;
+    std::uint16_t shared_pc;
+
+    // every lane starts with the same ram, so decoding can be shared for any
+    // address that no lane has written to yet
+    std::array<Instruction, 0x4000> decode_cache;
+    std::array<bool, 0x4000> decode_cache_valid;
+    std::array<bool, 0x4000> ram_written;
+  };
+}
+
+#endif // __KATE_BATCH__
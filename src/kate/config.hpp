@@ -4,67 +4,101 @@
 #include <array>
 #include <cstdint>
 
-#include <GLFW/glfw3.h>
-
 namespace kate {
-  // This value controls how fast the interpreter runs. Some programs may need
-  // this to be altered to run at the proper speed.
-  constexpr std::size_t instructions_per_second = 700;
+  // This value controls how fast the interpreter runs, as the number of
+  // instructions run every frame of the 60Hz display (11 is 660 per
+  // second). Some programs may need this to be altered to run at the proper
+  // speed.
+  constexpr std::size_t instructions_per_frame = 11;
+
+  // when the host falls behind, up to this many frames are run back to back
+  // to catch up, any more time than that is dropped
+  constexpr std::size_t max_catchup_frames = 4;
 
   // slowly fade the display to reduce flickering
   constexpr bool do_display_fade = true;
   constexpr std::uint8_t display_fade_rate = 64;
 
-  // keybindings
-  constexpr std::array<int, 16> key_map = {
-    GLFW_KEY_X, // keypad 0
-    GLFW_KEY_1, // keypad 1
-    GLFW_KEY_2, // keypad 2
-    GLFW_KEY_3, // keypad 3
-    GLFW_KEY_Q, // keypad 4
-    GLFW_KEY_W, // keypad 5
-    GLFW_KEY_E, // keypad 6
-    GLFW_KEY_A, // keypad 7
-    GLFW_KEY_S, // keypad 8
-    GLFW_KEY_D, // keypad 9
-    GLFW_KEY_Z, // keypad a
-    GLFW_KEY_C, // keypad b
-    GLFW_KEY_4, // keypad c
-    GLFW_KEY_R, // keypad d
-    GLFW_KEY_F, // keypad e
-    GLFW_KEY_V  // keypad f
-  };
+  // The beeper is streamed in `audio_buffer_count` buffers of
+  // `audio_buffer_samples` each. Smaller or fewer buffers lower the latency
+  // but make gaps more likely on a busy host.
+  constexpr unsigned int audio_sample_rate = 44100;
+  constexpr std::size_t audio_buffer_samples = 512;
+  constexpr std::size_t audio_buffer_count = 3;
+  constexpr double audio_tone_frequency = 440.0;
+  constexpr double audio_volume = 0.25;
+  // seconds to ramp the tone up and down, so it doesn't click
+  constexpr double audio_attack = 0.002;
+  constexpr double audio_release = 0.005;
+
+  // rewind history is capped at this many bytes, the oldest frames are
+  // dropped first. One full snapshot is kept every `rewind_keyframe_interval`
+  // frames, the frames in between are stored as differences from it.
+  constexpr std::size_t rewind_capacity = 32 * 1024 * 1024;
+  constexpr std::size_t rewind_keyframe_interval = 60;
+  // frames stepped back for each press of the rewind key
+  constexpr std::size_t rewind_step_frames = 60;
 
   /****************************************************************************
   * Some implementations differ in behaviour for various reasons, these flags *
-  * will enable/disable "quirks".                                             *
+  * will enable/disable "quirks". Each profile is a type, the interpreter is  *
+  * compiled once per profile so the flags cost nothing at runtime.           *
   *****************************************************************************
-  * quirks_enable_flags_reset                                                 *
+  * enable_flags_reset                                                        *
   *     8XY1, 8XY2, and 8XY3 reset the flags register to zero                 *
   *                                                                           *
-  * quirks_increment_index_register                                           *
+  * increment_index_register                                                  *
   *     FX55 and FX65 increment the index register                            *
   *                                                                           *
-  * quirks_vblank_wait                                                        *
+  * vblank_wait                                                               *
   *     Sprite drawing waits for the vblank interupt                          *
   *                                                                           *
-  * quirks_sprite_clipping                                                    *
+  * sprite_clipping                                                           *
   *     Sprite coordinates wrap, but sprites are clipped                      *
   *                                                                           *
-  * quirks_shifting_ignores_y                                                 *
+  * shifting_ignores_y                                                        *
   *     8XY6 and 8XYE ignore the Y register and shift X instead               *
   *                                                                           *
-  * quirks_jump_high_nubble_as_register                                       *
+  * jump_high_nubble_as_register                                              *
   *     Treat the highest nibble in BNNN as the register address              *
   ****************************************************************************/
 
   // COSMAC VIP CHIP-8
-  constexpr bool quirks_enable_flags_reset            = true;
-  constexpr bool quirks_increment_index_register      = true;
-  constexpr bool quirks_vblank_wait                   = true;
-  constexpr bool quirks_sprite_clipping               = true;
-  constexpr bool quirks_shifting_ignores_y            = false;
-  constexpr bool quirks_jump_high_nubble_as_register  = false;
+  struct COSMAC_VIP {
+    static constexpr bool enable_flags_reset            = true;
+    static constexpr bool increment_index_register      = true;
+    static constexpr bool vblank_wait                   = true;
+    static constexpr bool sprite_clipping               = true;
+    static constexpr bool shifting_ignores_y            = false;
+    static constexpr bool jump_high_nubble_as_register  = false;
+  };
+
+  // SUPER-CHIP (1.1, as found on the HP48)
+  struct SUPER_CHIP {
+    static constexpr bool enable_flags_reset            = false;
+    static constexpr bool increment_index_register      = false;
+    static constexpr bool vblank_wait                   = false;
+    static constexpr bool sprite_clipping               = true;
+    static constexpr bool shifting_ignores_y            = true;
+    static constexpr bool jump_high_nubble_as_register  = true;
+  };
+
+  // XO-CHIP
+  struct XO_CHIP {
+    static constexpr bool enable_flags_reset            = false;
+    static constexpr bool increment_index_register      = true;
+    static constexpr bool vblank_wait                   = false;
+    static constexpr bool sprite_clipping               = false;
+    static constexpr bool shifting_ignores_y            = false;
+    static constexpr bool jump_high_nubble_as_register  = false;
+  };
+
+  // used to select one of the profiles above at runtime
+  enum class QUIRKS {
+    COSMAC_VIP,
+    SUPER_CHIP,
+    XO_CHIP
+  };
 
   /****************************************************************************
   / Internal Configuration.                                                   /
@@ -75,6 +109,9 @@ namespace kate {
   constexpr std::size_t SCR_W = 64;
   constexpr std::size_t SCR_H = 32;
   constexpr std::size_t display_refresh_rate = 60;
+  // the rate the interpreter runs at, to turn cycle counts into time
+  constexpr std::size_t instructions_per_second =
+    instructions_per_frame * display_refresh_rate;
 
   // location of the first address to execute
   constexpr std::uint16_t entry_point   = 0x0200;
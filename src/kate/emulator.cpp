@@ -0,0 +1,246 @@
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../util/image.hpp"
+#include "../util/io.hpp"
+#include "../util/timer.hpp"
+#include "emulator.hpp"
+#include "savestate.hpp"
+
+static const std::filesystem::path screenshot_directory = "output";
+static const std::filesystem::path state_path = "output/quicksave.state";
+
+kate::Emulator::Emulator(Interpreter &interpreter, MoviePlayer *player)
+: interpreter(interpreter), player(player), frame_number(0),
+  published_generation(0), stopping(false), running(false) {
+  // there is always a frame to show, even before the first one is run.
+  // Nothing has been drawn yet, so every row is dirty.
+  interpreter.take_dirty_rows();
+  frames.get_back() = {
+    interpreter.get_output_buffer(), 0, 0,
+    interpreter.get_framebuffer_generation(), 0, all_rows
+  };
+  published_generation = interpreter.get_framebuffer_generation();
+  frames.publish();
+}
+
+kate::Emulator::~Emulator() {
+  stop();
+}
+
+void kate::Emulator::start() {
+  if (thread.joinable()) {
+    return;
+  }
+
+  stopping = false;
+  running = true;
+  thread = std::thread(&Emulator::thread_main, this);
+}
+
+void kate::Emulator::stop() {
+  if (!thread.joinable()) {
+    return;
+  }
+
+  stopping = true;
+  thread.join();
+  running = false;
+}
+
+bool kate::Emulator::is_running() const {
+  return running;
+}
+
+bool kate::Emulator::send(const Command &command) {
+  return commands.push(command);
+}
+
+bool kate::Emulator::update_frame() {
+  return frames.update();
+}
+
+const kate::Frame &kate::Emulator::get_frame() const {
+  return frames.get_front();
+}
+
+bool kate::Emulator::pop_sound_edge(SoundEdge &edge) {
+  return sound_edges.pop(edge);
+}
+
+void kate::Emulator::thread_main() {
+  utils::FrameScheduler scheduler {display_refresh_rate, max_catchup_frames};
+  std::uint64_t dropped = 0;
+
+  while (!stopping) {
+    std::size_t count = scheduler.wait();
+
+    if (scheduler.get_dropped() > dropped) {
+      std::cout << "WARNING: running slow! dropped ";
+      std::cout << scheduler.get_dropped() - dropped << " frames" << std::endl;
+      dropped = scheduler.get_dropped();
+    }
+
+    process_commands();
+    forward_sound_edges();
+
+    for (std::size_t i = 0; i < count; ++i) {
+      bool ok = run_frame();
+      forward_sound_edges();
+
+      if (!ok) {
+        publish_frame();
+        running = false;
+        return;
+      }
+    }
+
+    publish_frame();
+  }
+}
+
+void kate::Emulator::process_commands() {
+  Command c;
+
+  while (commands.pop(c)) {
+    switch (c.type) {
+      case COMMAND::KEYPRESS:
+        if (!player) {
+          interpreter.keypress(c.key);
+        }
+        break;
+
+      case COMMAND::KEYRELEASE:
+        if (!player) {
+          interpreter.keyrelease(c.key);
+        }
+        break;
+
+      case COMMAND::SAVE_STATE: {
+        State state;
+        interpreter.save_state(state);
+
+        if (utils::write_binary(
+          state_path,
+          kate::serialize_state(state, interpreter.get_quirks()), true
+        ) == 0) {
+          std::cout << "Saved state to " << state_path << std::endl;
+        }
+        break;
+      }
+
+      case COMMAND::LOAD_STATE: {
+        if (player) {
+          break;
+        }
+
+        std::vector<std::uint8_t> data = utils::read_binary(state_path);
+        if (data.empty()) {
+          break;
+        }
+
+        try {
+          QUIRKS quirks;
+          State state = kate::deserialize_state(data, quirks);
+
+          interpreter.set_quirks(quirks);
+          interpreter.load_state(state);
+          std::cout << "Loaded state from " << state_path << std::endl;
+        } catch (invalid_state &e) {
+          std::cerr << e.what() << std::endl;
+        }
+        break;
+      }
+
+      case COMMAND::REWIND: {
+        if (player) {
+          break;
+        }
+
+        State state;
+        std::size_t count = 0;
+        while ((count < rewind_step_frames) && rewind.pop(state)) {
+          ++count;
+        }
+
+        if (count > 0) {
+          interpreter.load_state(state);
+        }
+
+        std::cout << "Rewound " << count << " frames, " << rewind.frames();
+        std::cout << " left (" << rewind.memory_used() / 1024 << " of ";
+        std::cout << rewind.capacity() / 1024 << " KiB)" << std::endl;
+        break;
+      }
+
+      case COMMAND::SCREENSHOT: {
+        std::string fn = interpreter.debug_filename();
+
+        utils::save_pnm_packed(
+          framebuffer_bytes(interpreter.get_output_buffer()),
+          SCR_W, SCR_H, screenshot_directory, fn, utils::PGM_RAW, true, "1"
+        );
+
+        std::cout << "Saved file " << fn << " to " << screenshot_directory;
+        std::cout << std::endl;
+        break;
+      }
+    }
+  }
+}
+
+bool kate::Emulator::run_frame() {
+  if (player) {
+    // the movie triggers vblank and the timers itself
+    try {
+      player->run(instructions_per_frame);
+    } catch (interpreter_error &e) {
+      std::cerr << e.what() << std::endl;
+      return false;
+    }
+
+    if (player->finished()) {
+      std::cout << "Replay finished" << std::endl;
+      return false;
+    }
+  } else {
+    if (interpreter.run_frame() == STOP_REASON::ERROR) {
+      std::cerr << interpreter.get_error() << std::endl;
+      return false;
+    }
+
+    interpreter.vblank_trigger();
+    interpreter.decrement_timers();
+  }
+
+  interpreter.save_state(snapshot);
+  rewind.push(snapshot);
+  ++frame_number;
+
+  return true;
+}
+
+void kate::Emulator::publish_frame() {
+  Frame &frame = frames.get_back();
+  frame.buffer = interpreter.get_output_buffer();
+  frame.sound_timer = interpreter.get_sound_timer();
+  frame.number = frame_number;
+
+  frame.generation = interpreter.get_framebuffer_generation();
+  frame.base_generation = published_generation;
+  frame.dirty_rows = interpreter.take_dirty_rows();
+  published_generation = frame.generation;
+
+  frames.publish();
+}
+
+void kate::Emulator::forward_sound_edges() {
+  new_sound_edges.clear();
+  interpreter.take_sound_edges(new_sound_edges);
+
+  for (const SoundEdge &edge : new_sound_edges) {
+    sound_edges.push(edge);
+  }
+}
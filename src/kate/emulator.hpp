@@ -0,0 +1,107 @@
+#ifndef __KATE_EMULATOR__
+#define __KATE_EMULATOR__
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+#include "../util/spsc_queue.hpp"
+#include "../util/triple_buffer.hpp"
+#include "config.hpp"
+#include "interpreter.hpp"
+#include "movie.hpp"
+#include "rewind.hpp"
+
+namespace kate {
+  // what the renderer needs from one emulated frame
+  struct Frame {
+    Framebuffer buffer;
+    std::uint8_t sound_timer;
+    std::uint64_t number;
+
+    // the framebuffer generation of this frame and of the one published
+    // before it, and the rows that changed in between. A renderer that has
+    // skipped frames sees that `base_generation` isn't the one it last drew
+    // and has to redraw every row.
+    std::uint64_t generation;
+    std::uint64_t base_generation;
+    RowMask dirty_rows;
+  };
+
+  enum class COMMAND : std::uint8_t {
+    KEYPRESS,
+    KEYRELEASE,
+    SAVE_STATE,
+    LOAD_STATE,
+    REWIND,
+    SCREENSHOT
+  };
+
+  struct Command {
+    COMMAND type;
+    std::uint8_t key;
+  };
+
+  // Runs an interpreter on its own thread, a frame at a time at
+  // display_refresh_rate, so that a slow renderer can't hold it up.
+  //
+  // The host send()s input and other commands through a lock-free queue,
+  // they are applied at the start of the next frame. Each finished frame is
+  // published through a triple buffer, update_frame() picks up the newest.
+  // Beeper edges are passed on as soon as each frame has run, through a
+  // second queue for the audio thread. While the thread is running the
+  // interpreter must not be touched from anywhere else.
+  class Emulator {
+  public:
+    // with a `player` the movie supplies the input, vblank and timers,
+    // and key, load and rewind commands are ignored
+    Emulator(Interpreter &interpreter, MoviePlayer *player=nullptr);
+    ~Emulator();
+
+    void start();
+    // stops the thread and waits for it, after which the interpreter can
+    // be used directly again
+    void stop();
+    // false once the machine has crashed or the movie has finished
+    bool is_running() const;
+
+    // returns false if the queue is full, the command can be sent again
+    bool send(const Command &command);
+
+    // returns true if a new frame has been published since the last call
+    bool update_frame();
+    const Frame &get_frame() const;
+
+    // Returns false if there are no more edges. Only one thread may take
+    // them, if nobody does they are dropped once the queue is full.
+    bool pop_sound_edge(SoundEdge &edge);
+
+  private:
+    void thread_main();
+    void process_commands();
+    bool run_frame();
+    void publish_frame();
+    void forward_sound_edges();
+
+    Interpreter &interpreter;
+    MoviePlayer *player;
+    Rewind rewind;
+    State snapshot;
+    std::uint64_t frame_number;
+    std::uint64_t published_generation;
+
+    std::thread thread;
+    std::atomic<bool> stopping;
+    std::atomic<bool> running;
+
+    utils::SPSCQueue<Command, 64> commands;
+    utils::TripleBuffer<Frame> frames;
+
+    utils::SPSCQueue<SoundEdge, 256> sound_edges;
+    std::vector<SoundEdge> new_sound_edges;
+  };
+}
+
+#endif // __KATE_EMULATOR__
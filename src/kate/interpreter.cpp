@@ -1,9 +1,15 @@
-#include <algorithm> // std::copy
+#include <algorithm> // std::copy, std::fill, std::min
 #include <iomanip>
+#include <random> // std::random_device
 #include <sstream>
+#include <utility> // std::exchange
 #include <iostream>
 
+#include <cstring> // std::memcpy
+
 #include "interpreter.hpp"
+#include "movie.hpp"
+#include "native.hpp"
 
 /******************************************************************************
 / Exceptions                                                                  /
@@ -30,6 +36,37 @@ kate::stack_overflow::stack_overflow(const std::string &msg)
 kate::stack_overflow::stack_overflow(const char *msg)
 : interpreter_error(msg) {}
 
+kate::stack_underflow::stack_underflow(const std::string &msg)
+: interpreter_error(msg) {}
+kate::stack_underflow::stack_underflow(const char *msg)
+: interpreter_error(msg) {}
+
+std::vector<std::uint8_t> kate::unpack_framebuffer(const Framebuffer &fb) {
+  std::vector<std::uint8_t> pixels;
+  pixels.reserve(SCR_W * SCR_H);
+
+  for (std::uint64_t row : fb) {
+    for (std::size_t x = 0; x < SCR_W; ++x) {
+      pixels.push_back((row >> (SCR_W - 1 - x)) & 1);
+    }
+  }
+
+  return pixels;
+}
+
+std::vector<std::uint8_t> kate::framebuffer_bytes(const Framebuffer &fb) {
+  std::vector<std::uint8_t> bytes;
+  bytes.reserve(SCR_W * SCR_H / 8);
+
+  for (std::uint64_t row : fb) {
+    for (int shift = SCR_W - 8; shift >= 0; shift -= 8) {
+      bytes.push_back((row >> shift) & 0xff);
+    }
+  }
+
+  return bytes;
+}
+
 std::string kate::decode_INSTRUCTION(INSTRUCTION inst) {
   switch (inst) {
     case CLEAR        : return "CLEAR";
@@ -54,6 +91,70 @@ std::string kate::decode_INSTRUCTION(INSTRUCTION inst) {
   }
 }
 
+std::string kate::decode_HANDLER(HANDLER handler) {
+  switch (handler) {
+    case HANDLER::INVALID     : return "INVALID";
+    case HANDLER::CLEAR       : return "CLEAR";
+    case HANDLER::RET         : return "RET";
+    case HANDLER::JMP         : return "JMP";
+    case HANDLER::CALL        : return "CALL";
+    case HANDLER::SKIP_EQ_IMM : return "SKIP_EQ_IMM";
+    case HANDLER::SKIP_NE_IMM : return "SKIP_NE_IMM";
+    case HANDLER::SKIP_EQ_REG : return "SKIP_EQ_REG";
+    case HANDLER::SKIP_NE_REG : return "SKIP_NE_REG";
+    case HANDLER::MOV         : return "MOV";
+    case HANDLER::ADD         : return "ADD";
+    case HANDLER::ALU_MOV     : return "ALU_MOV";
+    case HANDLER::ALU_OR      : return "ALU_OR";
+    case HANDLER::ALU_AND     : return "ALU_AND";
+    case HANDLER::ALU_XOR     : return "ALU_XOR";
+    case HANDLER::ALU_ADD     : return "ALU_ADD";
+    case HANDLER::ALU_SUB     : return "ALU_SUB";
+    case HANDLER::ALU_RSUB    : return "ALU_RSUB";
+    case HANDLER::ALU_SHR     : return "ALU_SHR";
+    case HANDLER::ALU_SHL     : return "ALU_SHL";
+    case HANDLER::ALU_UNKNOWN : return "ALU_UNKNOWN";
+    case HANDLER::LDI         : return "LDI";
+    case HANDLER::JMP_OFF     : return "JMP_OFF";
+    case HANDLER::RANDOM      : return "RANDOM";
+    case HANDLER::DRAW        : return "DRAW";
+    case HANDLER::KEY_EQ      : return "KEY_EQ";
+    case HANDLER::KEY_NE      : return "KEY_NE";
+    case HANDLER::GET_DT      : return "GET_DT";
+    case HANDLER::GET_KEY     : return "GET_KEY";
+    case HANDLER::SET_DT      : return "SET_DT";
+    case HANDLER::SET_ST      : return "SET_ST";
+    case HANDLER::GET_CHAR    : return "GET_CHAR";
+    case HANDLER::ADD_IR      : return "ADD_IR";
+    case HANDLER::BCD         : return "BCD";
+    case HANDLER::STORE_REG   : return "STORE_REG";
+    case HANDLER::LOAD_REG    : return "LOAD_REG";
+    case HANDLER::FUSED_DRAW  : return "FUSED_DRAW";
+    case HANDLER::FUSED_WAIT  : return "FUSED_WAIT";
+    case HANDLER::FUSED_LOAD  : return "FUSED_LOAD";
+    default                   : return "UNKNOWN HANDLER";
+  }
+}
+
+std::string kate::decode_QUIRKS(QUIRKS quirks) {
+  switch (quirks) {
+    case QUIRKS::COSMAC_VIP : return "cosmac-vip";
+    case QUIRKS::SUPER_CHIP : return "super-chip";
+    case QUIRKS::XO_CHIP    : return "xo-chip";
+    default                 : return "UNKNOWN QUIRKS";
+  }
+}
+
+kate::QUIRKS kate::quirks_from_string(const std::string &name) {
+  for (QUIRKS q : {QUIRKS::COSMAC_VIP, QUIRKS::SUPER_CHIP, QUIRKS::XO_CHIP}) {
+    if (decode_QUIRKS(q) == name) {
+      return q;
+    }
+  }
+
+  throw interpreter_error("unknown quirks profile: " + name);
+}
+
 std::string kate::hex_string(std::size_t i, std::size_t w, bool b) {
   std::stringstream ss;
   if (b) {
@@ -64,40 +165,282 @@ std::string kate::hex_string(std::size_t i, std::size_t w, bool b) {
   return ss.str();
 }
 
+kate::Instruction kate::decode_instruction(std::uint16_t raw) {
+  Instruction inst = {raw, NOP, 0, 0, 0, HANDLER::INVALID};
+
+  std::uint8_t o = (raw & 0xf000) >> 12;
+  switch (o) {
+    case 0x00: case 0x0e:
+      inst.inst = static_cast<INSTRUCTION>(raw & 0x00ff);
+      inst.x = (raw & 0x0f00) >> 8;
+      break;
+    case 0x01: case 0x02: case 0x0a:
+      inst.inst = static_cast<INSTRUCTION>(o);
+      inst.n = raw & 0x0fff;;
+      break;
+    case 0x0b:
+      inst.inst = static_cast<INSTRUCTION>(o);
+      inst.x = (raw & 0x0f00) >> 8;
+      inst.n = raw & 0x0fff;;
+      break;
+    case 0x03: case 0x04: case 0x06: case 0x07: case 0x0c: case 0x0f:
+      inst.inst = static_cast<INSTRUCTION>(o);
+      inst.x = (raw & 0x0f00) >> 8;
+      inst.n = raw & 0x00ff;
+      break;
+    case 0x05: case 0x08: case 0x09: case 0x0d:
+      inst.inst = static_cast<INSTRUCTION>(o);
+      inst.x = (raw & 0x0f00) >> 8;
+      inst.y = (raw & 0x00f0) >> 4;
+      inst.n = (raw & 0x000f);
+      break;
+  }
+
+  // resolve the handler, ALU and MISC instructions are split by operation
+  switch (inst.inst) {
+    case CLEAR        : inst.handler = HANDLER::CLEAR;        break;
+    case RET          : inst.handler = HANDLER::RET;          break;
+    case JMP          : inst.handler = HANDLER::JMP;          break;
+    case CALL         : inst.handler = HANDLER::CALL;         break;
+    case SKIP_EQ_IMM  : inst.handler = HANDLER::SKIP_EQ_IMM;  break;
+    case SKIP_NE_IMM  : inst.handler = HANDLER::SKIP_NE_IMM;  break;
+    case SKIP_EQ_REG  : inst.handler = HANDLER::SKIP_EQ_REG;  break;
+    case SKIP_NE_REG  : inst.handler = HANDLER::SKIP_NE_REG;  break;
+    case MOV          : inst.handler = HANDLER::MOV;          break;
+    case ADD          : inst.handler = HANDLER::ADD;          break;
+    case LDI          : inst.handler = HANDLER::LDI;          break;
+    case JMP_OFF      : inst.handler = HANDLER::JMP_OFF;      break;
+    case RANDOM       : inst.handler = HANDLER::RANDOM;       break;
+    case DRAW         : inst.handler = HANDLER::DRAW;         break;
+    case KEY_EQ       : inst.handler = HANDLER::KEY_EQ;       break;
+    case KEY_NE       : inst.handler = HANDLER::KEY_NE;       break;
+    case ALU:
+      switch (static_cast<ALU_OP>(inst.n)) {
+        case ALU_OP::MOV  : inst.handler = HANDLER::ALU_MOV;  break;
+        case ALU_OP::OR   : inst.handler = HANDLER::ALU_OR;   break;
+        case ALU_OP::AND  : inst.handler = HANDLER::ALU_AND;  break;
+        case ALU_OP::XOR  : inst.handler = HANDLER::ALU_XOR;  break;
+        case ALU_OP::ADD  : inst.handler = HANDLER::ALU_ADD;  break;
+        case ALU_OP::SUB  : inst.handler = HANDLER::ALU_SUB;  break;
+        case ALU_OP::RSUB : inst.handler = HANDLER::ALU_RSUB; break;
+        case ALU_OP::SHR  : inst.handler = HANDLER::ALU_SHR;  break;
+        case ALU_OP::SHL  : inst.handler = HANDLER::ALU_SHL;  break;
+        default           : inst.handler = HANDLER::ALU_UNKNOWN;
+      }
+      break;
+    case MISC:
+      switch (static_cast<MISC_OP>(inst.n)) {
+        case MISC_OP::GET_DT    : inst.handler = HANDLER::GET_DT;    break;
+        case MISC_OP::GET_KEY   : inst.handler = HANDLER::GET_KEY;   break;
+        case MISC_OP::SET_DT    : inst.handler = HANDLER::SET_DT;    break;
+        case MISC_OP::SET_ST    : inst.handler = HANDLER::SET_ST;    break;
+        case MISC_OP::GET_CHAR  : inst.handler = HANDLER::GET_CHAR;  break;
+        case MISC_OP::ADD_IR    : inst.handler = HANDLER::ADD_IR;    break;
+        case MISC_OP::BCD       : inst.handler = HANDLER::BCD;       break;
+        case MISC_OP::STORE_REG : inst.handler = HANDLER::STORE_REG; break;
+        case MISC_OP::LOAD_REG  : inst.handler = HANDLER::LOAD_REG;  break;
+        default                 : inst.handler = HANDLER::INVALID;
+      }
+      break;
+    default:
+      inst.handler = HANDLER::INVALID;
+  }
+
+  return inst;
+}
+
+// the handler of the first instruction of a superinstruction
+static kate::HANDLER unfused(kate::HANDLER handler) {
+  switch (handler) {
+    case kate::HANDLER::FUSED_DRAW : return kate::HANDLER::MOV;
+    case kate::HANDLER::FUSED_WAIT : return kate::HANDLER::GET_DT;
+    case kate::HANDLER::FUSED_LOAD : return kate::HANDLER::ADD_IR;
+    default                        : return handler;
+  }
+}
+
+// in instructions, of the longest superinstruction
+constexpr std::uint64_t max_fused_length = 3;
+
+// the most instructions a superinstruction can run, 1 for any other handler
+static std::uint64_t fused_length(kate::HANDLER handler) {
+  switch (handler) {
+    case kate::HANDLER::FUSED_DRAW : return 3;
+    case kate::HANDLER::FUSED_WAIT : return 3;
+    case kate::HANDLER::FUSED_LOAD : return 2;
+    default                        : return 1;
+  }
+}
+
+kate::HANDLER kate::fused_handler(
+  const Instruction &inst, const std::uint8_t *next
+) {
+  // Only the first instruction of each sequence can start another, so an
+  // address is never both part of one superinstruction and the start of a
+  // different one.
+  switch (inst.handler) {
+    case HANDLER::MOV:
+      if (((next[0] >> 4) == 0x6) && ((next[2] >> 4) == 0xd)) {
+        return HANDLER::FUSED_DRAW;
+      }
+      break;
+    case HANDLER::GET_DT:
+      if (
+        (next[0] == (0x30 | inst.x)) && (next[1] == 0x00) &&
+        ((next[2] >> 4) == 0x1)
+      ) {
+        return HANDLER::FUSED_WAIT;
+      }
+      break;
+    case HANDLER::ADD_IR:
+      if (((next[0] >> 4) == 0xf) && (next[1] == 0x65)) {
+        return HANDLER::FUSED_LOAD;
+      }
+      break;
+    default:
+      break;
+  }
+
+  return inst.handler;
+}
+
+// true if `address` holds FX07 3X00 1NNN jumping back to the FX07, which
+// does nothing but wait for the delay timer to run out
+static bool is_idle_loop(
+  const std::array<std::uint8_t, 0x4000> &ram, std::size_t address
+) {
+  if (address >= 0x1000) {
+    return false;
+  }
+
+  const std::uint8_t *p = &ram[address];
+  std::size_t jump = (p[4] << 8) | p[5];
+  return ((p[0] >> 4) == 0xf) && (p[1] == 0x07) &&
+         (p[2] == (0x30 | (p[0] & 0x0f))) && (p[3] == 0x00) &&
+         (jump == (0x1000 | address));
+}
+
 /******************************************************************************
 / Interpreter                                                                 /
 ******************************************************************************/
-kate::Interpreter::Interpreter() {
+kate::Interpreter::Interpreter(QUIRKS quirks)
+: recording(nullptr), waiting(STOP_REASON::BUDGET),
+  framebuffer_generation(0), dirty_rows(0), beeper(false), native(nullptr) {
+  decode_cache_epoch.fill(0);
+  decode_epoch = 0;
+
+#ifdef KATE_PROFILE
+  profile = {};
+#endif
+
+  set_quirks(quirks);
   reset();
 
   std::random_device rd;
-  e.seed(rd());
-  dist = std::uniform_int_distribution<int>(0x00, 0xff);
+  seed((static_cast<std::uint64_t>(rd()) << 32) | rd());
+}
+
+void kate::Interpreter::set_quirks(QUIRKS q) {
+  quirks = q;
+  // a DXYN may no longer wait for vblank
+  waiting = STOP_REASON::BUDGET;
+#ifdef KATE_USE_JIT
+  // blocks are compiled for one quirk profile
+  jit.clear();
+#endif
+
+  // native code is only good for the quirks it was compiled for
+  if (native && (native->quirks != quirks)) {
+    attach_native(nullptr);
+    return;
+  }
+
+  switch (quirks) {
+    case QUIRKS::COSMAC_VIP : select_handlers<COSMAC_VIP>(); break;
+    case QUIRKS::SUPER_CHIP : select_handlers<SUPER_CHIP>(); break;
+    case QUIRKS::XO_CHIP    : select_handlers<XO_CHIP>();    break;
+  }
+}
+
+template <typename Q>
+void kate::Interpreter::select_handlers() {
+#ifdef KATE_PROFILE
+  // the profiler counts every instruction, so everything is interpreted
+  constexpr bool use_native = false;
+#else
+  bool use_native = native != nullptr;
+#endif
+
+  if (use_native) {
+    run_fn = &Interpreter::run_impl<Q, false, true>;
+    run_for_fn = &Interpreter::run_impl<Q, true, true>;
+  } else {
+    run_fn = &Interpreter::run_impl<Q, false, false>;
+    run_for_fn = &Interpreter::run_impl<Q, true, false>;
+  }
+  execute_fn = &Interpreter::execute_impl<Q>;
+}
+
+kate::QUIRKS kate::Interpreter::get_quirks() const {
+  return quirks;
+}
+
+void kate::Interpreter::attach_native(const NativeModule *module) {
+  if (module && (module->quirks != quirks)) {
+    throw interpreter_error(
+      "native code was compiled for " + decode_QUIRKS(module->quirks) +
+      ", not " + decode_QUIRKS(quirks)
+    );
+  }
+
+  native = module;
+  native_blocks.clear();
+  native_bytes.clear();
+
+  if (native) {
+    native_blocks.assign(state.ram.size(), nullptr);
+    native_bytes.assign(state.ram.size(), false);
+    for (std::size_t i = 0; i < native->block_count; ++i) {
+      const NativeBlock &block = native->blocks[i];
+      std::fill(
+        native_bytes.begin() + block.start, native_bytes.begin() + block.end,
+        true
+      );
+    }
+    refresh_native(0, state.ram.size());
+  }
+
+  set_quirks(quirks);
 }
 
 void kate::Interpreter::reset() {
-  ram.fill(0);
-  registers.fill(0);
-  key_states.fill(0);
-  stack.fill(0);
-  program_counter = entry_point;
-  stack_pointer = 0;
-  index_register = 0;
-  delay_timer = 0;
-  sound_timer = 0;
-
-  output_buffer.resize(SCR_W * SCR_H);
-  std::fill(output_buffer.begin(), output_buffer.end(), 0);
-  is_blocking = false;
-  is_vblank = false;
-  cur_inst = {0, NOP, 0, 0, 0};
-  cycle_counter = 0;
-  last_key_event = {0, KEY_EVENT::NONE};
+  state.ram.fill(0);
+  state.registers.fill(0);
+  state.key_states.fill(0);
+  state.stack.fill(0);
+  state.program_counter = entry_point;
+  state.stack_pointer = 0;
+  state.index_register = 0;
+  state.delay_timer = 0;
+  state.sound_timer = 0;
+
+  state.output_buffer.fill(0);
+  state.is_blocking = false;
+  state.is_vblank = false;
+  state.cur_inst = {0, NOP, 0, 0, 0, HANDLER::INVALID};
+  state.cycle_counter = 0;
+  state.prev_program_counter = 0;
+  state.last_key_event = {0, KEY_EVENT::NONE};
+  waiting = STOP_REASON::BUDGET;
+  drop_decode_cache();
+  error.clear();
+  mark_dirty(all_rows);
+  update_beeper();
 
   std::copy(
     char_data.begin(),
     char_data.end(),
-    &ram[char_pointer]
+    &state.ram[char_pointer]
   );
 }
 
@@ -107,34 +450,80 @@ void kate::Interpreter::load_rom(const std::vector<std::uint8_t> &rom) {
   std::copy(
     rom.begin(),
     rom.end(),
-    &ram[entry_point]
+    &state.ram[entry_point]
   );
+  refresh_native(entry_point, rom.size());
 }
 
-const std::vector<std::uint8_t> &kate::Interpreter::get_output_buffer() const {
-  return output_buffer;
+const kate::Framebuffer &kate::Interpreter::get_output_buffer() const {
+  return state.output_buffer;
+}
+
+std::uint64_t kate::Interpreter::get_framebuffer_generation() const {
+  return framebuffer_generation;
+}
+
+kate::RowMask kate::Interpreter::take_dirty_rows() {
+  return std::exchange(dirty_rows, 0);
 }
 
 std::uint8_t kate::Interpreter::get_sound_timer() const {
-  return sound_timer;
+  return state.sound_timer;
+}
+
+void kate::Interpreter::take_sound_edges(std::vector<SoundEdge> &out) {
+  out.insert(out.end(), sound_edges.begin(), sound_edges.end());
+  sound_edges.clear();
+}
+
+std::uint64_t kate::Interpreter::get_cycle_counter() const {
+  return state.cycle_counter;
+}
+
+const kate::Profile *kate::Interpreter::get_profile() const {
+#ifdef KATE_PROFILE
+  return &profile;
+#else
+  return nullptr;
+#endif
+}
+
+void kate::Interpreter::save_state(State &out) const {
+  std::memcpy(&out, &state, sizeof(State));
+}
+
+void kate::Interpreter::load_state(const State &in) {
+  std::memcpy(&state, &in, sizeof(State));
+
+  // the restored ram may hold different code
+  drop_decode_cache();
+  recording = nullptr;
+  waiting = STOP_REASON::BUDGET;
+  error.clear();
+  mark_dirty(all_rows);
+  update_beeper();
+}
+
+void kate::Interpreter::record(Movie *movie) {
+  recording = movie;
 }
 
 std::string kate::Interpreter::crashdump(const std::string &msg) const {
   std::stringstream ss;
   ss << "ABORTING EXECUTION: " << msg << '\n';
   ss << "------------------------------------------------------------------\n";
-  ss << " current cycle " << hex_string(cycle_counter, 8) << '\n';
-  ss << " current instruction " << hex_string(cur_inst.raw, 4, false);
-  ss << " ( " << decode_INSTRUCTION(cur_inst.inst) << " )\n";
+  ss << " current cycle " << hex_string(state.cycle_counter, 8) << '\n';
+  ss << " current instruction " << hex_string(state.cur_inst.raw, 4, false);
+  ss << " ( " << decode_INSTRUCTION(state.cur_inst.inst) << " )\n";
   ss << "------------------------------------------------------------------\n";
-  ss << " PC : " << hex_string(prev_program_counter, 4) << " . ";
-  ss << " SP : " << hex_string(stack_pointer, 4) << " . ";
-  ss << " IR : " << hex_string(index_register, 4) << '\n';
+  ss << " PC : " << hex_string(state.prev_program_counter, 4) << " . ";
+  ss << " SP : " << hex_string(state.stack_pointer, 4) << " . ";
+  ss << " IR : " << hex_string(state.index_register, 4) << '\n';
   ss << "------------------------------------------------------------------\n";
   ss << "      STACK  | REGISTERS\n";
   for (std::size_t i = 0; i <= 0xf; ++i) {
-    ss << hex_string(i, 1) << " : " << hex_string(stack[i], 4) << " | ";
-    ss << hex_string(registers[i], 2) << '\n';
+    ss << hex_string(i, 1) << " : " << hex_string(state.stack[i], 4) << " | ";
+    ss << hex_string(state.registers[i], 2) << '\n';
   }
   ss << "------------------------------------------------------------------\n";
 
@@ -143,370 +532,1057 @@ std::string kate::Interpreter::crashdump(const std::string &msg) const {
 
 std::string kate::Interpreter::debug_line() const {
   std::stringstream ss;
-  ss << "PC : " << kate::hex_string(prev_program_counter, 4) << " . ";
+  ss << "PC : " << kate::hex_string(state.prev_program_counter, 4) << " . ";
   ss << "inst : ";
-  ss << kate::hex_string(cur_inst.raw, 4, false) << " ( ";
-  ss << decode_INSTRUCTION(cur_inst.inst) << " )";
+  ss << kate::hex_string(state.cur_inst.raw, 4, false) << " ( ";
+  ss << decode_INSTRUCTION(state.cur_inst.inst) << " )";
 
   return ss.str();
 }
 
 std::string kate::Interpreter::debug_filename() const {
   std::stringstream ss;
-  ss << kate::hex_string(cycle_counter, 8, false) << "_";
-  ss << kate::hex_string(prev_program_counter, 4, false) << "_";
-  ss << kate::hex_string(cur_inst.raw, 4, false);
+  ss << kate::hex_string(state.cycle_counter, 8, false) << "_";
+  ss << kate::hex_string(state.prev_program_counter, 4, false) << "_";
+  ss << kate::hex_string(state.cur_inst.raw, 4, false);
 
   return ss.str();
 }
 
 
 void kate::Interpreter::decrement_timers() {
-  if (delay_timer > 0) {
-    --delay_timer;
+  if (recording) {
+    recording->events.push_back(
+      {state.cycle_counter, MOVIE_EVENT::TIMERS, 0}
+    );
   }
-  if (sound_timer > 0) {
-    --sound_timer;
+
+  if (state.delay_timer > 0) {
+    --state.delay_timer;
+  }
+  if (state.sound_timer > 0) {
+    --state.sound_timer;
+    update_beeper();
   }
 }
 
 void kate::Interpreter::keypress(std::uint8_t k) {
-  key_states[k] = true;
-  last_key_event = {k, KEY_EVENT::PRESS};
+  if (recording) {
+    recording->events.push_back({state.cycle_counter, MOVIE_EVENT::PRESS, k});
+  }
+
+  state.key_states[k] = true;
+  state.last_key_event = {k, KEY_EVENT::PRESS};
 }
 
 void kate::Interpreter::keyrelease(std::uint8_t k) {
-  key_states[k] = false;
-  last_key_event = {k, KEY_EVENT::RELEASE};
+  if (recording) {
+    recording->events.push_back(
+      {state.cycle_counter, MOVIE_EVENT::RELEASE, k}
+    );
+  }
+
+  state.key_states[k] = false;
+  state.last_key_event = {k, KEY_EVENT::RELEASE};
+  if (waiting == STOP_REASON::KEY_WAIT) {
+    waiting = STOP_REASON::BUDGET;
+  }
 }
 
 
+void kate::Interpreter::seed(std::uint64_t seed) {
+  rng_seed = seed;
+  state.rng_state = rng_from_seed(seed);
+}
+
+std::uint64_t kate::Interpreter::get_seed() const {
+  return rng_seed;
+}
+
 std::uint8_t kate::Interpreter::random_uint8() {
-  return dist(e);
+  return rng_next(state.rng_state);
 }
 
 void kate::Interpreter::step() {
-  fetch();
-  decode();
-  execute();
+  if (waiting == STOP_REASON::BUDGET) {
+    next_instruction();
+    state.cur_inst.handler = unfused(state.cur_inst.handler);
+    execute();
+
+    STOP_REASON reason;
+    is_stopped(reason);
+  }
+
+  ++state.cycle_counter;
+}
+
+void kate::Interpreter::run(std::uint64_t cycles) {
+  (this->*run_fn)(cycles);
+}
+
+kate::STOP_REASON kate::Interpreter::run_for(std::uint64_t cycles) {
+  if (!error.empty()) {
+    return STOP_REASON::ERROR;
+  }
+
+  // the try block costs nothing until something is thrown, so the checks
+  // stay out of the loop
+  try {
+    return (this->*run_for_fn)(cycles);
+  } catch (interpreter_error &e) {
+    error = e.what();
+    return STOP_REASON::ERROR;
+  }
+}
+
+kate::STOP_REASON kate::Interpreter::run_frame(std::uint64_t cycles) {
+  std::uint64_t end = state.cycle_counter + cycles;
+
+  STOP_REASON reason = run_for(cycles);
+  if ((reason != STOP_REASON::BUDGET) && (reason != STOP_REASON::ERROR)) {
+    // running the rest of the frame would only repeat the waiting
+    // instruction, which changes nothing but the cycle counter
+    state.cycle_counter = end;
+  }
+
+  return reason;
+}
+
+const std::string &kate::Interpreter::get_error() const {
+  return error;
+}
+
+void kate::Interpreter::execute() {
+  (this->*execute_fn)();
+}
+
+template <typename Q, bool stop_on_wait, bool use_native>
+kate::STOP_REASON kate::Interpreter::run_impl(std::uint64_t cycles) {
+  // still waiting from last time, running the instruction again would only
+  // repeat the wait
+  if (waiting != STOP_REASON::BUDGET) {
+    if constexpr (!stop_on_wait) {
+      state.cycle_counter += cycles;
+    }
+    return waiting;
+  }
+
+#ifdef KATE_THREADED_DISPATCH
+  // Direct threading: each handler jumps straight to the handler of the next
+  // instruction, rather than every instruction returning to one shared
+  // switch. This gives the branch predictor one indirect jump per handler to
+  // learn from instead of a single, unpredictable one.
+  static const void *labels[] = {
+    &&op_INVALID,
+    &&op_CLEAR,
+    &&op_RET,
+    &&op_JMP,
+    &&op_CALL,
+    &&op_SKIP_EQ_IMM,
+    &&op_SKIP_NE_IMM,
+    &&op_SKIP_EQ_REG,
+    &&op_SKIP_NE_REG,
+    &&op_MOV,
+    &&op_ADD,
+    &&op_ALU_MOV,
+    &&op_ALU_OR,
+    &&op_ALU_AND,
+    &&op_ALU_XOR,
+    &&op_ALU_ADD,
+    &&op_ALU_SUB,
+    &&op_ALU_RSUB,
+    &&op_ALU_SHR,
+    &&op_ALU_SHL,
+    &&op_ALU_UNKNOWN,
+    &&op_LDI,
+    &&op_JMP_OFF,
+    &&op_RANDOM,
+    &&op_DRAW,
+    &&op_KEY_EQ,
+    &&op_KEY_NE,
+    &&op_GET_DT,
+    &&op_GET_KEY,
+    &&op_SET_DT,
+    &&op_SET_ST,
+    &&op_GET_CHAR,
+    &&op_ADD_IR,
+    &&op_BCD,
+    &&op_STORE_REG,
+    &&op_LOAD_REG,
+    &&op_FUSED_DRAW,
+    &&op_FUSED_WAIT,
+    &&op_FUSED_LOAD
+  };
+  static_assert(
+    sizeof(labels) / sizeof(labels[0]) ==
+    static_cast<std::size_t>(HANDLER::COUNT)
+  );
+
+  #define DISPATCH()                                                    \
+    NATIVE_BLOCKS()                                                     \
+    JIT_BLOCKS()                                                        \
+    if (cycles == 0) {                                                  \
+      return STOP_REASON::BUDGET;                                       \
+    }                                                                   \
+    --cycles;                                                           \
+    next_instruction();                                                 \
+    goto *labels[static_cast<std::size_t>(state.cur_inst.handler)]
+
+  #define NEXT(handler)                                                 \
+    handler();                                                          \
+    ++state.cycle_counter;                                              \
+    DISPATCH()
+
+  // for the handlers that can leave the PC where it was
+  #define NEXT_OR_STOP(handler)                                         \
+    handler();                                                          \
+    ++state.cycle_counter;                                              \
+    STOP_IF_WAITING()                                                   \
+    DISPATCH()
+
+  // run_for() returns as soon as the machine stops, run() carries on past
+  // a jump to itself and counts the rest of a wait without running it
+  #define STOP_IF_WAITING()                                             \
+    if (is_stopped(reason)) {                                           \
+      if (stop_on_wait) {                                               \
+        return reason;                                                  \
+      } else if (reason != STOP_REASON::HALTED) {                       \
+        state.cycle_counter += cycles;                                  \
+        return reason;                                                  \
+      }                                                                 \
+    }
+
+  // a superinstruction that doesn't fit in the cycles left runs its first
+  // instruction alone, otherwise it counts the cycles of all but its last.
+  // Only a delay timer wait can end on a jump.
+  #define NEXT_FUSED(fused)                                             \
+    if (fused_length(state.cur_inst.handler) > cycles + 1) {            \
+      state.cur_inst.handler = unfused(state.cur_inst.handler);         \
+      goto *labels[static_cast<std::size_t>(state.cur_inst.handler)];   \
+    }                                                                   \
+    {                                                                   \
+      std::uint64_t start = state.cycle_counter;                        \
+      fused();                                                          \
+      cycles -= state.cycle_counter - start;                            \
+    }                                                                   \
+    if (state.cur_inst.handler == HANDLER::JMP) {                       \
+      cycles -= skip_idle(cycles);                                      \
+    }                                                                   \
+    ++state.cycle_counter;                                              \
+    STOP_IF_WAITING()                                                   \
+    DISPATCH()
+
+  // compiled blocks never end on an instruction that can stop the machine
+  #define NATIVE_BLOCKS()                                               \
+    if constexpr (use_native) {                                         \
+      while (std::uint64_t n = run_native(cycles)) {                    \
+        cycles -= n;                                                    \
+      }                                                                 \
+    }
+
+#ifdef KATE_USE_JIT
+  #define JIT_BLOCKS()                                                  \
+    while (std::uint64_t n = run_block<Q>(cycles)) {                    \
+      cycles -= n;                                                      \
+    }
+#else
+  #define JIT_BLOCKS()
+#endif
+
+  STOP_REASON reason;
+
+  DISPATCH();
+
+  op_INVALID      : NEXT(_INVALID);
+  op_CLEAR        : NEXT(_00E0);
+  op_RET          : NEXT(_00EE);
+  op_JMP          : NEXT_OR_STOP(_1NNN);
+  op_CALL         : NEXT(_2NNN);
+  op_SKIP_EQ_IMM  : NEXT(_3XNN);
+  op_SKIP_NE_IMM  : NEXT(_4XNN);
+  op_SKIP_EQ_REG  : NEXT(_5XY0);
+  op_SKIP_NE_REG  : NEXT(_9XY0);
+  op_MOV          : NEXT(_6XNN);
+  op_ADD          : NEXT(_7XNN);
+  op_ALU_MOV      : NEXT(_8XY0);
+  op_ALU_OR       : NEXT(_8XY1<Q>);
+  op_ALU_AND      : NEXT(_8XY2<Q>);
+  op_ALU_XOR      : NEXT(_8XY3<Q>);
+  op_ALU_ADD      : NEXT(_8XY4);
+  op_ALU_SUB      : NEXT(_8XY5);
+  op_ALU_RSUB     : NEXT(_8XY7);
+  op_ALU_SHR      : NEXT(_8XY6<Q>);
+  op_ALU_SHL      : NEXT(_8XYE<Q>);
+  op_ALU_UNKNOWN  : ++state.cycle_counter; DISPATCH();
+  op_LDI          : NEXT(_ANNN);
+  op_JMP_OFF      : NEXT_OR_STOP(_BNNN<Q>);
+  op_RANDOM       : NEXT(_CXNN);
+  op_DRAW         : NEXT_OR_STOP(_DXYN<Q>);
+  op_KEY_EQ       : NEXT(_EX9E);
+  op_KEY_NE       : NEXT(_EXA1);
+  op_GET_DT       : NEXT(_FX07);
+  op_GET_KEY      : NEXT_OR_STOP(_FX0A);
+  op_SET_DT       : NEXT(_FX15);
+  op_SET_ST       : NEXT(_FX18);
+  op_GET_CHAR     : NEXT(_FX29);
+  op_ADD_IR       : NEXT(_FX1E);
+  op_BCD          : NEXT(_FX33);
+  op_STORE_REG    : NEXT(_FX55<Q>);
+  op_LOAD_REG     : NEXT(_FX65<Q>);
+  op_FUSED_DRAW   : NEXT_FUSED(_6XNN_6YNN_DXYN<Q>);
+  op_FUSED_WAIT   : NEXT_FUSED(_FX07_3X00_1NNN);
+  op_FUSED_LOAD   : NEXT_FUSED(_FX1E_FX65<Q>);
+
+  #undef STOP_IF_WAITING
+  #undef NEXT_FUSED
+  #undef NEXT_OR_STOP
+  #undef NEXT
+  #undef JIT_BLOCKS
+  #undef NATIVE_BLOCKS
+  #undef DISPATCH
+#else
+  STOP_REASON reason;
+
+  while (cycles > 0) {
+    // compiled blocks never end on an instruction that can stop the machine
+    if constexpr (use_native) {
+      if (std::uint64_t n = run_native(cycles)) {
+        cycles -= n;
+        continue;
+      }
+    }
+#ifdef KATE_USE_JIT
+    if (std::uint64_t n = run_block<Q>(cycles)) {
+      cycles -= n;
+      continue;
+    }
+#endif
+    // step(), but a superinstruction may run more than one cycle
+    std::uint64_t start = state.cycle_counter;
+    next_instruction();
+    if (
+      (cycles < max_fused_length) &&
+      (fused_length(state.cur_inst.handler) > cycles)
+    ) {
+      state.cur_inst.handler = unfused(state.cur_inst.handler);
+    }
+    HANDLER handler = state.cur_inst.handler;
+    execute();
+    ++state.cycle_counter;
+    cycles -= state.cycle_counter - start;
+
+    if (handler == HANDLER::FUSED_WAIT) {
+      cycles -= skip_idle(cycles);
+    }
+
+    // as STOP_IF_WAITING() above
+    if (is_stopped(reason)) {
+      if (stop_on_wait) {
+        return reason;
+      } else if (reason != STOP_REASON::HALTED) {
+        state.cycle_counter += cycles;
+        return reason;
+      }
+    }
+  }
+
+  return STOP_REASON::BUDGET;
+#endif
+}
+
+#ifdef KATE_USE_JIT
+template <typename Q>
+std::uint64_t kate::Interpreter::run_block(std::uint64_t cycles) {
+  // kept small enough to inline, most instructions have no block
+  if (state.program_counter >= 0x4000) {
+    return 0;
+  }
 
-  ++cycle_counter;
+  const Jit::Block *block = jit.lookup<Q>(state.ram, state.program_counter);
+  if (!block || (block->count > cycles)) {
+    return 0;
+  }
+
+  enter_block(*block);
+  return block->count;
 }
 
+void kate::Interpreter::enter_block(const Jit::Block &block) {
+  block.fn(&state);
+
+  state.cycle_counter += block.count;
+  state.prev_program_counter = block.last;
+  state.program_counter = block.end;
+  state.cur_inst = decode_instruction(block.last_raw);
+}
+#endif
+
 void kate::Interpreter::vblank_trigger() {
-  is_vblank = true;
+  if (recording) {
+    recording->events.push_back(
+      {state.cycle_counter, MOVIE_EVENT::VBLANK, 0}
+    );
+  }
+
+  state.is_vblank = true;
+  if (waiting == STOP_REASON::VBLANK_WAIT) {
+    waiting = STOP_REASON::BUDGET;
+  }
+}
+
+void kate::Interpreter::next_instruction() {
+  if (
+    (state.program_counter < 0x4000) &&
+    (decode_cache_epoch[state.program_counter] == decode_epoch)
+  ) {
+    state.prev_program_counter = state.program_counter;
+    state.cur_inst = decode_cache[state.program_counter];
+    state.program_counter += 2;
+  } else {
+    fetch();
+    decode();
+    fuse();
+
+    decode_cache[state.prev_program_counter] = state.cur_inst;
+    decode_cache_epoch[state.prev_program_counter] = decode_epoch;
+  }
+
+#ifdef KATE_PROFILE
+  HANDLER handler = unfused(state.cur_inst.handler);
+  ++profile.handlers[static_cast<std::size_t>(handler)];
+  ++profile.addresses[state.prev_program_counter];
+#endif
+}
+
+void kate::Interpreter::fuse() {
+  std::size_t address = state.prev_program_counter;
+  if (address + 6 > state.ram.size()) {
+    return;
+  }
+
+  HANDLER handler = fused_handler(
+    state.cur_inst, &state.ram[address + 2]
+  );
+  if (handler == state.cur_inst.handler) {
+    return;
+  }
+
+  // the superinstruction reads the rest of itself from the cache, writing
+  // over any of it invalidates the whole thing
+  for (std::size_t i = 1; i < fused_length(handler); ++i) {
+    std::size_t at = address + (2 * i);
+    decode_cache[at] = decode_instruction(
+      (state.ram[at] << 8) | state.ram[at + 1]
+    );
+    decode_cache_epoch[at] = decode_epoch;
+  }
+  state.cur_inst.handler = handler;
+}
+
+void kate::Interpreter::enter_fused() {
+#ifdef KATE_PROFILE
+  ++profile.fused[static_cast<std::size_t>(state.cur_inst.handler)];
+  ++profile.fused_instructions;
+#endif
+}
+
+void kate::Interpreter::next_fused() {
+  ++state.cycle_counter;
+
+  state.prev_program_counter = state.program_counter;
+  state.cur_inst = decode_cache[state.program_counter];
+  state.program_counter += 2;
+
+#ifdef KATE_PROFILE
+  ++profile.handlers[static_cast<std::size_t>(state.cur_inst.handler)];
+  ++profile.addresses[state.prev_program_counter];
+  ++profile.fused_instructions;
+#endif
+}
+
+std::uint64_t kate::Interpreter::skip_idle(std::uint64_t cycles) {
+  // FX07 is four bytes before the jump, and the cache entry there is still
+  // the superinstruction as the loop writes nothing
+  std::uint16_t address = state.program_counter;
+  if (address + 4 != state.prev_program_counter) {
+    return 0;
+  }
+
+  std::uint64_t passes = cycles / 3;
+  state.cycle_counter += passes * 3;
+
+#ifdef KATE_PROFILE
+  profile.idle_instructions += passes * 3;
+  profile.handlers[static_cast<std::size_t>(HANDLER::GET_DT)] += passes;
+  profile.handlers[static_cast<std::size_t>(HANDLER::SKIP_EQ_IMM)] += passes;
+  profile.handlers[static_cast<std::size_t>(HANDLER::JMP)] += passes;
+  profile.addresses[address] += passes;
+  profile.addresses[address + 2] += passes;
+  profile.addresses[address + 4] += passes;
+  profile.fused[static_cast<std::size_t>(HANDLER::FUSED_WAIT)] += passes;
+  profile.fused_instructions += passes * 3;
+#endif
+
+  return passes * 3;
+}
+
+bool kate::Interpreter::is_stopped(STOP_REASON &reason) {
+  // a soft-blocked instruction rewinds the PC to itself, as does a jump to
+  // itself
+  if (state.program_counter != state.prev_program_counter) {
+    return false;
+  }
+
+  switch (state.cur_inst.handler) {
+    case HANDLER::DRAW    : reason = STOP_REASON::VBLANK_WAIT; break;
+    case HANDLER::GET_KEY : reason = STOP_REASON::KEY_WAIT; break;
+    case HANDLER::JMP     :
+    case HANDLER::JMP_OFF : reason = STOP_REASON::HALTED; return true;
+    default               : return false;
+  }
+
+  waiting = reason;
+  return true;
+}
+
+void kate::Interpreter::mark_dirty(RowMask rows) {
+  if (rows) {
+    dirty_rows |= rows;
+    ++framebuffer_generation;
+  }
+}
+
+void kate::Interpreter::update_beeper() {
+  bool on = state.sound_timer > 0;
+  if (on == beeper) {
+    return;
+  }
+  beeper = on;
+
+  if (sound_edges.size() >= max_sound_edges) {
+    sound_edges.erase(sound_edges.begin());
+  }
+  sound_edges.push_back({state.cycle_counter, on});
+}
+
+std::uint64_t kate::Interpreter::run_native(std::uint64_t cycles) {
+  if ((cycles == 0) || (state.program_counter >= native_blocks.size())) {
+    return 0;
+  }
+
+  const NativeBlock *block = native_blocks[state.program_counter];
+  if (!block) {
+    return 0;
+  }
+
+  // blocks never touch the sound timer, so there are no edges to record
+  return block->fn(&state, cycles);
+}
+
+void kate::Interpreter::refresh_native(
+  std::size_t address, std::size_t length
+) {
+  if (!native) {
+    return;
+  }
+
+  std::size_t end = std::min(address + length, native_bytes.size());
+  if (std::find(
+    native_bytes.cbegin() + address, native_bytes.cbegin() + end, true
+  ) == native_bytes.cbegin() + end) {
+    return;
+  }
+
+  for (std::size_t i = 0; i < native->block_count; ++i) {
+    const NativeBlock &block = native->blocks[i];
+    if ((block.end <= address) || (block.start >= end)) {
+      continue;
+    }
+
+    bool unchanged = std::equal(
+      &state.ram[block.start], &state.ram[0] + block.end,
+      native->rom + (block.start - entry_point)
+    );
+    // an idle loop is left to the interpreter, which can fast-forward it
+    native_blocks[block.start] = (
+      unchanged && !is_idle_loop(state.ram, block.start)
+    ) ? &block : nullptr;
+  }
+}
+
+void kate::Interpreter::drop_decode_cache() {
+  ++decode_epoch;
+#ifdef KATE_USE_JIT
+  jit.clear();
+#endif
+  refresh_native(0, state.ram.size());
+
+  // after 2^32 drops the old entries could look current again
+  if (decode_epoch == 0) {
+    decode_cache_epoch.fill(0);
+    decode_epoch = 1;
+  }
+}
+
+void kate::Interpreter::invalidate_decode_cache(
+  std::size_t address, std::size_t length
+) {
+  // an instruction is two bytes, so the one starting at the previous address
+  // is also affected
+  std::size_t begin = (address > 0) ? address - 1 : 0;
+  std::size_t end = std::min(address + length, decode_cache_epoch.size());
+
+  // epoch 0 is never current
+  if (begin < end) {
+    std::fill(&decode_cache_epoch[begin], &decode_cache_epoch[0] + end, 0);
+  }
+
+  // as is a superinstruction starting up to five bytes before
+  for (std::size_t i = (address > 5) ? address - 5 : 0; i < begin; ++i) {
+    if (decode_cache[i].handler >= HANDLER::FUSED_DRAW) {
+      decode_cache_epoch[i] = 0;
+    }
+  }
+
+#ifdef KATE_USE_JIT
+  jit.invalidate(address, length);
+#endif
+  refresh_native(address, length);
+}
+
+void kate::Interpreter::check_index_register(std::size_t length) {
+  if (state.index_register + length > state.ram.size()) {
+    throw invalid_address(crashdump("I out of range"));
+  }
 }
 
 void kate::Interpreter::fetch() {
-  if (program_counter >= 0x4000) {
+  // both bytes of the instruction have to be in ram
+  if (state.program_counter >= state.ram.size() - 1) {
     throw invalid_address(crashdump("PC out of range"));
   }
-  cur_inst = {0, NOP, 0, 0, 0};
+  state.cur_inst = {0, NOP, 0, 0, 0, HANDLER::INVALID};
 
   // save address of current instruction for debug purposes
-  prev_program_counter = program_counter;
+  state.prev_program_counter = state.program_counter;
 
   // fetch next instruction and increment PC
-  cur_inst.raw <<= 8;
-  cur_inst.raw |= ram[program_counter];
-  ++program_counter;
-  cur_inst.raw <<= 8;
-  cur_inst.raw |= ram[program_counter];
-  ++program_counter;
+  state.cur_inst.raw <<= 8;
+  state.cur_inst.raw |= state.ram[state.program_counter];
+  ++state.program_counter;
+  state.cur_inst.raw <<= 8;
+  state.cur_inst.raw |= state.ram[state.program_counter];
+  ++state.program_counter;
 }
 
 void kate::Interpreter::decode() {
-  std::uint8_t o = (cur_inst.raw & 0xf000) >> 12;
-  switch (o) {
-    case 0x00: case 0x0e:
-      cur_inst.inst = static_cast<INSTRUCTION>(cur_inst.raw & 0x00ff);
-      cur_inst.x = (cur_inst.raw & 0x0f00) >> 8;
-      break;
-    case 0x01: case 0x02: case 0x0a:
-      cur_inst.inst = static_cast<INSTRUCTION>(o);
-      cur_inst.n = cur_inst.raw & 0x0fff;;
-      break;
-    case 0x0b:
-      cur_inst.inst = static_cast<INSTRUCTION>(o);
-      cur_inst.x = (cur_inst.raw & 0x0f00) >> 8;
-      cur_inst.n = cur_inst.raw & 0x0fff;;
-      break;
-    case 0x03: case 0x04: case 0x06: case 0x07: case 0x0c: case 0x0f:
-      cur_inst.inst = static_cast<INSTRUCTION>(o);
-      cur_inst.x = (cur_inst.raw & 0x0f00) >> 8;
-      cur_inst.n = cur_inst.raw & 0x00ff;
-      break;
-    case 0x05: case 0x08: case 0x09: case 0x0d:
-      cur_inst.inst = static_cast<INSTRUCTION>(o);
-      cur_inst.x = (cur_inst.raw & 0x0f00) >> 8;
-      cur_inst.y = (cur_inst.raw & 0x00f0) >> 4;
-      cur_inst.n = (cur_inst.raw & 0x000f);
-      break;
+  state.cur_inst = decode_instruction(state.cur_inst.raw);
+}
+
+template <typename Q>
+void kate::Interpreter::execute_impl() {
+  switch (state.cur_inst.handler) {
+    case HANDLER::CLEAR       : _00E0(); break;
+    case HANDLER::RET         : _00EE(); break;
+    case HANDLER::JMP         : _1NNN(); break;
+    case HANDLER::CALL        : _2NNN(); break;
+    case HANDLER::SKIP_EQ_IMM : _3XNN(); break;
+    case HANDLER::SKIP_NE_IMM : _4XNN(); break;
+    case HANDLER::SKIP_EQ_REG : _5XY0(); break;
+    case HANDLER::SKIP_NE_REG : _9XY0(); break;
+    case HANDLER::MOV         : _6XNN(); break;
+    case HANDLER::ADD         : _7XNN(); break;
+    case HANDLER::ALU_MOV     : _8XY0(); break;
+    case HANDLER::ALU_OR      : _8XY1<Q>(); break;
+    case HANDLER::ALU_AND     : _8XY2<Q>(); break;
+    case HANDLER::ALU_XOR     : _8XY3<Q>(); break;
+    case HANDLER::ALU_ADD     : _8XY4(); break;
+    case HANDLER::ALU_SUB     : _8XY5(); break;
+    case HANDLER::ALU_RSUB    : _8XY7(); break;
+    case HANDLER::ALU_SHR     : _8XY6<Q>(); break;
+    case HANDLER::ALU_SHL     : _8XYE<Q>(); break;
+    case HANDLER::ALU_UNKNOWN : break;
+    case HANDLER::LDI         : _ANNN(); break;
+    case HANDLER::JMP_OFF     : _BNNN<Q>(); break;
+    case HANDLER::RANDOM      : _CXNN(); break;
+    case HANDLER::DRAW        : _DXYN<Q>(); break;
+    case HANDLER::KEY_EQ      : _EX9E(); break;
+    case HANDLER::KEY_NE      : _EXA1(); break;
+    case HANDLER::GET_DT      : _FX07(); break;
+    case HANDLER::GET_KEY     : _FX0A(); break;
+    case HANDLER::SET_DT      : _FX15(); break;
+    case HANDLER::SET_ST      : _FX18(); break;
+    case HANDLER::GET_CHAR    : _FX29(); break;
+    case HANDLER::ADD_IR      : _FX1E(); break;
+    case HANDLER::BCD         : _FX33(); break;
+    case HANDLER::STORE_REG   : _FX55<Q>(); break;
+    case HANDLER::LOAD_REG    : _FX65<Q>(); break;
+    case HANDLER::FUSED_DRAW  : _6XNN_6YNN_DXYN<Q>(); break;
+    case HANDLER::FUSED_WAIT  : _FX07_3X00_1NNN(); break;
+    case HANDLER::FUSED_LOAD  : _FX1E_FX65<Q>(); break;
+    default                   : _INVALID();
   }
 }
 
-void kate::Interpreter::execute() {
-  // execute instruction
-    std::uint8_t r = cur_inst.x;
-    std::uint8_t k = registers[cur_inst.x];
-  switch (cur_inst.inst) {
-    case CLEAR:
-      std::fill(output_buffer.begin(), output_buffer.end(), 0);
-      break;
-    case RET:
-      --stack_pointer;
-      program_counter = stack[stack_pointer];
-      break;
-    case JMP:
-      prev_program_counter = program_counter - 2;
-      program_counter = cur_inst.n;
-      break;
-    case CALL:
-      if (stack_pointer >= 16) {
-        throw stack_overflow(crashdump("STACK OVERFLOW"));
-      }
-      stack[stack_pointer] = program_counter;
-      ++stack_pointer;
-      program_counter = cur_inst.n;
-    case SKIP_EQ_IMM:
-      if (registers[cur_inst.x] == cur_inst.n) {
-        program_counter += 2;
-      }
-      break;
-    case SKIP_NE_IMM:
-      if (registers[cur_inst.x] != cur_inst.n) {
-        program_counter += 2;
-      }
-      break;
-    case SKIP_EQ_REG:
-      if (registers[cur_inst.x] == registers[cur_inst.y]) {
-        program_counter += 2;
-      }
-      break;
-    case SKIP_NE_REG:
-      if (registers[cur_inst.x] != registers[cur_inst.y]) {
-        program_counter += 2;
-      }
-      break;
-    case MOV:
-      registers[cur_inst.x] = cur_inst.n;
-      break;
-    case ADD:
-      registers[cur_inst.x] += cur_inst.n;
-      break;
-    case ALU: _8XYN(); break;
-    case LDI:
-      index_register = cur_inst.n;
-      break;
-    case JMP_OFF:
-      prev_program_counter = program_counter - 2;
-      if (quirks_jump_high_nubble_as_register) {
-        program_counter = cur_inst.n + registers[cur_inst.x];
-      } else {
-        program_counter = cur_inst.n + registers[0];
-      }
-      break;
-    case RANDOM:
-      registers[cur_inst.x] = random_uint8() & cur_inst.n;
-      break;
-    case DRAW: _DXYN(); break;
-    case KEY_EQ:
-      if (key_states[registers[cur_inst.x]] == true) {
-        prev_program_counter = program_counter;
-        program_counter += 2;
-      }
-      break;
-    case KEY_NE:
-      if (key_states[registers[cur_inst.x]] == false) {
-        prev_program_counter = program_counter;
-        program_counter += 2;
-      }
-      break;
-    case MISC: _FXNN(); break;
-    default:
-      throw invalid_instruction(crashdump("NOT YET IMPLEMENTED"));
+/******************************************************************************
+/ Instructions                                                                /
+******************************************************************************/
+void kate::Interpreter::_00E0() {
+  state.output_buffer.fill(0);
+  mark_dirty(all_rows);
+}
+
+void kate::Interpreter::_00EE() {
+  if (state.stack_pointer == 0) {
+    throw stack_underflow(crashdump("STACK UNDERFLOW"));
   }
+  --state.stack_pointer;
+  state.program_counter = state.stack[state.stack_pointer];
 }
 
-void kate::Interpreter::_8XYN() {
-  uint16_t tmp = 0;
-  switch (static_cast<ALU_OP>(cur_inst.n)) {
-    case ALU_OP::MOV:
-      registers[cur_inst.x] = registers[cur_inst.y];
-      break;
-    case ALU_OP::OR:
-      registers[cur_inst.x] |= registers[cur_inst.y];
-      if (kate::quirks_enable_flags_reset) {
-        registers[0xf] = 0;
-      }
-      break;
-    case ALU_OP::AND:
-      registers[cur_inst.x] &= registers[cur_inst.y];
-      if (kate::quirks_enable_flags_reset) {
-        registers[0xf] = 0;
-      }
-      break;
-    case ALU_OP::XOR:
-      registers[cur_inst.x] ^= registers[cur_inst.y];
-      if (kate::quirks_enable_flags_reset) {
-        registers[0xf] = 0;
-      }
-      break;
-    case ALU_OP::ADD:
-      tmp = registers[cur_inst.x];
-      registers[cur_inst.x] += registers[cur_inst.y];
-      registers[0xf] = registers[cur_inst.x] < tmp;
-      break;
-    case ALU_OP::SUB:
-      tmp = registers[cur_inst.x];
-      registers[cur_inst.x] -= registers[cur_inst.y];
-      registers[0xf] = (registers[cur_inst.x] <= tmp) &&
-                       (registers[cur_inst.y] <= tmp);
-      break;
-    case ALU_OP::RSUB:
-      tmp = registers[cur_inst.x];
-      registers[cur_inst.x] = registers[cur_inst.y] - registers[cur_inst.x];
-      registers[0xf] = tmp <= registers[cur_inst.y];
-      break;
-    case ALU_OP::SHL:
-      if (!quirks_shifting_ignores_y) {
-        registers[cur_inst.x] = registers[cur_inst.y];
-      }
-      tmp = (registers[cur_inst.x] >> 7) & 0b1;
-      registers[cur_inst.x] <<= 1;
-      registers[0xf] = tmp;
-      break;
-    case ALU_OP::SHR:
-      if (!quirks_shifting_ignores_y) {
-        registers[cur_inst.x] = registers[cur_inst.y];
-      }
-      tmp = registers[cur_inst.x] & 0b1;
-      registers[cur_inst.x] >>= 1;
-      registers[0xf] = tmp;
-      break;
+void kate::Interpreter::_1NNN() {
+  state.prev_program_counter = state.program_counter - 2;
+  state.program_counter = state.cur_inst.n;
+}
+
+void kate::Interpreter::_2NNN() {
+  if (state.stack_pointer >= 16) {
+    throw stack_overflow(crashdump("STACK OVERFLOW"));
+  }
+  state.stack[state.stack_pointer] = state.program_counter;
+  ++state.stack_pointer;
+  state.program_counter = state.cur_inst.n;
+}
+
+void kate::Interpreter::_3XNN() {
+  if (state.registers[state.cur_inst.x] == state.cur_inst.n) {
+    state.program_counter += 2;
+  }
+}
+
+void kate::Interpreter::_4XNN() {
+  if (state.registers[state.cur_inst.x] != state.cur_inst.n) {
+    state.program_counter += 2;
+  }
+}
+
+void kate::Interpreter::_5XY0() {
+  if (state.registers[state.cur_inst.x] == state.registers[state.cur_inst.y]) {
+    state.program_counter += 2;
+  }
+}
+
+void kate::Interpreter::_6XNN() {
+  state.registers[state.cur_inst.x] = state.cur_inst.n;
+}
+
+void kate::Interpreter::_7XNN() {
+  state.registers[state.cur_inst.x] += state.cur_inst.n;
+}
+
+/******************************************************************************
+/ ALU                                                                         /
+******************************************************************************/
+void kate::Interpreter::_8XY0() {
+  state.registers[state.cur_inst.x] = state.registers[state.cur_inst.y];
+}
+
+template <typename Q>
+void kate::Interpreter::_8XY1() {
+  state.registers[state.cur_inst.x] |= state.registers[state.cur_inst.y];
+  if constexpr (Q::enable_flags_reset) {
+    state.registers[0xf] = 0;
+  }
+}
+
+template <typename Q>
+void kate::Interpreter::_8XY2() {
+  state.registers[state.cur_inst.x] &= state.registers[state.cur_inst.y];
+  if constexpr (Q::enable_flags_reset) {
+    state.registers[0xf] = 0;
+  }
+}
+
+template <typename Q>
+void kate::Interpreter::_8XY3() {
+  state.registers[state.cur_inst.x] ^= state.registers[state.cur_inst.y];
+  if constexpr (Q::enable_flags_reset) {
+    state.registers[0xf] = 0;
   }
 }
 
+void kate::Interpreter::_8XY4() {
+  uint16_t tmp = state.registers[state.cur_inst.x];
+  state.registers[state.cur_inst.x] += state.registers[state.cur_inst.y];
+  state.registers[0xf] = state.registers[state.cur_inst.x] < tmp;
+}
+
+void kate::Interpreter::_8XY5() {
+  uint16_t tmp = state.registers[state.cur_inst.x];
+  state.registers[state.cur_inst.x] -= state.registers[state.cur_inst.y];
+  state.registers[0xf] = (state.registers[state.cur_inst.x] <= tmp) &&
+                   (state.registers[state.cur_inst.y] <= tmp);
+}
+
+template <typename Q>
+void kate::Interpreter::_8XY6() {
+  if constexpr (!Q::shifting_ignores_y) {
+    state.registers[state.cur_inst.x] = state.registers[state.cur_inst.y];
+  }
+  uint16_t tmp = state.registers[state.cur_inst.x] & 0b1;
+  state.registers[state.cur_inst.x] >>= 1;
+  state.registers[0xf] = tmp;
+}
+
+void kate::Interpreter::_8XY7() {
+  uint16_t tmp = state.registers[state.cur_inst.x];
+  state.registers[state.cur_inst.x] =
+    state.registers[state.cur_inst.y] - state.registers[state.cur_inst.x];
+  state.registers[0xf] = tmp <= state.registers[state.cur_inst.y];
+}
+
+template <typename Q>
+void kate::Interpreter::_8XYE() {
+  if constexpr (!Q::shifting_ignores_y) {
+    state.registers[state.cur_inst.x] = state.registers[state.cur_inst.y];
+  }
+  uint16_t tmp = (state.registers[state.cur_inst.x] >> 7) & 0b1;
+  state.registers[state.cur_inst.x] <<= 1;
+  state.registers[0xf] = tmp;
+}
+
+/******************************************************************************
+/ Instructions (continued)                                                    /
+******************************************************************************/
+void kate::Interpreter::_9XY0() {
+  if (state.registers[state.cur_inst.x] != state.registers[state.cur_inst.y]) {
+    state.program_counter += 2;
+  }
+}
+
+void kate::Interpreter::_ANNN() {
+  state.index_register = state.cur_inst.n;
+}
+
+template <typename Q>
+void kate::Interpreter::_BNNN() {
+  state.prev_program_counter = state.program_counter - 2;
+  if constexpr (Q::jump_high_nubble_as_register) {
+    state.program_counter =
+      state.cur_inst.n + state.registers[state.cur_inst.x];
+  } else {
+    state.program_counter = state.cur_inst.n + state.registers[0];
+  }
+}
+
+void kate::Interpreter::_CXNN() {
+  state.registers[state.cur_inst.x] = random_uint8() & state.cur_inst.n;
+}
+
+/******************************************************************************
+/ GPU                                                                         /
+******************************************************************************/
+template <typename Q>
 void kate::Interpreter::_DXYN() {
-  if (quirks_vblank_wait && !is_vblank) {
+  if (Q::vblank_wait && !state.is_vblank) {
     // soft-block
-    program_counter = prev_program_counter;
+    state.program_counter = state.prev_program_counter;
+#ifdef KATE_PROFILE
+    ++profile.vblank_waits;
+#endif
     return;
   }
 
-  // offsets wrap, drawing does not
-  std::uint8_t h_offset = registers[cur_inst.x];
-  std::uint8_t v_offset = registers[cur_inst.y];
+  check_index_register(state.cur_inst.n);
 
-  if (quirks_sprite_clipping) {
-    h_offset %= SCR_W;
-    v_offset %= SCR_H;
-  }
+  // offsets wrap, drawing does not (unless sprite clipping is disabled)
+  std::size_t h_offset = state.registers[state.cur_inst.x] % SCR_W;
+  std::size_t v_offset = state.registers[state.cur_inst.y] % SCR_H;
 
   // clear flags register
-  registers[0xf] = 0;
+  state.registers[0xf] = 0;
+
+  // each row in the sprite is 1 byte wide, stored sequentially. A row is
+  // shifted into place as a whole, so drawing it takes one AND to detect a
+  // collision and one XOR to update the screen.
+  for (std::size_t i = 0; i < state.cur_inst.n; ++i) {
+    std::uint64_t data = state.ram[state.index_register + i];
+    std::uint64_t sprite = data << (SCR_W - 8);
+    std::size_t ypos = v_offset + i;
 
-  // each row in the sprite is 1 byte wide, stored sequentially
-  for (std::size_t i = 0; i < cur_inst.n; ++i) {
-    std::uint8_t data = ram[index_register + i];
-    std::uint8_t ypos = v_offset + i;
-    if (!quirks_sprite_clipping) {
+    if constexpr (Q::sprite_clipping) {
+      // stop drawing if off bottom of screen
+      if (ypos >= SCR_H) {
+        break;
+      }
+
+      // pixels shifted past the right edge are dropped
+      sprite >>= h_offset;
+    } else {
       ypos %= SCR_H;
+
+      // pixels shifted past the right edge come back on the left
+      sprite = (sprite >> h_offset) | (sprite << ((SCR_W - h_offset) % SCR_W));
     }
-    std::size_t pixel_offset = ypos * SCR_W;
 
-    // loop over pixels
-    for (int p = 7; p >= 0; --p) {
-      std::uint8_t xpos = h_offset + (7 - p);
-      if (!quirks_sprite_clipping) {
-        xpos %= SCR_W;
-      }
-      std::size_t pixel_index = xpos + pixel_offset;
+    // set flag if any pixel will be turned off
+    if (state.output_buffer[ypos] & sprite) {
+      state.registers[0xf] = 1;
+    }
 
-      bool pixel = (data >> p) & 1;
+    // screen is updated via xor
+    state.output_buffer[ypos] ^= sprite;
+  }
+  state.is_vblank = false;
 
-      // set flag if pixel will be turned off
-      if (pixel & output_buffer[pixel_index]) {
-        registers[0xf] = 1;
-      }
+#ifdef KATE_PROFILE
+  ++profile.sprite_heights[state.cur_inst.n];
+  profile.draw_rows += Q::sprite_clipping ?
+    std::min<std::size_t>(state.cur_inst.n, SCR_H - v_offset) :
+    state.cur_inst.n;
+  profile.collisions += state.registers[0xf];
+#endif
 
-      // screen is updated via xor
-      output_buffer[pixel_index] ^= pixel;
+  // the rows the sprite covers, whether or not anything in them changed
+  RowMask rows = (RowMask(1) << state.cur_inst.n) - 1;
+  if constexpr (Q::sprite_clipping) {
+    mark_dirty((rows << v_offset) & all_rows);
+  } else {
+    mark_dirty(
+      ((rows << v_offset) | (rows >> ((SCR_H - v_offset) % SCR_H))) & all_rows
+    );
+  }
+}
 
-      // skip to next line if edge of screen reached
-      if (quirks_sprite_clipping && (xpos >= SCR_W)) {
-        break;
-      }
-    }
+void kate::Interpreter::_EX9E() {
+  if (state.key_states[state.registers[state.cur_inst.x]] == true) {
+    state.prev_program_counter = state.program_counter;
+    state.program_counter += 2;
+  }
+}
 
-    // stop drawing if off bottom of screen
-    if (quirks_sprite_clipping && (ypos >= SCR_H)) {
-      break;
-    }
+void kate::Interpreter::_EXA1() {
+  if (state.key_states[state.registers[state.cur_inst.x]] == false) {
+    state.prev_program_counter = state.program_counter;
+    state.program_counter += 2;
   }
-  is_vblank = false;
 }
 
-void kate::Interpreter::_FXNN() {
-  switch (static_cast<MISC_OP>(cur_inst.n)) {
-    case MISC_OP::GET_DT:
-      registers[cur_inst.x] = delay_timer;
-      break;
-    case MISC_OP::GET_KEY:
-      // if last key_event is not a release, soft-block
-      if (!is_blocking) {
-        last_key_event = {0, KEY_EVENT::NONE};
-        is_blocking = true;
-      }
+/******************************************************************************
+/ MISC                                                                        /
+******************************************************************************/
+void kate::Interpreter::_FX07() {
+  state.registers[state.cur_inst.x] = state.delay_timer;
+}
 
-      if (last_key_event.second != KEY_EVENT::RELEASE) {
-        program_counter -= 2;
-      } else {
-        registers[cur_inst.x] = last_key_event.first;
-        is_blocking = false;
-        last_key_event = {0, KEY_EVENT::NONE};
-      }
-      break;
-    case MISC_OP::SET_DT:
-      delay_timer = registers[cur_inst.x];
-      break;
-    case MISC_OP::SET_ST:
-      sound_timer = registers[cur_inst.x];
-      break;
-    case MISC_OP::GET_CHAR:
-      index_register = char_pointer + (registers[cur_inst.x & 0xf] * 5);
-      break;
-    case MISC_OP::ADD_IR:
-      index_register += registers[cur_inst.x];
-      break;
-    case MISC_OP::BCD:
-      ram[index_register]     =  registers[cur_inst.x]        / 100;
-      ram[index_register + 1] = (registers[cur_inst.x] % 100) /  10;
-      ram[index_register + 2] =  registers[cur_inst.x] %  10;
-      break;
-    case MISC_OP::STORE_REG:
-      for (std::size_t i = 0; i <= cur_inst.x; ++i) {
-        ram[index_register + i] = registers[i];
-      }
+void kate::Interpreter::_FX0A() {
+  // if last key_event is not a release, soft-block
+  if (!state.is_blocking) {
+    state.last_key_event = {0, KEY_EVENT::NONE};
+    state.is_blocking = true;
+  }
 
-      if (quirks_increment_index_register) {
-        // Note: the index register points to the address _after_ the
-        // last value written (write + increment for each register)
-        index_register += cur_inst.x + 1;
-      }
-      break;
-    case MISC_OP::LOAD_REG:
-      for (std::size_t i = 0; i <= cur_inst.x; ++i) {
-        registers[i] = ram[index_register + i];
-      }
+  if (state.last_key_event.event != KEY_EVENT::RELEASE) {
+    state.program_counter -= 2;
+  } else {
+    state.registers[state.cur_inst.x] = state.last_key_event.key;
+    state.is_blocking = false;
+    state.last_key_event = {0, KEY_EVENT::NONE};
+  }
+}
 
-      if (quirks_increment_index_register) {
-        // Note: the index register points to the address _after_ the
-        // last value written (write + increment for each register)
-        index_register += cur_inst.x + 1;
-      }
-      break;
-    default:
-      throw invalid_instruction(crashdump("NOT YET IMPLEMENTED"));
+void kate::Interpreter::_FX15() {
+  state.delay_timer = state.registers[state.cur_inst.x];
+}
+
+void kate::Interpreter::_FX18() {
+  state.sound_timer = state.registers[state.cur_inst.x];
+  update_beeper();
+}
+
+void kate::Interpreter::_FX1E() {
+  state.index_register += state.registers[state.cur_inst.x];
+}
+
+void kate::Interpreter::_FX29() {
+  state.index_register =
+    char_pointer + (state.registers[state.cur_inst.x & 0xf] * 5);
+}
+
+void kate::Interpreter::_FX33() {
+  check_index_register(3);
+  std::uint8_t value = state.registers[state.cur_inst.x];
+  state.ram[state.index_register]     =  value        / 100;
+  state.ram[state.index_register + 1] = (value % 100) /  10;
+  state.ram[state.index_register + 2] =  value %  10;
+  invalidate_decode_cache(state.index_register, 3);
+}
+
+template <typename Q>
+void kate::Interpreter::_FX55() {
+  check_index_register(state.cur_inst.x + 1);
+  for (std::size_t i = 0; i <= state.cur_inst.x; ++i) {
+    state.ram[state.index_register + i] = state.registers[i];
+  }
+  invalidate_decode_cache(state.index_register, state.cur_inst.x + 1);
+
+  if constexpr (Q::increment_index_register) {
+    // Note: the index register points to the address _after_ the
+    // last value written (write + increment for each register)
+    state.index_register += state.cur_inst.x + 1;
   }
 }
+
+template <typename Q>
+void kate::Interpreter::_FX65() {
+  check_index_register(state.cur_inst.x + 1);
+  for (std::size_t i = 0; i <= state.cur_inst.x; ++i) {
+    state.registers[i] = state.ram[state.index_register + i];
+  }
+
+  if constexpr (Q::increment_index_register) {
+    // Note: the index register points to the address _after_ the
+    // last value written (write + increment for each register)
+    state.index_register += state.cur_inst.x + 1;
+  }
+}
+
+void kate::Interpreter::_INVALID() {
+  throw invalid_instruction(crashdump("NOT YET IMPLEMENTED"));
+}
+
+/******************************************************************************
+/ Superinstructions                                                           /
+******************************************************************************/
+// Each runs its instructions exactly as stepping them would, counting a
+// cycle between each. The caller counts the last one.
+template <typename Q>
+void kate::Interpreter::_6XNN_6YNN_DXYN() {
+  enter_fused();
+  _6XNN();
+  next_fused();
+  _6XNN();
+  next_fused();
+  _DXYN<Q>();
+}
+
+void kate::Interpreter::_FX07_3X00_1NNN() {
+  enter_fused();
+  _FX07();
+  next_fused();
+  _3XNN();
+
+  // the jump is skipped once the delay timer runs out
+  if (state.program_counter == state.prev_program_counter + 2) {
+    next_fused();
+    _1NNN();
+  }
+}
+
+template <typename Q>
+void kate::Interpreter::_FX1E_FX65() {
+  enter_fused();
+  _FX1E();
+  next_fused();
+  _FX65<Q>();
+}
@@ -3,14 +3,20 @@
 
 #include <array>
 #include <exception>
-#include <random>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include <cstdint>
 
 #include "config.hpp"
 
+// the JIT doesn't count what it runs, so a profiling build never uses it
+#if defined(KATE_JIT) && !defined(KATE_PROFILE)
+  #define KATE_USE_JIT
+  #include "jit.hpp"
+#endif
+
 namespace kate {
   class interpreter_error : public std::exception {
   public:
@@ -41,6 +47,12 @@ namespace kate {
     explicit stack_overflow(const char* msg);
   };
 
+  class stack_underflow : public interpreter_error {
+  public:
+    explicit stack_underflow(const std::string& msg);
+    explicit stack_underflow(const char* msg);
+  };
+
   enum INSTRUCTION {
     NOP         = 0x00,
     CLEAR       = 0xe0,
@@ -87,13 +99,81 @@ namespace kate {
     LOAD_REG  = 0x65
   };
 
+  // Every instruction resolved down to the function that executes it. ALU
+  // and MISC instructions are split by their operation at decode time, so
+  // execution only ever needs a single dispatch.
+  enum class HANDLER : std::uint8_t {
+    INVALID,
+    CLEAR,
+    RET,
+    JMP,
+    CALL,
+    SKIP_EQ_IMM,
+    SKIP_NE_IMM,
+    SKIP_EQ_REG,
+    SKIP_NE_REG,
+    MOV,
+    ADD,
+    ALU_MOV,
+    ALU_OR,
+    ALU_AND,
+    ALU_XOR,
+    ALU_ADD,
+    ALU_SUB,
+    ALU_RSUB,
+    ALU_SHR,
+    ALU_SHL,
+    ALU_UNKNOWN,
+    LDI,
+    JMP_OFF,
+    RANDOM,
+    DRAW,
+    KEY_EQ,
+    KEY_NE,
+    GET_DT,
+    GET_KEY,
+    SET_DT,
+    SET_ST,
+    GET_CHAR,
+    ADD_IR,
+    BCD,
+    STORE_REG,
+    LOAD_REG,
+    // Superinstructions: common sequences run by one handler, which still
+    // steps through each instruction in turn. Only found in the decode
+    // cache, see Interpreter::fuse().
+    FUSED_DRAW,  // 6XNN 6YNN DXYN
+    FUSED_WAIT,  // FX07 3X00 1NNN
+    FUSED_LOAD,  // FX1E FX65
+    COUNT
+  };
+
   enum class KEY_EVENT {
     NONE,
     PRESS,
     RELEASE
   };
 
+  // The display is stored as one bit per pixel, one word per row, with the
+  // most significant bit being the leftmost pixel. A hires display would need
+  // a 128-bit row.
+  static_assert(SCR_W == 64, "a display row must fit in a std::uint64_t");
+  using Framebuffer = std::array<std::uint64_t, SCR_H>;
+
+  // a set of display rows, bit y is row y
+  static_assert(SCR_H <= 32, "a set of display rows must fit in 32 bits");
+  using RowMask = std::uint32_t;
+  constexpr RowMask all_rows = (SCR_H == 32) ? ~RowMask(0) : (1u << SCR_H) - 1;
+
+  // one byte (0 or 1) per pixel, row by row
+  std::vector<std::uint8_t> unpack_framebuffer(const Framebuffer &fb);
+  // one bit per pixel, row by row, most significant bit first
+  std::vector<std::uint8_t> framebuffer_bytes(const Framebuffer &fb);
+
   std::string decode_INSTRUCTION(INSTRUCTION inst);
+  std::string decode_HANDLER(HANDLER handler);
+  std::string decode_QUIRKS(QUIRKS quirks);
+  QUIRKS quirks_from_string(const std::string &name);
   std::string hex_string(std::size_t i, std::size_t w, bool b=true);
 
   // will be able to hold data for any kind of instruction
@@ -104,16 +184,166 @@ namespace kate {
     std::uint8_t x;
     std::uint8_t y;
     std::uint16_t n;
+
+    HANDLER handler;
+  };
+
+  Instruction decode_instruction(std::uint16_t raw);
+  // The superinstruction `inst` starts when followed by the four bytes at
+  // `next`, or its own handler if it doesn't start one. Anything else that
+  // runs code (the JIT) has to leave these sequences to the interpreter.
+  HANDLER fused_handler(const Instruction &inst, const std::uint8_t *next);
+
+  // The generator behind CXNN, xorshift64* on a single 64-bit state, shared
+  // by Interpreter and Batch so that equal seeds give equal sequences.
+  // rng_from_seed() turns any seed into a starting state, using splitmix64
+  // so that similar seeds still give unrelated sequences.
+  inline std::uint64_t rng_from_seed(std::uint64_t seed) {
+    std::uint64_t z = seed + 0x9e3779b97f4a7c15;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    z ^= z >> 31;
+
+    // xorshift gets stuck at zero
+    return (z != 0) ? z : 0x9e3779b97f4a7c15;
+  }
+
+  // advances `rng` and returns its top (best mixed) byte
+  inline std::uint8_t rng_next(std::uint64_t &rng) {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+
+    return (rng * 0x2545f4914f6cdd1d) >> 56;
+  }
+
+  struct Movie;
+  struct NativeBlock;
+  struct NativeModule;
+
+  struct KeyEvent {
+    std::uint8_t key;
+    KEY_EVENT event;
+  };
+
+  // the beeper turning on or off, at the cycle it happened
+  struct SoundEdge {
+    std::uint64_t cycle;
+    bool on;
+  };
+  // edges nobody takes are dropped oldest first past this many
+  constexpr std::size_t max_sound_edges = 64;
+
+  // why run_for() or run_frame() returned
+  enum class STOP_REASON {
+    BUDGET,       // every cycle asked for was run
+    VBLANK_WAIT,  // DXYN is waiting for vblank_trigger()
+    KEY_WAIT,     // FX0A is waiting for a key to be released
+    HALTED,       // jumped to itself, only input or the timers can change that
+    ERROR         // the machine faulted, see get_error()
+  };
+
+  // Everything that makes up a running machine, kept in one trivially
+  // copyable block so a snapshot is a single memcpy. The decode cache is
+  // derived from `ram` and so is not part of it.
+  struct State {
+    std::array<std::uint8_t, 0x4000> ram;
+    std::array<std::uint8_t, 16> registers;
+    std::array<std::uint8_t, 16> key_states;
+    std::array<std::uint16_t, 16> stack;
+    std::uint16_t program_counter;
+    std::uint16_t stack_pointer;
+    std::uint16_t index_register;
+    std::uint8_t delay_timer;
+    std::uint8_t sound_timer;
+
+    Framebuffer output_buffer;
+    bool is_blocking;
+    bool is_vblank;
+    Instruction cur_inst;
+    std::uint64_t cycle_counter;
+    std::uint16_t prev_program_counter;
+    KeyEvent last_key_event;
+
+    // xorshift64*, never zero
+    std::uint64_t rng_state;
+  };
+  static_assert(
+    std::is_trivially_copyable_v<State>,
+    "State is saved and restored with memcpy"
+  );
+
+  // What the interpreter has executed, counted only in builds made with
+  // KATE_PROFILE defined (`make PROFILE=1`). Otherwise the counting isn't
+  // compiled in at all and get_profile() returns nullptr.
+  struct Profile {
+    // every instruction executed, including those that were only waiting
+    std::array<std::uint64_t, static_cast<std::size_t>(HANDLER::COUNT)>
+      handlers;
+    // by the address each instruction was fetched from
+    std::array<std::uint64_t, 0x4000> addresses;
+
+    // DXYN that drew, by sprite height (N)
+    std::array<std::uint64_t, 16> sprite_heights;
+    // rows drawn, after clipping
+    std::uint64_t draw_rows;
+    // DXYN that turned a pixel off and set VF
+    std::uint64_t collisions;
+    // DXYN that had to wait for vblank instead of drawing
+    std::uint64_t vblank_waits;
+
+    // superinstructions run, by handler. `handlers` still counts each of
+    // their instructions on its own.
+    std::array<std::uint64_t, static_cast<std::size_t>(HANDLER::COUNT)>
+      fused;
+    // instructions that were run as part of a superinstruction
+    std::uint64_t fused_instructions;
+    // instructions of delay timer waits that were fast-forwarded rather than
+    // run, also counted in everything above
+    std::uint64_t idle_instructions;
   };
 
   class Interpreter {
   public:
-    Interpreter();
+    Interpreter(QUIRKS quirks=QUIRKS::COSMAC_VIP);
+
+    void set_quirks(QUIRKS quirks);
+    QUIRKS get_quirks() const;
+
+    // Run the blocks in `module` (see native.hpp) wherever the ram still
+    // holds the code they were compiled from, nullptr to stop. Throws if it
+    // was compiled for other quirks, and changing the quirks detaches it.
+    // The module must outlive the interpreter or be detached first.
+    void attach_native(const NativeModule *module);
 
     void reset();
     void load_rom(const std::vector<std::uint8_t> &rom);
-    const std::vector<std::uint8_t> &get_output_buffer() const;
+    const Framebuffer &get_output_buffer() const;
+    // incremented whenever the display may have changed (00E0, DXYN, a
+    // reset or a restored state), so an unchanged display can be spotted
+    // cheaply
+    std::uint64_t get_framebuffer_generation() const;
+    // the rows written since the last call. A row can be written without
+    // changing, e.g. cleared and then drawn the same again.
+    RowMask take_dirty_rows();
     std::uint8_t get_sound_timer() const;
+    // Appends every time the beeper turned on or off (the sound timer set
+    // by FX18, running out, or a reset or restored state) since the last
+    // call to `out`, stamped with the cycle counter.
+    void take_sound_edges(std::vector<SoundEdge> &out);
+    std::uint64_t get_cycle_counter() const;
+    // nullptr unless built with KATE_PROFILE, see Profile
+    const Profile *get_profile() const;
+
+    // copy the whole machine out or back in, restoring also drops the
+    // decode cache (in constant time)
+    void save_state(State &out) const;
+    void load_state(const State &in);
+
+    // Append every input and timer event to `movie` from now on (nullptr to
+    // stop). A movie can't represent a jump in state, so loading one stops
+    // the recording.
+    void record(Movie *movie);
     std::string crashdump(const std::string &msg) const;
     std::string debug_line() const;
     std::string debug_filename() const;
@@ -121,42 +351,173 @@ namespace kate {
     void decrement_timers();
     void keypress(std::uint8_t k);
     void keyrelease(std::uint8_t k);
+    void seed(std::uint64_t seed);
+    // the last value passed to seed()
+    std::uint64_t get_seed() const;
     std::uint8_t random_uint8();
 
+    // step() and run() throw on errors, and run() carries on through waits.
+    // A DXYN or FX0A that is waiting on the host isn't run again until
+    // vblank_trigger() or keyrelease() wakes it, its cycles are only counted.
     void step();
+    void run(std::uint64_t cycles);
+
+    // Run up to `cycles` instructions in one loop, returning early once the
+    // machine is waiting on the host (see STOP_REASON). A machine that is
+    // still waiting returns straight away without running anything. Errors
+    // are returned rather than thrown, the crash dump is kept for
+    // get_error() and every call returns ERROR until the next reset(),
+    // load_rom() or load_state().
+    STOP_REASON run_for(std::uint64_t cycles);
+    // Run one frame of `cycles`. Once the machine stops to wait nothing else
+    // can happen before the next frame, so the rest of the frame is counted
+    // without being executed. Returns BUDGET or the first reason the machine
+    // stopped.
+    STOP_REASON run_frame(std::uint64_t cycles=instructions_per_frame);
+    const std::string &get_error() const;
+
     void vblank_trigger();
 
     void fetch();
     void decode();
     void execute();
 
-    void _8XYN();
-    void _DXYN();
-    void _FXNN();
-
   private:
-    std::default_random_engine e;
-    std::uniform_int_distribution<int> dist;
+    // the quirk profile is a template parameter of everything on the hot
+    // path, one instantiation per profile is selected by set_quirks()
+    template <typename Q, bool stop_on_wait, bool use_native>
+    STOP_REASON run_impl(std::uint64_t cycles);
+    template <typename Q> void select_handlers();
+    template <typename Q> void execute_impl();
+#ifdef KATE_USE_JIT
+    // runs the compiled block at the PC, if there is one and it fits in
+    // `cycles`, as if each of its instructions had been stepped. Returns the
+    // number of instructions run, 0 if there was no block.
+    template <typename Q> std::uint64_t run_block(std::uint64_t cycles);
+    void enter_block(const Jit::Block &block);
+#endif
+    // runs the native block at the PC, returning the instructions run, 0 if
+    // there is none
+    std::uint64_t run_native(std::uint64_t cycles);
+    // re-check the native blocks overlapping these bytes against the ram
+    void refresh_native(std::size_t address, std::size_t length);
 
-    std::array<std::uint8_t, 0x4000> ram;
-    std::array<std::uint8_t, 16> registers;
-    std::array<std::uint8_t, 16> key_states;
-    std::array<std::uint16_t, 16> stack;
-    std::uint16_t program_counter;
-    std::uint16_t stack_pointer;
-    std::uint16_t index_register;
-    std::uint8_t delay_timer;
-    std::uint8_t sound_timer;
+    // May return a superinstruction, which the caller has to replace with
+    // its first instruction if there aren't enough cycles left to run all of
+    // it.
+    void next_instruction();
+    // turns the instruction just decoded into a superinstruction if it
+    // starts one, decoding the rest of it into the cache too
+    void fuse();
+    // counts a superinstruction in the profile
+    void enter_fused();
+    // moves on to the next instruction of a superinstruction
+    void next_fused();
+    // Called after an FX07 3X00 1NNN superinstruction. If it jumped back to
+    // itself the delay timer hasn't run out, and every pass until the host
+    // next calls decrement_timers() would do exactly the same. As many whole
+    // passes as fit in `cycles` are counted without being run, returning the
+    // cycles counted.
+    std::uint64_t skip_idle(std::uint64_t cycles);
+    // true if the instruction just executed left the machine waiting. A
+    // DXYN or FX0A stays waiting until the host wakes it, see `waiting`.
+    bool is_stopped(STOP_REASON &reason);
+    void drop_decode_cache();
+    void mark_dirty(RowMask rows);
+    // records an edge if the sound timer has just started or stopped
+    void update_beeper();
+    void invalidate_decode_cache(std::size_t address, std::size_t length);
+    // throws if `length` bytes from I would run past the end of ram
+    void check_index_register(std::size_t length);
 
-    // each pixel is stored as a whole byte.
-    // this is inneficcient but inconsequential.
-    std::vector<std::uint8_t> output_buffer;
-    bool is_blocking;
-    bool is_vblank;
-    Instruction cur_inst;
-    std::uint64_t cycle_counter;
-    std::uint16_t prev_program_counter;
-    std::pair<int, KEY_EVENT> last_key_event;
+    void _00E0();
+    void _00EE();
+    void _1NNN();
+    void _2NNN();
+    void _3XNN();
+    void _4XNN();
+    void _5XY0();
+    void _6XNN();
+    void _7XNN();
+    void _8XY0();
+    template <typename Q> void _8XY1();
+    template <typename Q> void _8XY2();
+    template <typename Q> void _8XY3();
+    void _8XY4();
+    void _8XY5();
+    template <typename Q> void _8XY6();
+    void _8XY7();
+    template <typename Q> void _8XYE();
+    void _9XY0();
+    void _ANNN();
+    template <typename Q> void _BNNN();
+    void _CXNN();
+    template <typename Q> void _DXYN();
+    void _EX9E();
+    void _EXA1();
+    void _FX07();
+    void _FX0A();
+    void _FX15();
+    void _FX18();
+    void _FX1E();
+    void _FX29();
+    void _FX33();
+    template <typename Q> void _FX55();
+    template <typename Q> void _FX65();
+    void _INVALID();
+
+    template <typename Q> void _6XNN_6YNN_DXYN();
+    void _FX07_3X00_1NNN();
+    template <typename Q> void _FX1E_FX65();
+
+    QUIRKS quirks;
+    STOP_REASON (Interpreter::*run_fn)(std::uint64_t);
+    STOP_REASON (Interpreter::*run_for_fn)(std::uint64_t);
+    void (Interpreter::*execute_fn)();
+
+    State state;
+    std::uint64_t rng_seed;
+    Movie *recording;
+    std::string error;
+
+    // VBLANK_WAIT or KEY_WAIT while a DXYN or FX0A is waiting, BUDGET
+    // otherwise. Running it again would change nothing but the cycle
+    // counter until vblank_trigger() or keyrelease() clears this. Derived
+    // from the State, so it is cleared when one is restored and the
+    // instruction runs once more to find out.
+    STOP_REASON waiting;
+
+    // kept outside of State so restoring one still counts as a change
+    std::uint64_t framebuffer_generation;
+    RowMask dirty_rows;
+
+    bool beeper;
+    std::vector<SoundEdge> sound_edges;
+
+#ifdef KATE_PROFILE
+    Profile profile;
+#endif
+
+    // instructions are decoded once per address and then reused, entries are
+    // invalidated whenever the ram underneath them (or under the rest of a
+    // superinstruction) is written. An entry is only valid if its epoch
+    // matches `decode_epoch`, so the whole cache can be dropped by
+    // incrementing it.
+    std::array<Instruction, 0x4000> decode_cache;
+    std::array<std::uint32_t, 0x4000> decode_cache_epoch;
+    std::uint32_t decode_epoch;
+
+#ifdef KATE_USE_JIT
+    // dropped and invalidated along with the decode cache
+    Jit jit;
+#endif
+
+    // the attached native module, the block to run at each address (nullptr
+    // where there is none or the ram no longer matches), and whether any
+    // block was compiled from each byte. Empty while nothing is attached.
+    const NativeModule *native;
+    std::vector<const NativeBlock *> native_blocks;
+    std::vector<bool> native_bytes;
   };
 }
 
@@ -0,0 +1,596 @@
+// only built with `make JIT=1`, see jit.hpp
+#ifdef KATE_JIT
+
+#include <algorithm> // std::fill, std::max, std::min
+#include <string>
+
+#include <cstddef> // offsetof
+#include <cstdlib> // std::getenv
+
+#include <sys/mman.h>
+#include <unistd.h> // close, ftruncate, getpid
+
+#include "interpreter.hpp"
+#include "jit.hpp"
+
+// the code buffer, everything is thrown away when it fills up
+constexpr std::size_t code_size = 1 << 20;
+// shorter blocks don't win back the cost of entering one
+constexpr std::size_t min_block_length = 2;
+constexpr std::size_t max_block_length = 64;
+// no block of max_block_length instructions can be larger than this
+constexpr std::size_t max_block_bytes = 4096;
+// a block invalidated this many times is left to the interpreter
+constexpr std::uint8_t max_rewrites = 4;
+
+static_assert(offsetof(kate::State, registers) <= 0x7fffffff);
+static_assert(offsetof(kate::State, index_register) <= 0x7fffffff);
+static_assert(offsetof(kate::State, delay_timer) <= 0x7fffffff);
+
+namespace {
+  enum Reg : std::uint8_t {
+    EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+  };
+
+  // Registers for V0-VF, in the order they are handed out. The block is
+  // called with the State in rdi. eax, ecx and edx are left as scratch and
+  // I is kept in r14, everything from rbx on has to be saved.
+  constexpr Reg pool[] = {ESI, R8, R9, R10, R11, EBX, EBP, R12, R13};
+  constexpr std::size_t pool_size = sizeof(pool) / sizeof(pool[0]);
+  constexpr Reg ir = R14;
+
+  bool callee_saved(Reg r) {
+    return (r == EBX) || (r == EBP) || (r >= R12);
+  }
+
+  // Just enough of an x86-64 assembler for the instructions below. Every
+  // operation is on 32 bit registers, with byte and word loads and stores
+  // to [rdi + disp32].
+  class Emitter {
+  public:
+    explicit Emitter(std::uint8_t *out) : out(out), used(0) {}
+
+    std::size_t size() const {
+      return used;
+    }
+
+    void mov(Reg dst, Reg src) { op_rr(0x89, dst, src); }
+    void add(Reg dst, Reg src) { op_rr(0x01, dst, src); }
+    void or_(Reg dst, Reg src) { op_rr(0x09, dst, src); }
+    void and_(Reg dst, Reg src) { op_rr(0x21, dst, src); }
+    void sub(Reg dst, Reg src) { op_rr(0x29, dst, src); }
+    void xor_(Reg dst, Reg src) { op_rr(0x31, dst, src); }
+    void cmp(Reg dst, Reg src) { op_rr(0x39, dst, src); }
+
+    void mov(Reg dst, std::uint32_t imm) {
+      rex(false, EAX, dst);
+      emit8(0xb8 + (dst & 7));
+      emit32(imm);
+    }
+    void add(Reg dst, std::uint32_t imm) { op_ri(0, dst, imm); }
+    void and_(Reg dst, std::uint32_t imm) { op_ri(4, dst, imm); }
+    void cmp(Reg dst, std::uint32_t imm) { op_ri(7, dst, imm); }
+
+    void shl1(Reg r) { op_shift(4, r); }
+    void shr1(Reg r) { op_shift(5, r); }
+    void shr(Reg r, std::uint8_t n) {
+      rex(false, EAX, r);
+      emit8(0xc1);
+      modrm(3, 5, r);
+      emit8(n);
+    }
+
+    // dst = src * imm
+    void imul(Reg dst, Reg src, std::uint8_t imm) {
+      rex(false, dst, src);
+      emit8(0x6b);
+      modrm(3, dst, src);
+      emit8(imm);
+    }
+
+    // set the low byte, only for eax to ebx which need no REX prefix
+    void setae(Reg r) { op_setcc(0x93, r); }
+    void sete(Reg r) { op_setcc(0x94, r); }
+
+    // zero extending loads from, and stores of the low byte or word to,
+    // the State
+    void load_u8(Reg dst, std::size_t disp) { op_mem(0xb6, dst, disp); }
+    void load_u16(Reg dst, std::size_t disp) { op_mem(0xb7, dst, disp); }
+    void store_u8(std::size_t disp, Reg src) {
+      // without a REX prefix, 6 and 7 would be dh and bh rather than sil and
+      // dil
+      emit8(0x40 | ((src >> 3) << 2));
+      emit8(0x88);
+      modrm(2, src, EDI);
+      emit32(disp);
+    }
+    void store_u16(std::size_t disp, Reg src) {
+      emit8(0x66);
+      rex(false, src, EDI);
+      emit8(0x89);
+      modrm(2, src, EDI);
+      emit32(disp);
+    }
+
+    void push(Reg r) {
+      rex(false, EAX, r);
+      emit8(0x50 + (r & 7));
+    }
+    void pop(Reg r) {
+      rex(false, EAX, r);
+      emit8(0x58 + (r & 7));
+    }
+    void ret() {
+      emit8(0xc3);
+    }
+
+  private:
+    void emit8(std::uint8_t b) {
+      out[used++] = b;
+    }
+    void emit32(std::uint32_t w) {
+      for (std::size_t i = 0; i < 4; ++i) {
+        emit8((w >> (i * 8)) & 0xff);
+      }
+    }
+
+    // only emitted when one of the registers is r8-r15
+    void rex(bool w, Reg reg, Reg rm) {
+      std::uint8_t prefix = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+      if (prefix != 0x40) {
+        emit8(prefix);
+      }
+    }
+    void modrm(std::uint8_t mod, std::uint8_t reg, std::uint8_t rm) {
+      emit8((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    void op_rr(std::uint8_t opcode, Reg dst, Reg src) {
+      rex(false, src, dst);
+      emit8(opcode);
+      modrm(3, src, dst);
+    }
+    void op_ri(std::uint8_t ext, Reg dst, std::uint32_t imm) {
+      rex(false, EAX, dst);
+      emit8(0x81);
+      modrm(3, ext, dst);
+      emit32(imm);
+    }
+    void op_shift(std::uint8_t ext, Reg r) {
+      rex(false, EAX, r);
+      emit8(0xd1);
+      modrm(3, ext, r);
+    }
+    void op_setcc(std::uint8_t opcode, Reg r) {
+      emit8(0x0f);
+      emit8(opcode);
+      modrm(3, 0, r);
+    }
+    void op_mem(std::uint8_t opcode, Reg dst, std::size_t disp) {
+      rex(false, dst, EDI);
+      emit8(0x0f);
+      emit8(opcode);
+      modrm(2, dst, EDI);
+      emit32(disp);
+    }
+
+    std::uint8_t *out;
+    std::size_t used;
+  };
+
+  // what an instruction does to V0-VF and I
+  struct Access {
+    bool translatable;
+    std::uint16_t reads;
+    std::uint16_t writes;
+    bool reads_i;
+    bool writes_i;
+  };
+
+  template <typename Q>
+  Access access(const kate::Instruction &inst) {
+    using kate::HANDLER;
+
+    std::uint16_t x = 1 << inst.x;
+    std::uint16_t y = 1 << inst.y;
+    std::uint16_t f = 1 << 0xf;
+
+    switch (inst.handler) {
+      case HANDLER::MOV         : return {true, 0, x, false, false};
+      case HANDLER::ADD         : return {true, x, x, false, false};
+      case HANDLER::ALU_MOV     : return {true, y, x, false, false};
+      case HANDLER::ALU_OR      :
+      case HANDLER::ALU_AND     :
+      case HANDLER::ALU_XOR     :
+        if constexpr (Q::enable_flags_reset) {
+          return {true, std::uint16_t(x | y), std::uint16_t(x | f), false,
+                  false};
+        } else {
+          return {true, std::uint16_t(x | y), x, false, false};
+        }
+      case HANDLER::ALU_ADD     :
+      case HANDLER::ALU_SUB     :
+      case HANDLER::ALU_RSUB    :
+        return {true, std::uint16_t(x | y), std::uint16_t(x | f), false,
+                false};
+      case HANDLER::ALU_SHR     :
+      case HANDLER::ALU_SHL     :
+        if constexpr (Q::shifting_ignores_y) {
+          return {true, x, std::uint16_t(x | f), false, false};
+        } else {
+          return {true, y, std::uint16_t(x | f), false, false};
+        }
+      case HANDLER::ALU_UNKNOWN : return {true, 0, 0, false, false};
+      case HANDLER::LDI         : return {true, 0, 0, false, true};
+      case HANDLER::GET_DT      : return {true, 0, x, false, false};
+      case HANDLER::SET_DT      : return {true, x, 0, false, false};
+      case HANDLER::ADD_IR      : return {true, x, 0, true, true};
+      case HANDLER::GET_CHAR    : return {true, x, 0, false, true};
+      default                   : return {false, 0, 0, false, false};
+    }
+  }
+
+  template <typename Q>
+  void emit_instruction(
+    Emitter &e, const kate::Instruction &inst, const Reg (&v)[16]
+  ) {
+    using kate::HANDLER;
+
+    constexpr std::size_t dt = offsetof(kate::State, delay_timer);
+
+    Reg x = v[inst.x];
+    Reg y = v[inst.y];
+    Reg f = v[0xf];
+
+    switch (inst.handler) {
+      case HANDLER::MOV:
+        e.mov(x, std::uint32_t(inst.n));
+        break;
+      case HANDLER::ADD:
+        e.add(x, std::uint32_t(inst.n));
+        e.and_(x, 0xffu);
+        break;
+      case HANDLER::ALU_MOV:
+        e.mov(x, y);
+        break;
+      case HANDLER::ALU_OR:
+      case HANDLER::ALU_AND:
+      case HANDLER::ALU_XOR:
+        if (inst.handler == HANDLER::ALU_OR) {
+          e.or_(x, y);
+        } else if (inst.handler == HANDLER::ALU_AND) {
+          e.and_(x, y);
+        } else {
+          e.xor_(x, y);
+        }
+        if constexpr (Q::enable_flags_reset) {
+          e.mov(f, 0u);
+        }
+        break;
+      case HANDLER::ALU_ADD:
+        // the carry is bit 8 of the 32 bit sum
+        e.mov(EAX, x);
+        e.add(EAX, y);
+        e.mov(x, EAX);
+        e.and_(x, 0xffu);
+        e.shr(EAX, 8);
+        e.mov(f, EAX);
+        break;
+      case HANDLER::ALU_SUB:
+        // VF is 1 when there was no borrow, and always when x == y
+        if (inst.x == inst.y) {
+          e.mov(x, 0u);
+          e.mov(f, 1u);
+          break;
+        }
+        e.xor_(ECX, ECX);
+        e.cmp(x, y);
+        e.setae(ECX);
+        e.sub(x, y);
+        e.and_(x, 0xffu);
+        e.mov(f, ECX);
+        break;
+      case HANDLER::ALU_RSUB:
+        // with x == y, VF is whether Vx was 0 beforehand
+        e.xor_(ECX, ECX);
+        if (inst.x == inst.y) {
+          e.cmp(x, 0u);
+          e.sete(ECX);
+          e.mov(x, 0u);
+        } else {
+          e.cmp(y, x);
+          e.setae(ECX);
+          e.mov(EAX, y);
+          e.sub(EAX, x);
+          e.and_(EAX, 0xffu);
+          e.mov(x, EAX);
+        }
+        e.mov(f, ECX);
+        break;
+      case HANDLER::ALU_SHR:
+        if constexpr (!Q::shifting_ignores_y) {
+          e.mov(x, y);
+        }
+        e.mov(ECX, x);
+        e.and_(ECX, 1u);
+        e.shr1(x);
+        e.mov(f, ECX);
+        break;
+      case HANDLER::ALU_SHL:
+        if constexpr (!Q::shifting_ignores_y) {
+          e.mov(x, y);
+        }
+        e.mov(ECX, x);
+        e.shr(ECX, 7);
+        e.shl1(x);
+        e.and_(x, 0xffu);
+        e.mov(f, ECX);
+        break;
+      case HANDLER::LDI:
+        e.mov(ir, std::uint32_t(inst.n));
+        break;
+      case HANDLER::GET_DT:
+        e.load_u8(x, dt);
+        break;
+      case HANDLER::SET_DT:
+        e.store_u8(dt, x);
+        break;
+      case HANDLER::ADD_IR:
+        e.add(ir, x);
+        e.and_(ir, 0xffffu);
+        break;
+      case HANDLER::GET_CHAR:
+        e.imul(EAX, x, 5);
+        e.add(EAX, std::uint32_t(kate::char_pointer));
+        e.mov(ir, EAX);
+        break;
+      default:
+        // ALU_UNKNOWN does nothing
+        break;
+    }
+  }
+}
+
+kate::Jit::Jit() : code(nullptr), code_writable(nullptr), perf_map(nullptr) {
+  // The same memory is mapped twice, executable and writable, so it never
+  // has to be both at once and nothing needs re-protecting per block
+  int fd = memfd_create("kate-jit", MFD_CLOEXEC);
+  if ((fd >= 0) && (ftruncate(fd, code_size) == 0)) {
+    void *x = mmap(nullptr, code_size, PROT_READ | PROT_EXEC, MAP_SHARED,
+                   fd, 0);
+    void *w = mmap(nullptr, code_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+
+    if ((x != MAP_FAILED) && (w != MAP_FAILED)) {
+      code = static_cast<std::uint8_t *>(x);
+      code_writable = static_cast<std::uint8_t *>(w);
+    } else {
+      if (x != MAP_FAILED) {
+        munmap(x, code_size);
+      }
+      if (w != MAP_FAILED) {
+        munmap(w, code_size);
+      }
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  if (std::getenv("KATE_PERF_MAP")) {
+    std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+    perf_map = std::fopen(path.c_str(), "a");
+  }
+
+  clear();
+}
+
+kate::Jit::~Jit() {
+  if (code) {
+    munmap(code, code_size);
+    munmap(code_writable, code_size);
+  }
+  if (perf_map) {
+    std::fclose(perf_map);
+  }
+}
+
+void kate::Jit::invalidate(std::size_t address, std::size_t length) {
+  // a decision not to compile at an address depends on the next two
+  // instructions, so anything up to three bytes before the write can change
+  std::size_t begin = (address > 3) ? address - 3 : 0;
+  std::size_t end = std::min(address + length, covered.size());
+
+  // writes to data, by far the most common, end here
+  auto last = covered.cbegin() + end;
+  if (std::find(covered.cbegin() + begin, last, true) == last) {
+    return;
+  }
+
+  for (std::size_t i = begin; i < end; ++i) {
+    if (entries[i] == no_block) {
+      entries[i] = not_compiled;
+    }
+  }
+
+  for (Block &block : blocks) {
+    if (block.fn && (block.start < end) && (block.end > address)) {
+      entries[block.start] = not_compiled;
+      block.fn = nullptr;
+
+      if (rewrites[block.start] < max_rewrites) {
+        ++rewrites[block.start];
+      }
+    }
+  }
+}
+
+void kate::Jit::clear() {
+  entries.fill(not_compiled);
+  covered.fill(false);
+  rewrites.fill(0);
+  blocks.clear();
+  code_used = 0;
+}
+
+template <typename Q>
+const kate::Jit::Block *kate::Jit::compile(
+  const std::array<std::uint8_t, 0x4000> &ram, std::uint16_t address
+) {
+  // code that keeps rewriting itself would spend all its time compiling
+  if (!code || (rewrites[address] >= max_rewrites)) {
+    covered[address] = true;
+    entries[address] = no_block;
+    return nullptr;
+  }
+
+  // find how far the block goes, and which registers it needs
+  std::vector<Instruction> insts;
+  std::uint16_t used = 0;
+  std::uint16_t written = 0;
+  bool uses_i = false;
+  bool writes_i = false;
+
+  std::size_t a = address;
+  std::size_t read_end = 0;
+  while ((insts.size() < max_block_length) && (a + 1 < ram.size())) {
+    Instruction inst = decode_instruction((ram[a] << 8) | ram[a + 1]);
+    Access acc = access<Q>(inst);
+    if (!acc.translatable) {
+      break;
+    }
+
+    // left for the interpreter to run as a superinstruction, which also
+    // read the rest of it
+    if (
+      (a + 6 <= ram.size()) &&
+      (fused_handler(inst, &ram[a + 2]) != inst.handler)
+    ) {
+      read_end = a + 6;
+      break;
+    }
+
+    std::uint16_t regs = used | acc.reads | acc.writes;
+    if (static_cast<std::size_t>(__builtin_popcount(regs)) > pool_size) {
+      break;
+    }
+
+    used = regs;
+    written |= acc.writes;
+    uses_i |= acc.reads_i || acc.writes_i;
+    writes_i |= acc.writes_i;
+    insts.push_back(inst);
+    a += 2;
+  }
+
+  // the instruction the block stopped at was looked at too
+  read_end = std::min(std::max(read_end, a + 2), covered.size());
+  std::fill(&covered[address], &covered[0] + read_end, true);
+
+  if (insts.size() < min_block_length) {
+    entries[address] = no_block;
+    return nullptr;
+  }
+
+  if (code_used + max_block_bytes > code_size) {
+    // the rewrite counts are kept, they are about the program not the buffer
+    std::array<std::uint8_t, 0x4000> counts = rewrites;
+    clear();
+    rewrites = counts;
+    std::fill(&covered[address], &covered[0] + read_end, true);
+  }
+
+  Reg v[16];
+  std::size_t next = 0;
+  for (std::size_t i = 0; i < 16; ++i) {
+    v[i] = (used & (1 << i)) ? pool[next++] : EAX;
+  }
+
+  std::size_t regs = offsetof(State, registers);
+  std::size_t ir_offset = offsetof(State, index_register);
+
+  Emitter e(code_writable + code_used);
+
+  // prologue: save what the ABI needs saved, then load the registers
+  std::vector<Reg> saved;
+  for (std::size_t i = 0; i < next; ++i) {
+    if (callee_saved(pool[i])) {
+      saved.push_back(pool[i]);
+    }
+  }
+  if (uses_i) {
+    saved.push_back(ir);
+  }
+  for (Reg r : saved) {
+    e.push(r);
+  }
+  for (std::size_t i = 0; i < 16; ++i) {
+    if (used & (1 << i)) {
+      e.load_u8(v[i], regs + i);
+    }
+  }
+  if (uses_i) {
+    e.load_u16(ir, ir_offset);
+  }
+
+  for (const Instruction &inst : insts) {
+    emit_instruction<Q>(e, inst, v);
+  }
+
+  // epilogue: store back only what changed
+  for (std::size_t i = 0; i < 16; ++i) {
+    if (written & (1 << i)) {
+      e.store_u8(regs + i, v[i]);
+    }
+  }
+  if (writes_i) {
+    e.store_u16(ir_offset, ir);
+  }
+  for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+    e.pop(*it);
+  }
+  e.ret();
+
+  Block block;
+  block.fn = reinterpret_cast<void (*)(State *)>(code + code_used);
+  block.count = insts.size();
+  block.start = address;
+  block.last = a - 2;
+  block.end = a;
+  block.last_raw = insts.back().raw;
+
+  code_used += e.size();
+  write_perf_map(block, e.size());
+
+  entries[address] = blocks.size();
+  blocks.push_back(block);
+  return &blocks.back();
+}
+
+void kate::Jit::write_perf_map(const Block &block, std::size_t size) {
+  if (!perf_map) {
+    return;
+  }
+
+  // perf reads the map when it reports, so a block compiled into space
+  // freed by clear() shows up under the name of the last one there
+  std::fprintf(
+    perf_map, "%lx %zx kate_block_%04x\n",
+    reinterpret_cast<unsigned long>(block.fn), size,
+    static_cast<unsigned>(block.start)
+  );
+  std::fflush(perf_map);
+}
+
+template const kate::Jit::Block *kate::Jit::compile<kate::COSMAC_VIP>(
+  const std::array<std::uint8_t, 0x4000> &ram, std::uint16_t address
+);
+template const kate::Jit::Block *kate::Jit::compile<kate::SUPER_CHIP>(
+  const std::array<std::uint8_t, 0x4000> &ram, std::uint16_t address
+);
+template const kate::Jit::Block *kate::Jit::compile<kate::XO_CHIP>(
+  const std::array<std::uint8_t, 0x4000> &ram, std::uint16_t address
+);
+
+#endif // KATE_JIT
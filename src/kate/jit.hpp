@@ -0,0 +1,108 @@
+#ifndef __KATE_JIT__
+#define __KATE_JIT__
+
+#include <array>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include "config.hpp"
+
+#if !defined(__x86_64__) || !defined(__linux__)
+  #error "the JIT (make JIT=1) only targets x86-64 Linux"
+#endif
+
+namespace kate {
+  struct State;
+
+  // Translates straight-line runs of register instructions (6XNN, 7XNN,
+  // 8XYN, ANNN, FX07, FX15, FX1E, FX29) into x86-64. A block ends at the
+  // first instruction it can't translate, so jumps, calls, skips, DRAW and
+  // anything touching memory or the host are always left to the interpreter,
+  // which executes them straight after the block. A block also stops before
+  // any sequence the interpreter would run as a superinstruction (see
+  // fused_handler()), so those are never split.
+  //
+  // Within a block V0-VF and I live in host registers, only those that were
+  // written are stored back to the State when it returns.
+  //
+  // Only built with KATE_JIT defined (`make JIT=1`).
+  class Jit {
+  public:
+    struct Block {
+      void (*fn)(State *);
+      // instructions in the block
+      std::uint16_t count;
+      // the address of the first and last instruction, and the one after it
+      std::uint16_t start;
+      std::uint16_t last;
+      std::uint16_t end;
+      // the opcode of the last instruction
+      std::uint16_t last_raw;
+    };
+
+    Jit();
+    ~Jit();
+
+    Jit(const Jit &) = delete;
+    Jit &operator=(const Jit &) = delete;
+
+    // The block starting at `address`, compiling it on first use. Returns
+    // nullptr if there is nothing there worth compiling, which is also
+    // remembered. Q must be the quirk profile the interpreter is running.
+    template <typename Q>
+    const Block *lookup(
+      const std::array<std::uint8_t, 0x4000> &ram, std::uint16_t address
+    ) {
+      std::uint32_t entry = entries[address];
+      if (entry < no_block) {
+        return &blocks[entry];
+      }
+      if (entry == no_block) {
+        return nullptr;
+      }
+
+      return compile<Q>(ram, address);
+    }
+
+    // drop every block that could have been translated from these bytes
+    void invalidate(std::size_t address, std::size_t length);
+    // drop everything, e.g. the ram was replaced or the quirks changed
+    void clear();
+
+  private:
+    template <typename Q>
+    const Block *compile(
+      const std::array<std::uint8_t, 0x4000> &ram, std::uint16_t address
+    );
+    void write_perf_map(const Block &block, std::size_t size);
+
+    // no block compiled here yet, and none worth compiling
+    static constexpr std::uint32_t not_compiled = 0xffffffff;
+    static constexpr std::uint32_t no_block = 0xfffffffe;
+
+    // per address, not_compiled, no_block or an index into `blocks`
+    std::array<std::uint32_t, 0x4000> entries;
+    // set for every address some block (or decision not to make one) was
+    // read from, so writes to data never have to search `blocks`
+    std::array<bool, 0x4000> covered;
+    // how often the block at each address was invalidated
+    std::array<std::uint8_t, 0x4000> rewrites;
+    // blocks that were invalidated stay here, with `fn` cleared, until the
+    // next clear()
+    std::vector<Block> blocks;
+
+    // the code buffer, mapped once executable and once writable. nullptr if
+    // that failed, then nothing is ever compiled.
+    std::uint8_t *code;
+    std::uint8_t *code_writable;
+    std::size_t code_used;
+
+    // appended to /tmp/perf-<pid>.map when KATE_PERF_MAP is set
+    std::FILE *perf_map;
+  };
+}
+
+#endif // __KATE_JIT__
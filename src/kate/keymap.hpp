@@ -0,0 +1,32 @@
+#ifndef __KATE_KEYMAP__
+#define __KATE_KEYMAP__
+
+#include <array>
+
+#include <GLFW/glfw3.h>
+
+namespace kate {
+  // keybindings
+  // kept apart from config.hpp so that the interpreter core does not depend
+  // on GLFW.
+  constexpr std::array<int, 16> key_map = {
+    GLFW_KEY_X, // keypad 0
+    GLFW_KEY_1, // keypad 1
+    GLFW_KEY_2, // keypad 2
+    GLFW_KEY_3, // keypad 3
+    GLFW_KEY_Q, // keypad 4
+    GLFW_KEY_W, // keypad 5
+    GLFW_KEY_E, // keypad 6
+    GLFW_KEY_A, // keypad 7
+    GLFW_KEY_S, // keypad 8
+    GLFW_KEY_D, // keypad 9
+    GLFW_KEY_Z, // keypad a
+    GLFW_KEY_C, // keypad b
+    GLFW_KEY_4, // keypad c
+    GLFW_KEY_R, // keypad d
+    GLFW_KEY_F, // keypad e
+    GLFW_KEY_V  // keypad f
+  };
+}
+
+#endif // __KATE_KEYMAP__
@@ -0,0 +1,178 @@
+#include <algorithm> // std::equal, std::min
+#include <limits>
+#include <string>
+
+#include "movie.hpp"
+
+constexpr char magic[] = "KATEMOVI";
+constexpr std::size_t magic_size = sizeof(magic) - 1;
+
+/******************************************************************************
+/ Exceptions                                                                  /
+******************************************************************************/
+kate::invalid_movie::invalid_movie(const std::string &msg)
+: interpreter_error(msg) {}
+kate::invalid_movie::invalid_movie(const char *msg)
+: interpreter_error(msg) {}
+
+/******************************************************************************
+/ Serialization                                                               /
+******************************************************************************/
+static void put(
+  std::vector<std::uint8_t> &data, std::uint64_t value, std::size_t bytes
+) {
+  for (std::size_t i = 0; i < bytes; ++i) {
+    data.push_back((value >> (i * 8)) & 0xff);
+  }
+}
+
+static std::uint64_t get(
+  const std::vector<std::uint8_t> &data, std::size_t &pos, std::size_t bytes
+) {
+  if (pos + bytes > data.size()) {
+    throw kate::invalid_movie("movie is truncated");
+  }
+
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < bytes; ++i) {
+    value |= static_cast<std::uint64_t>(data[pos++]) << (i * 8);
+  }
+  return value;
+}
+
+static void put_varint(std::vector<std::uint8_t> &data, std::uint64_t value) {
+  while (value >= 0x80) {
+    data.push_back((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  data.push_back(value);
+}
+
+static std::uint64_t get_varint(
+  const std::vector<std::uint8_t> &data, std::size_t &pos
+) {
+  std::uint64_t value = 0;
+
+  for (std::size_t shift = 0; shift < 64; shift += 7) {
+    std::uint8_t b = get(data, pos, 1);
+    value |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+
+    if (!(b & 0x80)) {
+      return value;
+    }
+  }
+
+  throw kate::invalid_movie("invalid cycle count in movie");
+}
+
+std::vector<std::uint8_t> kate::serialize_movie(const Movie &movie) {
+  std::vector<std::uint8_t> data(magic, magic + magic_size);
+
+  put(data, movie_version, 2);
+  put(data, static_cast<std::uint8_t>(movie.quirks), 1);
+  put(data, movie.seed, 8);
+  put(data, movie.rom_hash, 8);
+  put(data, movie.events.size(), 4);
+
+  std::uint64_t cycle = 0;
+  for (const MovieEvent &e : movie.events) {
+    put_varint(data, e.cycle - cycle);
+    data.push_back((static_cast<std::uint8_t>(e.type) << 4) | (e.key & 0xf));
+    cycle = e.cycle;
+  }
+
+  return data;
+}
+
+kate::Movie kate::deserialize_movie(const std::vector<std::uint8_t> &data) {
+  if (
+    (data.size() < magic_size) ||
+    !std::equal(magic, magic + magic_size, data.begin())
+  ) {
+    throw invalid_movie("not a movie");
+  }
+
+  std::size_t pos = magic_size;
+  std::uint16_t version = get(data, pos, 2);
+  if (version != movie_version) {
+    throw invalid_movie("unsupported movie version " + std::to_string(version));
+  }
+
+  Movie movie;
+  std::uint8_t q = get(data, pos, 1);
+  if (q > static_cast<std::uint8_t>(QUIRKS::XO_CHIP)) {
+    throw invalid_movie("unknown quirks profile in movie");
+  }
+  movie.quirks = static_cast<QUIRKS>(q);
+  movie.seed = get(data, pos, 8);
+  movie.rom_hash = get(data, pos, 8);
+
+  std::size_t count = get(data, pos, 4);
+  std::uint64_t cycle = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    cycle += get_varint(data, pos);
+
+    std::uint8_t b = get(data, pos, 1);
+    std::uint8_t type = b >> 4;
+    std::uint8_t key = b & 0xf;
+    if (type > static_cast<std::uint8_t>(MOVIE_EVENT::TIMERS)) {
+      throw invalid_movie("invalid event in movie");
+    }
+    movie.events.push_back({cycle, static_cast<MOVIE_EVENT>(type), key});
+  }
+
+  if (pos != data.size()) {
+    throw invalid_movie("trailing data in movie");
+  }
+
+  return movie;
+}
+
+/******************************************************************************
+/ Playback                                                                    /
+******************************************************************************/
+kate::MoviePlayer::MoviePlayer(const Movie &movie, Interpreter &interpreter)
+: movie(movie), interpreter(interpreter), next_event(0) {}
+
+void kate::MoviePlayer::run(std::uint64_t cycles) {
+  std::uint64_t end = interpreter.get_cycle_counter() + cycles;
+
+  while (true) {
+    apply_events();
+
+    std::uint64_t cycle = interpreter.get_cycle_counter();
+    if (cycle >= end) {
+      break;
+    }
+
+    std::uint64_t next = std::numeric_limits<std::uint64_t>::max();
+    if (!finished()) {
+      next = movie.events[next_event].cycle;
+    }
+
+    interpreter.run(std::min(end, next) - cycle);
+  }
+}
+
+bool kate::MoviePlayer::finished() const {
+  return next_event >= movie.events.size();
+}
+
+std::uint64_t kate::MoviePlayer::length() const {
+  return movie.events.empty() ? 0 : movie.events.back().cycle;
+}
+
+void kate::MoviePlayer::apply_events() {
+  std::uint64_t cycle = interpreter.get_cycle_counter();
+
+  while (!finished() && (movie.events[next_event].cycle <= cycle)) {
+    const MovieEvent &e = movie.events[next_event++];
+
+    switch (e.type) {
+      case MOVIE_EVENT::PRESS   : interpreter.keypress(e.key); break;
+      case MOVIE_EVENT::RELEASE : interpreter.keyrelease(e.key); break;
+      case MOVIE_EVENT::VBLANK  : interpreter.vblank_trigger(); break;
+      case MOVIE_EVENT::TIMERS  : interpreter.decrement_timers(); break;
+    }
+  }
+}
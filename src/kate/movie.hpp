@@ -0,0 +1,86 @@
+#ifndef __KATE_MOVIE__
+#define __KATE_MOVIE__
+
+#include <vector>
+
+#include <cstdint>
+
+#include "config.hpp"
+#include "interpreter.hpp"
+
+namespace kate {
+  class invalid_movie : public interpreter_error {
+  public:
+    explicit invalid_movie(const std::string& msg);
+    explicit invalid_movie(const char* msg);
+  };
+
+  enum class MOVIE_EVENT : std::uint8_t {
+    PRESS,
+    RELEASE,
+    VBLANK,
+    TIMERS
+  };
+
+  // `cycle` is the value of the cycle counter when the event was applied,
+  // i.e. the number of instructions executed before it
+  struct MovieEvent {
+    std::uint64_t cycle;
+    MOVIE_EVENT type;
+    std::uint8_t key;
+  };
+
+  // Everything outside the interpreter that affects a run: the quirks, the
+  // random seed, and every input and timer event along with the cycle it
+  // happened on. Given the same rom, playing it back reproduces the run
+  // exactly, however fast or slow the host is.
+  //
+  // On disk, after a short header:
+  //
+  //   "KATEMOVI"  8 bytes
+  //   version     u16
+  //   quirks      u8
+  //   seed        u64
+  //   rom hash    u64 (as chosen by the host, 0 if unused)
+  //   events      u32
+  //
+  // each event is the number of cycles since the previous one as an LEB128
+  // varint, followed by one byte holding the type (high nibble) and key (low
+  // nibble). Frames with no input cost two bytes per event.
+  struct Movie {
+    QUIRKS quirks;
+    std::uint64_t seed;
+    std::uint64_t rom_hash;
+    std::vector<MovieEvent> events;
+  };
+
+  constexpr std::uint16_t movie_version = 1;
+
+  std::vector<std::uint8_t> serialize_movie(const Movie &movie);
+  // throws invalid_movie if `data` isn't a movie of the current version
+  Movie deserialize_movie(const std::vector<std::uint8_t> &data);
+
+  // Plays the events of a movie back into an interpreter, each one at the
+  // cycle it was recorded on. The interpreter should be freshly loaded with
+  // the movie's quirks and seed.
+  class MoviePlayer {
+  public:
+    MoviePlayer(const Movie &movie, Interpreter &interpreter);
+
+    // run for `cycles`, applying any events that fall within them
+    void run(std::uint64_t cycles);
+
+    bool finished() const;
+    // the cycle of the last event
+    std::uint64_t length() const;
+
+  private:
+    void apply_events();
+
+    const Movie &movie;
+    Interpreter &interpreter;
+    std::size_t next_event;
+  };
+}
+
+#endif // __KATE_MOVIE__
@@ -0,0 +1,59 @@
+#include <algorithm> // std::equal
+
+#include <dlfcn.h>
+
+#include "native.hpp"
+
+/******************************************************************************
+/ Exceptions                                                                  /
+******************************************************************************/
+kate::invalid_native::invalid_native(const std::string &msg)
+: interpreter_error(msg) {}
+kate::invalid_native::invalid_native(const char *msg)
+: interpreter_error(msg) {}
+
+/******************************************************************************
+/ NativeCode                                                                  /
+******************************************************************************/
+kate::NativeCode::NativeCode(const std::filesystem::path &path)
+: handle(nullptr), module(nullptr) {
+  // a path without a slash would be searched for like a system library
+  std::filesystem::path absolute = std::filesystem::absolute(path);
+
+  handle = dlopen(absolute.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    throw invalid_native(dlerror());
+  }
+
+  module = static_cast<const NativeModule *>(
+    dlsym(handle, "kate_native_module")
+  );
+
+  std::string error;
+  if (!module) {
+    error = "not a native module";
+  } else if (
+    (module->abi_version != native_abi_version) ||
+    (module->state_size != sizeof(State))
+  ) {
+    error = "native module was built for a different version, recompile it";
+  }
+
+  if (!error.empty()) {
+    dlclose(handle);
+    throw invalid_native(error);
+  }
+}
+
+kate::NativeCode::~NativeCode() {
+  dlclose(handle);
+}
+
+const kate::NativeModule &kate::NativeCode::get_module() const {
+  return *module;
+}
+
+bool kate::NativeCode::matches(const std::vector<std::uint8_t> &rom) const {
+  return (rom.size() == module->rom_size) &&
+         std::equal(rom.begin(), rom.end(), module->rom);
+}
@@ -0,0 +1,81 @@
+#ifndef __KATE_NATIVE__
+#define __KATE_NATIVE__
+
+#include <filesystem>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "config.hpp"
+#include "interpreter.hpp"
+
+namespace kate {
+  class invalid_native : public interpreter_error {
+  public:
+    explicit invalid_native(const std::string& msg);
+    explicit invalid_native(const char* msg);
+  };
+
+  // A rom compiled ahead of time by `kate-recompile` into a shared library,
+  // one function per basic block found by following every jump, call and
+  // skip from entry_point.
+  //
+  // A block runs from its first instruction up to and including the jump,
+  // call, return or skip that ends it, and stops early before anything
+  // that needs the host (DXYN, FX0A, FX18, 00E0), writes memory (FX33,
+  // FX55), can't be followed (BNNN) or would throw. It never runs more than
+  // `budget` instructions and returns how many it did run, leaving the State
+  // exactly as stepping them one at a time would have, cycle counter
+  // included. 0 means it ran nothing and the interpreter has to.
+  //
+  // The interpreter only enters a block while the ram underneath it still
+  // holds what was compiled, so self-modified code and anything that wasn't
+  // reachable from the entry point are always interpreted.
+  struct NativeBlock {
+    std::uint16_t start;
+    // one past the last byte of the last instruction
+    std::uint16_t end;
+    std::uint64_t (*fn)(State *state, std::uint64_t budget);
+  };
+
+  // bumped whenever the above, State or the generated code changes
+  constexpr std::uint32_t native_abi_version = 1;
+
+  // what the library exports as `kate_native_module`
+  struct NativeModule {
+    std::uint32_t abi_version;
+    std::uint32_t state_size;
+    QUIRKS quirks;
+
+    // the rom as compiled, loaded at entry_point
+    const std::uint8_t *rom;
+    std::size_t rom_size;
+
+    const NativeBlock *blocks;
+    std::size_t block_count;
+  };
+
+  // A loaded library, unloaded again when this is destroyed. The module
+  // must outlive any interpreter it is attached to.
+  class NativeCode {
+  public:
+    // throws invalid_native if `path` can't be loaded or was built for a
+    // different version of kate
+    explicit NativeCode(const std::filesystem::path &path);
+    ~NativeCode();
+
+    NativeCode(const NativeCode &) = delete;
+    NativeCode &operator=(const NativeCode &) = delete;
+
+    const NativeModule &get_module() const;
+    // true if this was compiled from `rom`
+    bool matches(const std::vector<std::uint8_t> &rom) const;
+
+  private:
+    void *handle;
+    const NativeModule *module;
+  };
+}
+
+#endif // __KATE_NATIVE__
@@ -0,0 +1,170 @@
+#include <algorithm> // std::sort, std::min
+#include <iomanip>
+#include <numeric> // std::accumulate
+#include <sstream>
+#include <utility> // std::pair
+#include <vector>
+
+#include "../util/io.hpp"
+#include "profile.hpp"
+
+// how many of the busiest addresses the text report lists
+constexpr std::size_t hottest_addresses = 20;
+
+// the opcode each handler executes, in HANDLER order
+static const char *handler_opcodes[] = {
+  "????", "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "9XY0",
+  "6XNN", "7XNN", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY7",
+  "8XY6", "8XYE", "8XY?", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+  "FX07", "FX0A", "FX15", "FX18", "FX29", "FX1E", "FX33", "FX55", "FX65",
+  "6XNN 6YNN DXYN", "FX07 3X00 1NNN", "FX1E FX65"
+};
+static_assert(
+  sizeof(handler_opcodes) / sizeof(handler_opcodes[0]) ==
+  static_cast<std::size_t>(kate::HANDLER::COUNT)
+);
+
+static double percent(std::uint64_t part, std::uint64_t total) {
+  return total ? (100.0 * part / total) : 0.0;
+}
+
+std::string kate::profile_report(const Profile &profile) {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(2);
+
+  std::uint64_t total = std::accumulate(
+    profile.handlers.begin(), profile.handlers.end(), std::uint64_t(0)
+  );
+  ss << "instructions executed: " << total << "\n\n";
+
+  std::vector<std::pair<std::uint64_t, std::size_t>> handlers;
+  for (std::size_t i = 0; i < profile.handlers.size(); ++i) {
+    if (profile.handlers[i]) {
+      handlers.push_back({profile.handlers[i], i});
+    }
+  }
+  std::sort(handlers.rbegin(), handlers.rend());
+
+  ss << "handler       opcode          count        %\n";
+  for (auto [count, i] : handlers) {
+    ss << std::left << std::setw(14) << decode_HANDLER(HANDLER(i));
+    ss << std::setw(6) << handler_opcodes[i] << std::right;
+    ss << std::setw(15) << count << std::setw(9) << percent(count, total);
+    ss << '\n';
+  }
+
+  std::vector<std::pair<std::uint64_t, std::size_t>> addresses;
+  for (std::size_t i = 0; i < profile.addresses.size(); ++i) {
+    if (profile.addresses[i]) {
+      addresses.push_back({profile.addresses[i], i});
+    }
+  }
+  std::size_t shown = std::min(addresses.size(), hottest_addresses);
+  std::partial_sort(
+    addresses.begin(), addresses.begin() + shown, addresses.end(),
+    [](const auto &a, const auto &b) { return a.first > b.first; }
+  );
+
+  ss << "\nhottest addresses (" << addresses.size() << " executed)\n";
+  ss << "address           count        %\n";
+  for (std::size_t i = 0; i < shown; ++i) {
+    auto [count, address] = addresses[i];
+    ss << hex_string(address, 4) << "  " << std::setw(15) << count;
+    ss << std::setw(9) << percent(count, total) << '\n';
+  }
+
+  std::uint64_t draws = std::accumulate(
+    profile.sprite_heights.begin(), profile.sprite_heights.end(),
+    std::uint64_t(0)
+  );
+  ss << "\nsprites drawn: " << draws << '\n';
+  ss << "rows drawn   : " << profile.draw_rows;
+  if (draws) {
+    ss << " (" << static_cast<double>(profile.draw_rows) / draws;
+    ss << " per sprite)";
+  }
+  ss << '\n';
+  ss << "collisions   : " << profile.collisions << " (";
+  ss << percent(profile.collisions, draws) << "% of sprites)\n";
+  ss << "vblank waits : " << profile.vblank_waits << '\n';
+
+  ss << "\nsprite height            count        %\n";
+  for (std::size_t n = 0; n < profile.sprite_heights.size(); ++n) {
+    if (profile.sprite_heights[n]) {
+      ss << std::setw(13) << n;
+      ss << std::setw(17) << profile.sprite_heights[n];
+      ss << std::setw(9) << percent(profile.sprite_heights[n], draws) << '\n';
+    }
+  }
+
+  ss << "\nfused instructions: " << profile.fused_instructions << " (";
+  ss << percent(profile.fused_instructions, total) << "% of instructions)\n";
+  ss << "superinstruction  opcodes                  count\n";
+  for (std::size_t i = 0; i < profile.fused.size(); ++i) {
+    if (profile.fused[i]) {
+      ss << std::left << std::setw(18) << decode_HANDLER(HANDLER(i));
+      ss << std::setw(16) << handler_opcodes[i] << std::right;
+      ss << std::setw(14) << profile.fused[i] << '\n';
+    }
+  }
+  ss << "\nfast-forwarded idle instructions: " << profile.idle_instructions;
+  ss << " (" << percent(profile.idle_instructions, total);
+  ss << "% of instructions)\n";
+
+  return ss.str();
+}
+
+std::string kate::profile_csv(const Profile &profile) {
+  std::stringstream ss;
+  ss << "kind,key,count\n";
+
+  for (std::size_t i = 0; i < profile.handlers.size(); ++i) {
+    if (profile.handlers[i]) {
+      ss << "handler," << decode_HANDLER(HANDLER(i)) << ',';
+      ss << profile.handlers[i] << '\n';
+    }
+  }
+
+  for (std::size_t i = 0; i < profile.addresses.size(); ++i) {
+    if (profile.addresses[i]) {
+      ss << "address," << hex_string(i, 4) << ',';
+      ss << profile.addresses[i] << '\n';
+    }
+  }
+
+  for (std::size_t n = 0; n < profile.sprite_heights.size(); ++n) {
+    if (profile.sprite_heights[n]) {
+      ss << "sprite_height," << n << ',' << profile.sprite_heights[n] << '\n';
+    }
+  }
+
+  ss << "draw,rows," << profile.draw_rows << '\n';
+  ss << "draw,collisions," << profile.collisions << '\n';
+  ss << "draw,vblank_waits," << profile.vblank_waits << '\n';
+
+  for (std::size_t i = 0; i < profile.fused.size(); ++i) {
+    if (profile.fused[i]) {
+      ss << "fused," << decode_HANDLER(HANDLER(i)) << ',';
+      ss << profile.fused[i] << '\n';
+    }
+  }
+  ss << "fused,instructions," << profile.fused_instructions << '\n';
+  ss << "fused,idle_instructions," << profile.idle_instructions << '\n';
+
+  return ss.str();
+}
+
+int kate::save_profile(
+  const Profile &profile, const std::filesystem::path &directory
+) {
+  int err = utils::write_file(
+    directory / "profile.txt", profile_report(profile), true
+  );
+  if (err == 0) {
+    err = utils::write_file(
+      directory / "profile.csv", profile_csv(profile), true
+    );
+  }
+
+  return err;
+}
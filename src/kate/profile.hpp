@@ -0,0 +1,25 @@
+#ifndef __KATE_PROFILE__
+#define __KATE_PROFILE__
+
+#include <filesystem>
+#include <string>
+
+#include "interpreter.hpp"
+
+namespace kate {
+  // a human readable summary: instructions by handler, the hottest
+  // addresses, how sprites were drawn and how often superinstructions ran
+  std::string profile_report(const Profile &profile);
+
+  // every non-zero counter as `kind,key,count`, where kind is one of
+  // handler, address, sprite_height, draw or fused
+  std::string profile_csv(const Profile &profile);
+
+  // writes profile.txt and profile.csv to `directory`, returns non-zero on
+  // failure
+  int save_profile(
+    const Profile &profile, const std::filesystem::path &directory
+  );
+}
+
+#endif // __KATE_PROFILE__
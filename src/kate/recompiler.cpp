@@ -0,0 +1,515 @@
+#include <set>
+#include <sstream>
+
+#include "native.hpp"
+#include "recompiler.hpp"
+
+// longer runs of straight-line code are split, to keep functions a sane size
+constexpr std::size_t max_block_length = 128;
+
+namespace {
+  enum class KIND {
+    STRAIGHT,   // compiled, execution carries on to the next instruction
+    TERMINATOR, // compiled, and the last instruction of its block
+    INTERPRETED // left to the interpreter, the block ends before it
+  };
+
+  KIND kind_of(const kate::Instruction &inst, std::size_t address) {
+    using kate::HANDLER;
+
+    switch (inst.handler) {
+      case HANDLER::MOV         :
+      case HANDLER::ADD         :
+      case HANDLER::ALU_MOV     :
+      case HANDLER::ALU_OR      :
+      case HANDLER::ALU_AND     :
+      case HANDLER::ALU_XOR     :
+      case HANDLER::ALU_ADD     :
+      case HANDLER::ALU_SUB     :
+      case HANDLER::ALU_RSUB    :
+      case HANDLER::ALU_SHR     :
+      case HANDLER::ALU_SHL     :
+      case HANDLER::ALU_UNKNOWN :
+      case HANDLER::LDI         :
+      case HANDLER::RANDOM      :
+      case HANDLER::GET_DT      :
+      case HANDLER::SET_DT      :
+      case HANDLER::ADD_IR      :
+      case HANDLER::GET_CHAR    :
+      case HANDLER::LOAD_REG    : return KIND::STRAIGHT;
+
+      // a jump to itself halts, which only the interpreter reports
+      case HANDLER::JMP         :
+        return (inst.n == address) ? KIND::INTERPRETED : KIND::TERMINATOR;
+      case HANDLER::CALL        :
+      case HANDLER::RET         :
+      case HANDLER::SKIP_EQ_IMM :
+      case HANDLER::SKIP_NE_IMM :
+      case HANDLER::SKIP_EQ_REG :
+      case HANDLER::SKIP_NE_REG :
+      case HANDLER::KEY_EQ      :
+      case HANDLER::KEY_NE      : return KIND::TERMINATOR;
+
+      default                   : return KIND::INTERPRETED;
+    }
+  }
+
+  struct QuirkFlags {
+    bool enable_flags_reset;
+    bool increment_index_register;
+    bool shifting_ignores_y;
+    const char *name;
+  };
+
+  template <typename Q>
+  QuirkFlags flags_of(const char *name) {
+    return {
+      Q::enable_flags_reset, Q::increment_index_register,
+      Q::shifting_ignores_y, name
+    };
+  }
+
+  QuirkFlags quirk_flags(kate::QUIRKS quirks) {
+    switch (quirks) {
+      case kate::QUIRKS::SUPER_CHIP:
+        return flags_of<kate::SUPER_CHIP>("SUPER_CHIP");
+      case kate::QUIRKS::XO_CHIP:
+        return flags_of<kate::XO_CHIP>("XO_CHIP");
+      default:
+        return flags_of<kate::COSMAC_VIP>("COSMAC_VIP");
+    }
+  }
+
+  // the rom as it will sit in ram
+  class Rom {
+  public:
+    explicit Rom(const std::vector<std::uint8_t> &rom) : rom(rom) {}
+
+    // true if a whole instruction starts at `address`
+    bool contains(std::size_t address) const {
+      return (address >= kate::entry_point) &&
+             (address + 2 <= kate::entry_point + rom.size()) &&
+             (address + 2 <= 0x4000);
+    }
+
+    kate::Instruction fetch(std::size_t address) const {
+      std::size_t i = address - kate::entry_point;
+      return kate::decode_instruction((rom[i] << 8) | rom[i + 1]);
+    }
+
+  private:
+    const std::vector<std::uint8_t> &rom;
+  };
+
+  std::string hex(std::size_t i, std::size_t w) {
+    return kate::hex_string(i, w);
+  }
+
+  std::string v(std::size_t i) {
+    return "v[" + hex(i, 1) + "]";
+  }
+
+  // the name of the constant holding the decoded instruction at `address`
+  std::string inst_name(std::size_t address) {
+    return "i" + kate::hex_string(address, 4, false);
+  }
+
+  class BlockWriter {
+  public:
+    BlockWriter(
+      std::ostream &out, const QuirkFlags &quirks,
+      std::set<std::size_t> &instructions
+    ) : out(out), quirks(quirks), instructions(instructions) {}
+
+    // writes the function for the block starting at `start`, returns the end
+    // of the last instruction in it
+    std::size_t write(const Rom &rom, std::size_t start) {
+      out << "static std::uint64_t block_";
+      out << kate::hex_string(start, 4, false);
+      out << "(State *s, std::uint64_t budget) {\n";
+      out << "  std::uint8_t v[16];\n";
+      out << "  std::memcpy(v, s->registers.data(), 16);\n";
+
+      std::size_t count = 0;
+      std::size_t address = start;
+      while ((count < max_block_length) && rom.contains(address)) {
+        kate::Instruction inst = rom.fetch(address);
+        KIND kind = kind_of(inst, address);
+        if (kind == KIND::INTERPRETED) {
+          break;
+        }
+
+        out << "\n  // " << hex(address, 4) << ": ";
+        out << kate::hex_string(inst.raw, 4, false) << ' ';
+        out << kate::decode_HANDLER(inst.handler) << '\n';
+        if (count > 0) {
+          out << "  if (budget == " << count << ") {\n";
+          out << "    " << exit_after(count, address - 2) << '\n';
+          out << "  }\n";
+        }
+
+        write_instruction(inst, address, count);
+        ++count;
+        address += 2;
+
+        if (kind == KIND::TERMINATOR) {
+          out << "}\n\n";
+          return address;
+        }
+      }
+
+      out << "\n  " << exit_after(count, address - 2) << "\n}\n\n";
+      return address;
+    }
+
+  private:
+    // return once `count` instructions have run, the last one at `last`,
+    // which didn't change the flow of control
+    std::string exit_after(std::size_t count, std::size_t last) {
+      if (count == 0) {
+        return "return 0;";
+      }
+      return exit(count, hex(last, 4), hex(last + 2, 4), last);
+    }
+
+    std::string exit(
+      std::size_t count, const std::string &prev, const std::string &pc,
+      std::size_t address
+    ) {
+      instructions.insert(address);
+      std::stringstream ss;
+      ss << "return done(s, v, " << count << ", " << prev << ", " << pc;
+      ss << ", " << inst_name(address) << ");";
+      return ss.str();
+    }
+
+    void line(const std::string &code) {
+      out << "  " << code << '\n';
+    }
+
+    void write_instruction(
+      const kate::Instruction &inst, std::size_t address, std::size_t count
+    ) {
+      using kate::HANDLER;
+
+      std::string x = v(inst.x);
+      std::string y = v(inst.y);
+      std::string nn = hex(inst.n, 2);
+      std::string nnn = hex(inst.n, 3);
+      std::string here = hex(address, 4);
+      std::string next = hex(address + 2, 4);
+      std::string skip = hex(address + 4, 4);
+      // the flags reset quirk, for 8XY1, 8XY2 and 8XY3
+      std::string flags_reset =
+        quirks.enable_flags_reset ? " v[0xf] = 0;" : "";
+      // the shift quirk, for 8XY6 and 8XYE
+      std::string shift_from =
+        quirks.shifting_ignores_y ? "" : x + " = " + y + ";\n  ";
+
+      switch (inst.handler) {
+        case HANDLER::MOV:
+          line(x + " = " + nn + ";");
+          break;
+        case HANDLER::ADD:
+          line(x + " += " + nn + ";");
+          break;
+        case HANDLER::ALU_MOV:
+          line(x + " = " + y + ";");
+          break;
+        case HANDLER::ALU_OR:
+          line(x + " |= " + y + ";" + flags_reset);
+          break;
+        case HANDLER::ALU_AND:
+          line(x + " &= " + y + ";" + flags_reset);
+          break;
+        case HANDLER::ALU_XOR:
+          line(x + " ^= " + y + ";" + flags_reset);
+          break;
+        case HANDLER::ALU_ADD:
+          line("{");
+          line("  std::uint16_t t = " + x + ";");
+          line("  " + x + " += " + y + ";");
+          line("  v[0xf] = " + x + " < t;");
+          line("}");
+          break;
+        case HANDLER::ALU_SUB:
+          line("{");
+          line("  std::uint16_t t = " + x + ";");
+          line("  " + x + " -= " + y + ";");
+          line("  v[0xf] = (" + x + " <= t) && (" + y + " <= t);");
+          line("}");
+          break;
+        case HANDLER::ALU_RSUB:
+          line("{");
+          line("  std::uint16_t t = " + x + ";");
+          line("  " + x + " = " + y + " - " + x + ";");
+          line("  v[0xf] = t <= " + y + ";");
+          line("}");
+          break;
+        case HANDLER::ALU_SHR:
+          line(shift_from + "{");
+          line("  std::uint16_t t = " + x + " & 1;");
+          line("  " + x + " >>= 1;");
+          line("  v[0xf] = t;");
+          line("}");
+          break;
+        case HANDLER::ALU_SHL:
+          line(shift_from + "{");
+          line("  std::uint16_t t = (" + x + " >> 7) & 1;");
+          line("  " + x + " <<= 1;");
+          line("  v[0xf] = t;");
+          line("}");
+          break;
+        case HANDLER::ALU_UNKNOWN:
+          break;
+        case HANDLER::LDI:
+          line("s->index_register = " + nnn + ";");
+          break;
+        case HANDLER::RANDOM:
+          line(x + " = random_uint8(s) & " + nn + ";");
+          break;
+        case HANDLER::GET_DT:
+          line(x + " = s->delay_timer;");
+          break;
+        case HANDLER::SET_DT:
+          line("s->delay_timer = " + x + ";");
+          break;
+        case HANDLER::ADD_IR:
+          line("s->index_register += " + x + ";");
+          break;
+        case HANDLER::GET_CHAR:
+          line("s->index_register = kate::char_pointer + (" + x + " * 5);");
+          break;
+        case HANDLER::LOAD_REG: {
+          // out of range throws, which the interpreter has to do
+          std::string length = std::to_string(inst.x + 1);
+          line("if (s->index_register + " + length + " > s->ram.size()) {");
+          line("  " + exit_after(count, address - 2));
+          line("}");
+          line("for (std::size_t i = 0; i < " + length + "; ++i) {");
+          line("  v[i] = s->ram[s->index_register + i];");
+          line("}");
+          if (quirks.increment_index_register) {
+            line("s->index_register += " + length + ";");
+          }
+          break;
+        }
+
+        case HANDLER::JMP:
+          line(exit(count + 1, here, nnn, address));
+          break;
+        case HANDLER::CALL:
+          line("if (s->stack_pointer >= 16) {");
+          line("  " + exit_after(count, address - 2));
+          line("}");
+          line("s->stack[s->stack_pointer] = " + next + ";");
+          line("++s->stack_pointer;");
+          line(exit(count + 1, here, nnn, address));
+          break;
+        case HANDLER::RET:
+          line("if (s->stack_pointer == 0) {");
+          line("  " + exit_after(count, address - 2));
+          line("}");
+          line("--s->stack_pointer;");
+          line(exit(count + 1, here, "s->stack[s->stack_pointer]", address));
+          break;
+        case HANDLER::SKIP_EQ_IMM:
+          line(skip_if(x + " == " + nn, count, address));
+          break;
+        case HANDLER::SKIP_NE_IMM:
+          line(skip_if(x + " != " + nn, count, address));
+          break;
+        case HANDLER::SKIP_EQ_REG:
+          line(skip_if(x + " == " + y, count, address));
+          break;
+        case HANDLER::SKIP_NE_REG:
+          line(skip_if(x + " != " + y, count, address));
+          break;
+        case HANDLER::KEY_EQ:
+        case HANDLER::KEY_NE: {
+          // as in the interpreter, a taken key skip also moves the
+          // previous PC on
+          std::string pressed = (inst.handler == HANDLER::KEY_EQ) ?
+                                "true" : "false";
+          line("if (s->key_states[" + x + "] == " + pressed + ") {");
+          line("  " + exit(count + 1, next, skip, address));
+          line("}");
+          line(exit(count + 1, here, next, address));
+          break;
+        }
+
+        default:
+          break;
+      }
+    }
+
+    std::string skip_if(
+      const std::string &condition, std::size_t count, std::size_t address
+    ) {
+      std::string pc = "(" + condition + ") ? " + hex(address + 4, 4) +
+                       " : " + hex(address + 2, 4);
+      return exit(count + 1, hex(address, 4), pc, address);
+    }
+
+    std::ostream &out;
+    const QuirkFlags &quirks;
+    std::set<std::size_t> &instructions;
+  };
+}
+
+kate::CodeMap kate::analyse_rom(const std::vector<std::uint8_t> &rom) {
+  CodeMap map;
+  map.reachable.assign(0x4000, false);
+  map.leaders.assign(0x4000, false);
+
+  Rom code(rom);
+  std::vector<std::size_t> work;
+  auto visit = [&](std::size_t address, bool leader) {
+    if (!code.contains(address)) {
+      return;
+    }
+    if (leader) {
+      map.leaders[address] = true;
+    }
+    if (!map.reachable[address]) {
+      map.reachable[address] = true;
+      work.push_back(address);
+    }
+  };
+
+  visit(entry_point, true);
+  while (!work.empty()) {
+    std::size_t address = work.back();
+    work.pop_back();
+
+    Instruction inst = code.fetch(address);
+    switch (inst.handler) {
+      case HANDLER::JMP:
+        visit(inst.n, true);
+        break;
+      case HANDLER::CALL:
+        visit(inst.n, true);
+        visit(address + 2, true);
+        break;
+      case HANDLER::SKIP_EQ_IMM:
+      case HANDLER::SKIP_NE_IMM:
+      case HANDLER::SKIP_EQ_REG:
+      case HANDLER::SKIP_NE_REG:
+      case HANDLER::KEY_EQ:
+      case HANDLER::KEY_NE:
+        visit(address + 2, true);
+        visit(address + 4, true);
+        break;
+      // nowhere that can be known ahead of time
+      case HANDLER::RET:
+      case HANDLER::JMP_OFF:
+      case HANDLER::INVALID:
+        break;
+      default:
+        visit(
+          address + 2, kind_of(inst, address) == KIND::INTERPRETED
+        );
+    }
+  }
+
+  return map;
+}
+
+std::string kate::recompile_rom(
+  const std::vector<std::uint8_t> &rom, QUIRKS quirks,
+  const std::string &name
+) {
+  QuirkFlags flags = quirk_flags(quirks);
+  CodeMap map = analyse_rom(rom);
+  Rom code(rom);
+
+  // the blocks are written first, they decide which instructions need a
+  // constant
+  std::stringstream blocks;
+  std::stringstream table;
+  std::set<std::size_t> instructions;
+  BlockWriter writer(blocks, flags, instructions);
+  for (std::size_t address = 0; address < map.leaders.size(); ++address) {
+    if (
+      !map.leaders[address] ||
+      (kind_of(code.fetch(address), address) == KIND::INTERPRETED)
+    ) {
+      continue;
+    }
+
+    std::size_t end = writer.write(code, address);
+    table << "  {" << hex(address, 4) << ", " << hex(end, 4) << ", block_";
+    table << hex_string(address, 4, false) << "},\n";
+  }
+
+  std::stringstream out;
+  out << "// Generated by kate-recompile from " << name << " for the ";
+  out << decode_QUIRKS(quirks) << " quirks.\n";
+  out << "// Do not edit, see src/kate/native.hpp.\n";
+  out << "#include <cstring>\n\n";
+  out << "#include \"kate/native.hpp\"\n\n";
+  out << "using kate::Instruction;\n";
+  out << "using kate::State;\n\n";
+
+  // the decoded instruction left in cur_inst, as the interpreter would
+  for (std::size_t address : instructions) {
+    Instruction inst = code.fetch(address);
+    out << "constexpr Instruction " << inst_name(address) << " = {";
+    out << hex(inst.raw, 4) << ", static_cast<kate::INSTRUCTION>(";
+    out << hex(inst.inst, 2) << "), " << hex(inst.x, 1) << ", ";
+    out << hex(inst.y, 1) << ", " << hex(inst.n, 3) << ",\n  ";
+    out << "static_cast<kate::HANDLER>(";
+    out << static_cast<unsigned>(inst.handler) << ")};\n";
+  }
+
+  out << R"(
+static inline std::uint64_t done(
+  State *s, const std::uint8_t *v, std::uint64_t count, std::uint16_t prev,
+  std::uint16_t pc, const Instruction &inst
+) {
+  std::memcpy(s->registers.data(), v, 16);
+  s->cycle_counter += count;
+  s->prev_program_counter = prev;
+  s->program_counter = pc;
+  s->cur_inst = inst;
+  return count;
+}
+
+// kate::Interpreter::random_uint8()
+static inline std::uint8_t random_uint8(State *s) {
+  std::uint64_t x = s->rng_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  s->rng_state = x;
+
+  return (x * 0x2545f4914f6cdd1d) >> 56;
+}
+
+)";
+
+  out << blocks.str();
+
+  out << "static const std::uint8_t rom[] = {";
+  for (std::size_t i = 0; i < rom.size(); ++i) {
+    out << ((i % 12) ? " " : "\n  ") << hex(rom[i], 2) << ',';
+  }
+  out << "\n};\n\n";
+
+  // an empty array isn't allowed
+  std::string block_list = "nullptr, 0";
+  if (!table.str().empty()) {
+    out << "static const kate::NativeBlock blocks[] = {\n";
+    out << table.str();
+    out << "};\n\n";
+    block_list = "blocks, sizeof(blocks) / sizeof(blocks[0])";
+  }
+
+  out << "extern \"C\" const kate::NativeModule kate_native_module = {\n";
+  out << "  kate::native_abi_version, sizeof(State), kate::QUIRKS::";
+  out << flags.name << ",\n";
+  out << "  rom, sizeof(rom), " << block_list << "\n";
+  out << "};\n";
+
+  return out.str();
+}
@@ -0,0 +1,37 @@
+#ifndef __KATE_RECOMPILER__
+#define __KATE_RECOMPILER__
+
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include "config.hpp"
+#include "interpreter.hpp"
+
+namespace kate {
+  // What static analysis of a rom found, indexed by address. Code is found
+  // by following every jump, call and skip from entry_point. BNNN jumps to
+  // somewhere that can't be known ahead of time, so code only reachable
+  // through one is missed.
+  struct CodeMap {
+    // an instruction starts here
+    std::vector<bool> reachable;
+    // a basic block starts here: the entry point, a jump, call or skip
+    // target, a return address, or the instruction after one only the
+    // interpreter can run
+    std::vector<bool> leaders;
+  };
+
+  CodeMap analyse_rom(const std::vector<std::uint8_t> &rom);
+
+  // C++ for a shared library exporting a NativeModule for `rom`, see
+  // native.hpp. It only needs the kate headers (with src/ on the include
+  // path) to compile.
+  std::string recompile_rom(
+    const std::vector<std::uint8_t> &rom, QUIRKS quirks,
+    const std::string &name
+  );
+}
+
+#endif // __KATE_RECOMPILER__
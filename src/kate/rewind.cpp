@@ -0,0 +1,240 @@
+#include <algorithm> // std::max, std::min
+
+#include <cstring> // std::memcpy
+
+#include "rewind.hpp"
+
+// deltas are computed a word at a time
+static_assert(sizeof(kate::State) % 8 == 0, "State must be whole words");
+constexpr std::size_t state_words = sizeof(kate::State) / 8;
+static_assert(state_words <= 0xffff, "word counts are stored as u16");
+
+static std::uint64_t load_word(const kate::State &state, std::size_t i) {
+  const std::uint8_t *p = reinterpret_cast<const std::uint8_t *>(&state);
+  std::uint64_t word;
+  std::memcpy(&word, p + i * 8, 8);
+  return word;
+}
+
+static void xor_word(kate::State &state, std::size_t i, std::uint64_t value) {
+  std::uint8_t *p = reinterpret_cast<std::uint8_t *>(&state) + i * 8;
+  std::uint64_t word;
+  std::memcpy(&word, p, 8);
+  word ^= value;
+  std::memcpy(p, &word, 8);
+}
+
+static void put_u16(std::vector<std::uint8_t> &data, std::uint16_t value) {
+  data.push_back(value & 0xff);
+  data.push_back(value >> 8);
+}
+
+static std::uint16_t get_u16(const std::uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+kate::Rewind::Rewind(std::size_t capacity, std::size_t keyframe_interval)
+: keyframe_interval(std::max<std::size_t>(keyframe_interval, 1)) {
+  // there must always be room for a keyframe, however large the deltas are
+  ring.resize(std::max(capacity, 4 * sizeof(State)));
+  scratch.reserve(2 * sizeof(State));
+  clear();
+}
+
+void kate::Rewind::push(const State &state) {
+  bool is_keyframe = !has_keyframe ||
+                     (frames_since_keyframe + 1 >= keyframe_interval);
+
+  if (!is_keyframe) {
+    encode_delta(state);
+
+    // if a delta is no smaller than a full snapshot, just store the snapshot
+    if (scratch.size() >= sizeof(State)) {
+      is_keyframe = true;
+    } else {
+      make_room(scratch.size());
+
+      // the keyframe this delta depends on had to be dropped
+      if (entries.empty()) {
+        is_keyframe = true;
+      }
+    }
+  }
+
+  if (is_keyframe) {
+    encode_keyframe(state);
+    make_room(scratch.size());
+  }
+
+  entries.push_back({head, scratch.size(), is_keyframe});
+  write(scratch);
+
+  if (is_keyframe) {
+    std::memcpy(&keyframe, &state, sizeof(State));
+    has_keyframe = true;
+    frames_since_keyframe = 0;
+  } else {
+    ++frames_since_keyframe;
+  }
+}
+
+bool kate::Rewind::pop(State &state) {
+  if (entries.empty()) {
+    return false;
+  }
+
+  Entry entry = entries.back();
+  decode(entry, state);
+
+  entries.pop_back();
+  used -= entry.size;
+  head = entry.offset;
+
+  if (!entry.is_keyframe) {
+    --frames_since_keyframe;
+    return true;
+  }
+
+  // go back to the previous keyframe, if there is one
+  has_keyframe = false;
+  frames_since_keyframe = 0;
+  for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+    if (it->is_keyframe) {
+      read(*it, scratch);
+      std::memcpy(&keyframe, scratch.data(), sizeof(State));
+      has_keyframe = true;
+      break;
+    }
+    ++frames_since_keyframe;
+  }
+
+  return true;
+}
+
+void kate::Rewind::clear() {
+  head = 0;
+  used = 0;
+  entries.clear();
+  has_keyframe = false;
+  frames_since_keyframe = 0;
+}
+
+std::size_t kate::Rewind::frames() const {
+  return entries.size();
+}
+
+std::size_t kate::Rewind::memory_used() const {
+  return used;
+}
+
+std::size_t kate::Rewind::capacity() const {
+  return ring.size();
+}
+
+void kate::Rewind::encode_keyframe(const State &state) {
+  const std::uint8_t *p = reinterpret_cast<const std::uint8_t *>(&state);
+  scratch.assign(p, p + sizeof(State));
+}
+
+void kate::Rewind::encode_delta(const State &state) {
+  // a list of runs of changed words: the number of unchanged words skipped
+  // since the previous run (u16), the number of changed words (u16), then
+  // each changed word XORed with the keyframe
+  scratch.clear();
+
+  std::size_t i = 0;
+  std::size_t prev_end = 0;
+  while (i < state_words) {
+    if (load_word(state, i) == load_word(keyframe, i)) {
+      ++i;
+      continue;
+    }
+
+    std::size_t begin = i;
+    while (
+      (i < state_words) && (load_word(state, i) != load_word(keyframe, i))
+    ) {
+      ++i;
+    }
+
+    put_u16(scratch, begin - prev_end);
+    put_u16(scratch, i - begin);
+    for (std::size_t w = begin; w < i; ++w) {
+      std::uint64_t x = load_word(state, w) ^ load_word(keyframe, w);
+      for (std::size_t b = 0; b < 8; ++b) {
+        scratch.push_back((x >> (b * 8)) & 0xff);
+      }
+    }
+    prev_end = i;
+  }
+}
+
+void kate::Rewind::decode(const Entry &entry, State &state) {
+  read(entry, scratch);
+
+  if (entry.is_keyframe) {
+    std::memcpy(&state, scratch.data(), sizeof(State));
+    return;
+  }
+
+  // deltas are only ever decoded for the newest group, so `keyframe` is the
+  // one this delta was taken against
+  std::memcpy(&state, &keyframe, sizeof(State));
+
+  const std::uint8_t *p = scratch.data();
+  const std::uint8_t *end = p + scratch.size();
+  std::size_t w = 0;
+  while (p < end) {
+    w += get_u16(p);
+    std::size_t count = get_u16(p + 2);
+    p += 4;
+
+    for (std::size_t i = 0; i < count; ++i, ++w, p += 8) {
+      std::uint64_t x = 0;
+      for (std::size_t b = 0; b < 8; ++b) {
+        x |= static_cast<std::uint64_t>(p[b]) << (b * 8);
+      }
+      xor_word(state, w, x);
+    }
+  }
+}
+
+void kate::Rewind::make_room(std::size_t size) {
+  while (!entries.empty() && (ring.size() - used < size)) {
+    drop_oldest_keyframe();
+  }
+
+  if (entries.empty()) {
+    head = 0;
+    used = 0;
+    has_keyframe = false;
+    frames_since_keyframe = 0;
+  }
+}
+
+void kate::Rewind::drop_oldest_keyframe() {
+  // the keyframe goes along with every delta that depends on it
+  do {
+    used -= entries.front().size;
+    entries.pop_front();
+  } while (!entries.empty() && !entries.front().is_keyframe);
+}
+
+void kate::Rewind::write(const std::vector<std::uint8_t> &data) {
+  std::size_t first = std::min(data.size(), ring.size() - head);
+  std::memcpy(&ring[head], data.data(), first);
+  std::memcpy(&ring[0], data.data() + first, data.size() - first);
+
+  head = (head + data.size()) % ring.size();
+  used += data.size();
+}
+
+void kate::Rewind::read(
+  const Entry &entry, std::vector<std::uint8_t> &data
+) const {
+  data.resize(entry.size);
+
+  std::size_t first = std::min(entry.size, ring.size() - entry.offset);
+  std::memcpy(data.data(), &ring[entry.offset], first);
+  std::memcpy(data.data() + first, &ring[0], entry.size - first);
+}
@@ -0,0 +1,70 @@
+#ifndef __KATE_REWIND__
+#define __KATE_REWIND__
+
+#include <deque>
+#include <vector>
+
+#include <cstdint>
+
+#include "config.hpp"
+#include "interpreter.hpp"
+
+namespace kate {
+  // A history of machine states, one per frame, kept in a fixed-size ring.
+  //
+  // Every `keyframe_interval` frames a full State is stored, each frame in
+  // between is stored as the XOR of its State with that keyframe, with the
+  // runs of unchanged (zero) words left out. Most frames only change a few
+  // registers and display rows so these deltas are small. When the ring is
+  // full the oldest keyframe is dropped along with all of its deltas.
+  class Rewind {
+  public:
+    Rewind(
+      std::size_t capacity=rewind_capacity,
+      std::size_t keyframe_interval=rewind_keyframe_interval
+    );
+
+    // record the state for the current frame
+    void push(const State &state);
+    // remove the most recent frame and return its state, returns false if
+    // there is no history left
+    bool pop(State &state);
+    void clear();
+
+    std::size_t frames() const;
+    std::size_t memory_used() const;
+    std::size_t capacity() const;
+
+  private:
+    struct Entry {
+      std::size_t offset;
+      std::size_t size;
+      bool is_keyframe;
+    };
+
+    void encode_keyframe(const State &state);
+    void encode_delta(const State &state);
+    void decode(const Entry &entry, State &state);
+
+    void make_room(std::size_t size);
+    void drop_oldest_keyframe();
+    void write(const std::vector<std::uint8_t> &data);
+    void read(const Entry &entry, std::vector<std::uint8_t> &data) const;
+
+    std::size_t keyframe_interval;
+
+    std::vector<std::uint8_t> ring;
+    std::size_t head;
+    std::size_t used;
+    std::deque<Entry> entries;
+
+    // the most recent keyframe, which new deltas are taken against
+    State keyframe;
+    bool has_keyframe;
+    std::size_t frames_since_keyframe;
+
+    std::vector<std::uint8_t> scratch;
+  };
+}
+
+#endif // __KATE_REWIND__
@@ -0,0 +1,171 @@
+#include <algorithm> // std::equal
+#include <string>
+
+#include "savestate.hpp"
+
+constexpr char magic[] = "KATESAVE";
+constexpr std::size_t magic_size = sizeof(magic) - 1;
+
+/******************************************************************************
+/ Exceptions                                                                  /
+******************************************************************************/
+kate::invalid_state::invalid_state(const std::string &msg)
+: interpreter_error(msg) {}
+kate::invalid_state::invalid_state(const char *msg)
+: interpreter_error(msg) {}
+
+/******************************************************************************
+/ Serialization                                                               /
+******************************************************************************/
+namespace {
+  class Writer {
+  public:
+    explicit Writer(std::vector<std::uint8_t> &data) : data(data) {}
+
+    void put(std::uint64_t value, std::size_t bytes) {
+      for (std::size_t i = 0; i < bytes; ++i) {
+        data.push_back((value >> (i * 8)) & 0xff);
+      }
+    }
+
+    template <typename T, std::size_t N>
+    void put(const std::array<T, N> &values) {
+      for (T value : values) {
+        put(value, sizeof(T));
+      }
+    }
+  private:
+    std::vector<std::uint8_t> &data;
+  };
+
+  class Reader {
+  public:
+    Reader(const std::vector<std::uint8_t> &data, std::size_t pos)
+    : data(data), pos(pos) {}
+
+    std::uint64_t get(std::size_t bytes) {
+      if (pos + bytes > data.size()) {
+        throw kate::invalid_state("save state is truncated");
+      }
+
+      std::uint64_t value = 0;
+      for (std::size_t i = 0; i < bytes; ++i) {
+        value |= static_cast<std::uint64_t>(data[pos++]) << (i * 8);
+      }
+      return value;
+    }
+
+    template <typename T, std::size_t N>
+    void get(std::array<T, N> &values) {
+      for (T &value : values) {
+        value = get(sizeof(T));
+      }
+    }
+
+    bool at_end() const {
+      return pos == data.size();
+    }
+  private:
+    const std::vector<std::uint8_t> &data;
+    std::size_t pos;
+  };
+}
+
+std::vector<std::uint8_t> kate::serialize_state(
+  const State &state, QUIRKS quirks
+) {
+  std::vector<std::uint8_t> data(magic, magic + magic_size);
+  Writer w(data);
+
+  w.put(state_version, 2);
+  w.put(static_cast<std::uint8_t>(quirks), 1);
+
+  w.put(state.ram);
+  w.put(state.registers);
+  w.put(state.key_states);
+  w.put(state.stack);
+  w.put(state.program_counter, 2);
+  w.put(state.stack_pointer, 2);
+  w.put(state.index_register, 2);
+  w.put(state.delay_timer, 1);
+  w.put(state.sound_timer, 1);
+
+  w.put(state.output_buffer);
+  w.put(state.is_blocking, 1);
+  w.put(state.is_vblank, 1);
+  // the rest of the instruction is decoded again on load
+  w.put(state.cur_inst.raw, 2);
+  w.put(state.cycle_counter, 8);
+  w.put(state.prev_program_counter, 2);
+  w.put(state.last_key_event.key, 1);
+  w.put(static_cast<std::uint8_t>(state.last_key_event.event), 1);
+
+  w.put(state.rng_state, 8);
+
+  return data;
+}
+
+kate::State kate::deserialize_state(
+  const std::vector<std::uint8_t> &data, QUIRKS &quirks
+) {
+  if (
+    (data.size() < magic_size) ||
+    !std::equal(magic, magic + magic_size, data.begin())
+  ) {
+    throw invalid_state("not a save state");
+  }
+
+  Reader r(data, magic_size);
+
+  std::uint16_t version = r.get(2);
+  if (version != state_version) {
+    throw invalid_state(
+      "unsupported save state version " + std::to_string(version)
+    );
+  }
+
+  std::uint8_t q = r.get(1);
+  if (q > static_cast<std::uint8_t>(QUIRKS::XO_CHIP)) {
+    throw invalid_state("unknown quirks profile in save state");
+  }
+  quirks = static_cast<QUIRKS>(q);
+
+  State state;
+  r.get(state.ram);
+  r.get(state.registers);
+  r.get(state.key_states);
+  r.get(state.stack);
+  state.program_counter = r.get(2);
+  state.stack_pointer = r.get(2);
+  if (state.stack_pointer > state.stack.size()) {
+    throw invalid_state("stack pointer out of range in save state");
+  }
+  state.index_register = r.get(2);
+  state.delay_timer = r.get(1);
+  state.sound_timer = r.get(1);
+
+  r.get(state.output_buffer);
+  state.is_blocking = r.get(1);
+  state.is_vblank = r.get(1);
+  state.cur_inst = decode_instruction(r.get(2));
+  state.cycle_counter = r.get(8);
+  state.prev_program_counter = r.get(2);
+  state.last_key_event.key = r.get(1);
+
+  std::uint8_t event = r.get(1);
+  if (event > static_cast<std::uint8_t>(KEY_EVENT::RELEASE)) {
+    throw invalid_state("invalid key event in save state");
+  }
+  state.last_key_event.event = static_cast<KEY_EVENT>(event);
+
+  state.rng_state = r.get(8);
+  if (state.rng_state == 0) {
+    throw invalid_state("invalid rng state in save state");
+  }
+
+  if (!r.at_end()) {
+    throw invalid_state("trailing data in save state");
+  }
+
+  return state;
+}
@@ -0,0 +1,37 @@
+#ifndef __KATE_SAVESTATE__
+#define __KATE_SAVESTATE__
+
+#include <vector>
+
+#include <cstdint>
+
+#include "interpreter.hpp"
+
+namespace kate {
+  class invalid_state : public interpreter_error {
+  public:
+    explicit invalid_state(const std::string& msg);
+    explicit invalid_state(const char* msg);
+  };
+
+  // On disk a state is written field by field, little endian, after a short
+  // header:
+  //
+  //   "KATESAVE"  8 bytes
+  //   version     u16
+  //   quirks      u8
+  //
+  // so files don't depend on the host's struct layout. Any change to the
+  // layout below the header needs a new version.
+  constexpr std::uint16_t state_version = 1;
+
+  std::vector<std::uint8_t> serialize_state(
+    const State &state, QUIRKS quirks
+  );
+  // throws invalid_state if `data` isn't a state of the current version
+  State deserialize_state(
+    const std::vector<std::uint8_t> &data, QUIRKS &quirks
+  );
+}
+
+#endif // __KATE_SAVESTATE__
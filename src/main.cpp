@@ -1,21 +1,28 @@
+#include <algorithm> // std::min
+#include <array>
 #include <exception>
 #include <iostream>
-
-#include <AL/al.h>
-#include <AL/alc.h>
+#include <memory>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include "audio/beeper.hpp"
 #include "debug/gl_debug.hpp"
 #include "debug/glfw_debug.hpp"
+#include "kate/emulator.hpp"
 #include "kate/interpreter.hpp"
+#include "kate/keymap.hpp"
+#include "kate/movie.hpp"
+#include "kate/native.hpp"
+#include "kate/profile.hpp"
+#include "opengl/bit_texture.hpp"
 #include "opengl/exceptions.hpp"
 #include "opengl/input.hpp"
 #include "opengl/mesh.hpp"
+#include "opengl/render_target.hpp"
 #include "opengl/shader.hpp"
-#include "opengl/texture.hpp"
-#include "util/image.hpp"
+#include "util/hash.hpp"
 #include "util/io.hpp"
 #include "util/options.hpp"
 #include "util/timer.hpp"
@@ -30,15 +37,47 @@ GLFWwindow *init_opengl(
 
 void processInput(
   GLFWwindow *window, std::map<int, openglwrapper::KeyState> &key_states,
-  kate::Interpreter &interpreter
+  kate::Emulator &emulator
 );
 
-void render_console(const std::vector<std::uint8_t> &buffer);
+void render_console(const kate::Framebuffer &buffer);
+// without the fade every pixel drops straight to black
+constexpr std::uint8_t fade_rate =
+  kate::do_display_fade ? kate::display_fade_rate : 255;
+// frames it takes a lit pixel to fade out completely once it's turned off
+constexpr std::size_t fade_frames = (255 + fade_rate - 1) / fade_rate;
+
+// uploads are streamed through this many buffers, so writing one frame never
+// waits for the GPU to finish reading an earlier one
+constexpr std::size_t display_upload_slots = 3;
+
+// what the renderer has already drawn, so unchanged frames can be skipped
+struct DisplayState {
+  kate::Framebuffer drawn;
+  std::uint64_t generation;
+
+  // the faded image is built up on the GPU, alternating between the two
+  // targets: each frame reads the previous one and draws into the other
+  std::array<openglwrapper::RenderTarget, 2> persistence;
+  std::size_t current;
+  // frames left until every pixel has finished fading
+  std::size_t fading;
+  // the window was resized or uncovered, so the last frame has to be
+  // presented again even if nothing changed
+  bool redraw;
+};
+
+// set as the window's framebuffer size and refresh callbacks, the window's
+// user pointer is its DisplayState
+void framebuffer_size_callback(GLFWwindow *window, int width, int height);
+void window_refresh_callback(GLFWwindow *window);
+
 void render_opengl(
-  const std::vector<std::uint8_t> &buffer,
-  GLFWwindow *window, std::vector<std::uint8_t> &display_buffer,
+  const kate::Frame &frame,
+  GLFWwindow *window, DisplayState &display,
   openglwrapper::Mesh &simple_mesh, openglwrapper::Shader &main_shader,
-  openglwrapper::Texture &display_texture
+  openglwrapper::Shader &fade_shader,
+  openglwrapper::BitTexture &display_texture
 );
 
 int main(int argc, const char *argv[]) {
@@ -76,56 +115,34 @@ int main(int argc, const char *argv[]) {
   std::filesystem::path vshader_path("./data/shaders/vertex.glsl");
   std::filesystem::path fshader_path("./data/shaders/fragment.glsl");
 
+  std::filesystem::path fade_shader_path("./data/shaders/fade.glsl");
+
   openglwrapper::Shader main_shader;
+  openglwrapper::Shader fade_shader;
   try {
     main_shader = {vshader_path, fshader_path};
+    fade_shader = {vshader_path, fade_shader_path};
   } catch (openglwrapper::shader_error &e) {
     std::cerr << e.what() << std::endl;
     return 1;
   }
 
   // texture
-  std::vector<std::uint8_t> display_buffer;
-  display_buffer.resize(kate::SCR_W * kate::SCR_H);
-  std::fill(display_buffer.begin(), display_buffer.end(), '0');
-  openglwrapper::Texture display_texture(
-    display_buffer, kate::SCR_W, kate::SCR_H, 1
-  );
-
-  // basic audio system
-  ALCdevice *Device = alcOpenDevice(nullptr);
-  ALCcontext *Context = alcCreateContext(Device, nullptr);
-  alcMakeContextCurrent(Context);
-
-  ALuint audio_buffer;
-  alGenBuffers(1, &audio_buffer);
-
-  // generate a simple square wave tone
-  // TODO: fix audio clipping at begining/end of tone
-  std::vector<std::uint8_t> audio_data;
-  std::size_t freq = 440;
-  std::size_t samples = freq * 10;
-
-  for (std::size_t i = 0; i < samples; ++i) {
-    if (i & 0b1) {
-      audio_data.push_back(0xff);
-    } else {
-      audio_data.push_back(0x00);
-    }
-  }
-
-  alBufferData(
-    audio_buffer,
-    AL_FORMAT_MONO8,
-    audio_data.data(),
-    audio_data.size(),
-    freq * 2
+  DisplayState display {
+    {}, 0,
+    {
+      openglwrapper::RenderTarget(kate::SCR_W, kate::SCR_H),
+      openglwrapper::RenderTarget(kate::SCR_W, kate::SCR_H)
+    },
+    0, 0, false
+  };
+  glfwSetWindowUserPointer(window, &display);
+  glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+  glfwSetWindowRefreshCallback(window, window_refresh_callback);
+  openglwrapper::BitTexture display_texture(
+    kate::SCR_W, kate::SCR_H, display_upload_slots
   );
 
-  ALuint audio_source;
-  alGenSources(1, &audio_source);
-  alSourcei(audio_source, AL_BUFFER, audio_buffer);
-
   // interpreter
   std::vector<std::uint8_t> rom = utils::read_binary(options.rom_path);
 
@@ -135,80 +152,146 @@ int main(int argc, const char *argv[]) {
     openglwrapper::key_states[kate::key_map[i]].is_handled = true;
   }
 
-  kate::Interpreter chip8 {};
-  chip8.load_rom(rom);
+  // a movie holds everything needed to repeat a run except the rom itself
+  kate::Movie movie {
+    kate::quirks_from_string(options.quirks), 0, utils::fnv1a(rom), {}
+  };
+  bool replaying = !options.replay_path.empty();
+  bool recording = !options.record_path.empty();
+
+  if (replaying) {
+    try {
+      movie = kate::deserialize_movie(utils::read_binary(options.replay_path));
+    } catch (kate::invalid_movie &e) {
+      std::cerr << options.replay_path << ": " << e.what() << std::endl;
+      return 1;
+    }
 
-  utils::Clock clock;
-  utils::seconds timer_begin {0.0};
-  utils::seconds timer_end {0.0};
+    if (movie.rom_hash != utils::fnv1a(rom)) {
+      std::cerr << "WARNING: movie was recorded with a different rom";
+      std::cerr << std::endl;
+    }
+  }
 
-  utils::seconds system_timestep {1.0 / kate::instructions_per_second};
-  utils::seconds system_accumulator {0.0};
+  // declared before the interpreter so that it is unloaded after it
+  std::unique_ptr<kate::NativeCode> native;
+  if (!options.native_path.empty()) {
+    try {
+      native = std::make_unique<kate::NativeCode>(options.native_path);
+    } catch (kate::invalid_native &e) {
+      std::cerr << options.native_path << ": " << e.what() << std::endl;
+      return 1;
+    }
 
-  utils::seconds render_timestep {1.0 / kate::display_refresh_rate};
-  utils::seconds render_accumulator {0.0};
+    if (!native->matches(rom)) {
+      std::cerr << "WARNING: native code was compiled from a different rom";
+      std::cerr << std::endl;
+    }
+  }
 
-  glClearColor(0.1, 0.1, 0.1, 1.0);
-  glfwPollEvents();
-  processInput(window, openglwrapper::key_states, chip8);
-  while (!glfwWindowShouldClose(window)) {
-    timer_begin = clock.get();
+  kate::Interpreter chip8 {movie.quirks};
+  chip8.load_rom(rom);
 
-    if (system_accumulator >= system_timestep) {
-      if (system_accumulator >= (system_timestep * 2)) {
-        std::cout << "WARNING: system loop running slow! ";
-        std::cout << system_accumulator.count() << std::endl;
-      }
+  if (native) {
+    try {
+      chip8.attach_native(&native->get_module());
+    } catch (kate::interpreter_error &e) {
+      std::cerr << options.native_path << ": " << e.what() << std::endl;
+      return 1;
+    }
+  }
 
-      glfwPollEvents();
-      processInput(window, openglwrapper::key_states, chip8);
+  if (replaying) {
+    chip8.seed(movie.seed);
+  } else if (recording) {
+    movie.seed = chip8.get_seed();
+    chip8.record(&movie);
+  }
+  kate::MoviePlayer player {movie, chip8};
+
+  // the interpreter runs on its own thread from here on, see kate::Emulator.
+  // This thread only polls input and draws the newest finished frame, at
+  // the display rate; it never needs to catch up.
+  kate::Emulator emulator {chip8, replaying ? &player : nullptr};
+  utils::FrameScheduler scheduler {kate::display_refresh_rate, 1};
+
+  // the beeper has a thread of its own too, taking sound timer edges from
+  // the emulator as soon as each frame has run
+  std::size_t audio_buffer_samples = kate::audio_buffer_samples;
+  if (options.audio_buffer_samples > 0) {
+    audio_buffer_samples = options.audio_buffer_samples;
+  }
 
-      try {
-        chip8.step();
-      } catch (kate::interpreter_error &e) {
-        std::cerr << e.what() << std::endl;
-        glfwSetWindowShouldClose(window, true);
-        break;
-      }
-      system_accumulator -= system_timestep;
+  audio::BeeperConfig audio_config {
+    kate::audio_sample_rate, audio_buffer_samples, kate::audio_buffer_count,
+    kate::audio_tone_frequency, kate::audio_volume,
+    kate::audio_attack, kate::audio_release
+  };
+  auto take_edge = [&emulator](audio::Edge &edge) {
+    kate::SoundEdge e;
+    if (!emulator.pop_sound_edge(e)) {
+      return false;
     }
 
-    if (render_accumulator >= render_timestep) {
-      if (render_accumulator >= (render_timestep * 2)) {
-        std::cout << "WARNING: render loop running slow! ";
-        std::cout << system_accumulator.count() << std::endl;
-      }
-      chip8.vblank_trigger();
-      chip8.decrement_timers();
+    // the cycle counter advances instructions_per_frame every 60Hz frame,
+    // so this keeps the edges on the same clock as the frames
+    edge = {
+      static_cast<double>(e.cycle) / kate::instructions_per_second, e.on
+    };
+    return true;
+  };
 
-      if (chip8.get_sound_timer() > 0) {
-        ALint state;
-        alGetSourcei(audio_source, AL_SOURCE_STATE, &state);
+  std::unique_ptr<audio::Beeper> beeper;
+  try {
+    beeper = std::make_unique<audio::Beeper>(audio_config, take_edge);
+  } catch (audio::audio_error &e) {
+    std::cerr << e.what() << ", continuing without sound" << std::endl;
+  }
 
-        if (state != AL_PLAYING) {
-          alSourcePlay(audio_source);
-        }
-      } else {
-        alSourcePause(audio_source);
-      }
+  emulator.start();
+  if (beeper) {
+    beeper->start();
+  }
 
-      glClear(GL_COLOR_BUFFER_BIT);
+  glClearColor(0.1, 0.1, 0.1, 1.0);
+  while (!glfwWindowShouldClose(window)) {
+    scheduler.wait();
 
-      const std::vector<std::uint8_t> &buffer = chip8.get_output_buffer();
-      render_opengl(
-        buffer, window, display_buffer,
-        simple_mesh, main_shader,display_texture
-      );
+    glfwPollEvents();
+    processInput(window, openglwrapper::key_states, emulator);
 
-      render_accumulator -= render_timestep;
+    if (!emulator.is_running()) {
+      glfwSetWindowShouldClose(window, true);
     }
 
-    timer_end = clock.get();
-    system_accumulator += (timer_end - timer_begin);
-    render_accumulator += (timer_end - timer_begin);
+    emulator.update_frame();
+    const kate::Frame &frame = emulator.get_frame();
+
+    render_opengl(
+      frame, window, display,
+      simple_mesh, main_shader, fade_shader, display_texture
+    );
   }
 
+  emulator.stop();
+  beeper.reset();
   glfwTerminate();
+
+  // only profiling builds count anything, see kate::Profile
+  if (const kate::Profile *profile = chip8.get_profile()) {
+    if (kate::save_profile(*profile, "output") == 0) {
+      std::cout << "Saved profile to \"output\"" << std::endl;
+    }
+  }
+
+  if (recording) {
+    if (utils::write_binary(
+      options.record_path, kate::serialize_movie(movie), true
+    ) == 0) {
+      std::cout << "Saved movie to " << options.record_path << std::endl;
+    }
+  }
+
   return 0;
 }
 
@@ -242,6 +325,10 @@ GLFWwindow *init_opengl(
 
   glViewport(0, 0, window_width, window_height);
 
+  // the frame scheduler paces the main loop, waiting for vsync as well would
+  // make frames late whenever the two drift apart
+  glfwSwapInterval(0);
+
   // enable debugging
   if (!debug::enableDebug()) {
     std::cerr << "GL Debug Context not available." << std::endl;
@@ -252,40 +339,45 @@ GLFWwindow *init_opengl(
 
 void processInput(
   GLFWwindow *window, std::map<int, openglwrapper::KeyState> &key_states,
-  kate::Interpreter &interpreter
+  kate::Emulator &emulator
 ) {
   if (key_states[GLFW_KEY_ESCAPE].is_pressed) {
     glfwSetWindowShouldClose(window, true);
   }
 
-  if (key_states[GLFW_KEY_P].is_pressed && !key_states[GLFW_KEY_P].is_handled) {
-    std::filesystem::path directory = "output";
-    std::string fn = interpreter.debug_filename();
-
-    utils::save_pnm(
-      interpreter.get_output_buffer(), kate::SCR_W, kate::SCR_H,
-      directory, fn, utils::PGM_RAW, true, "1"
-    );
-
-    std::cout << "Saved file " << fn << " to " << directory << std::endl;
+  // everything else is carried out on the emulation thread. A command that
+  // doesn't fit in the queue is left unhandled and sent again next frame.
+  const std::map<int, kate::COMMAND> hotkeys {
+    {GLFW_KEY_P, kate::COMMAND::SCREENSHOT},
+    {GLFW_KEY_F5, kate::COMMAND::SAVE_STATE},
+    {GLFW_KEY_F9, kate::COMMAND::LOAD_STATE},
+    {GLFW_KEY_BACKSPACE, kate::COMMAND::REWIND}
+  };
 
-    key_states[GLFW_KEY_P].is_handled = true;
+  for (const auto &[key, command] : hotkeys) {
+    if (key_states[key].is_pressed && !key_states[key].is_handled) {
+      key_states[key].is_handled = emulator.send({command, 0});
+    }
   }
 
-  for (int k = 0; k <= 0xf; ++k) {
+  for (std::uint8_t k = 0; k <= 0xf; ++k) {
     if (!key_states[kate::key_map[k]].is_handled) {
       if (key_states[kate::key_map[k]].is_pressed) {
-        interpreter.keypress(k);
+        key_states[kate::key_map[k]].is_handled = emulator.send(
+          {kate::COMMAND::KEYPRESS, k}
+        );
       } else if (key_states[kate::key_map[k]].is_released) {
-        interpreter.keyrelease(k);
+        key_states[kate::key_map[k]].is_handled = emulator.send(
+          {kate::COMMAND::KEYRELEASE, k}
+        );
+      } else {
+        key_states[kate::key_map[k]].is_handled = true;
       }
-
-      key_states[kate::key_map[k]].is_handled = true;
     }
   }
 }
 
-void render_console(const std::vector<std::uint8_t> &buffer) {
+void render_console(const kate::Framebuffer &buffer) {
   // dump buffer to console for debugging
   for (std::size_t i = 0; i < kate::SCR_W;  ++i) {
     std::cout << '-';
@@ -293,48 +385,106 @@ void render_console(const std::vector<std::uint8_t> &buffer) {
 
   std::cout << std::endl;
   for (std::size_t y = 0; y < kate::SCR_H; ++y) {
-    std::size_t offset = y * kate::SCR_W;
     for (std::size_t x = 0; x < kate::SCR_W; ++x) {
-      std::size_t index = x + offset;
+      bool pixel = (buffer[y] >> (kate::SCR_W - 1 - x)) & 1;
 
-      std::cout << (buffer[index] ? '#' : ' ');
+      std::cout << (pixel ? '#' : ' ');
     }
     std::cout << '\n';
   }
 }
 
 void render_opengl(
-  const std::vector<std::uint8_t> &buffer,
-  GLFWwindow *window, std::vector<std::uint8_t> &display_buffer,
+  const kate::Frame &frame,
+  GLFWwindow *window, DisplayState &display,
   openglwrapper::Mesh &simple_mesh, openglwrapper::Shader &main_shader,
-  openglwrapper::Texture &display_texture
+  openglwrapper::Shader &fade_shader,
+  openglwrapper::BitTexture &display_texture
 ) {
-  for (std::size_t y = 0; y < kate::SCR_H; ++y) {
-    std::size_t offset = y * kate::SCR_W;
-    for (std::size_t x = 0; x < kate::SCR_W; ++x) {
-      std::size_t index = x + offset;
-
-      if (kate::do_display_fade) {
-        if (display_buffer[index] >= kate::display_fade_rate) {
-          display_buffer[index] -= kate::display_fade_rate;
-        } else {
-          display_buffer[index] = 0;
-        }
-
-        if (buffer[index] == 1) {
-          display_buffer[index] = 255;
-        }
-      } else {
-        display_buffer[index] = buffer[index] ? 255 : 0;
+  kate::RowMask rows = 0;
+  if (frame.generation != display.generation) {
+    // only the rows written since the frame we last drew need checking,
+    // unless some frames in between were never seen
+    kate::RowMask written = kate::all_rows;
+    if (frame.base_generation == display.generation) {
+      written = frame.dirty_rows;
+    }
+
+    for (std::size_t y = 0; y < kate::SCR_H; ++y) {
+      if (((written >> y) & 1) && (frame.buffer[y] != display.drawn[y])) {
+        rows |= kate::RowMask(1) << y;
       }
     }
+
+    display.drawn = frame.buffer;
+    display.generation = frame.generation;
+  }
+
+  if (rows != 0) {
+    display.fading = fade_frames;
+  } else if ((display.fading == 0) && !display.redraw) {
+    // nothing changed and nothing is fading, the last frame is still correct
+    return;
+  }
+  display.redraw = false;
+
+  if (rows != 0) {
+    std::size_t first = kate::SCR_H;
+    std::size_t last = 0;
+    for (std::size_t y = 0; y < kate::SCR_H; ++y) {
+      if (!((rows >> y) & 1)) {
+        continue;
+      }
+      first = std::min(first, y);
+      last = y;
+    }
+
+    // upload just the span of rows that changed, still packed one bit per
+    // pixel, the fade shader unpacks them
+    display_texture.update_rows(
+      frame.buffer.data(), first, last - first + 1
+    );
+  }
+
+  // new = max(frame, previous - rate), drawn into the other target. Only
+  // redrawing presents the last one again without fading it any further.
+  if (display.fading > 0) {
+    const openglwrapper::RenderTarget &previous =
+      display.persistence[display.current];
+    display.current ^= 1;
+    const openglwrapper::RenderTarget &target =
+      display.persistence[display.current];
+
+    target.bind();
+    fade_shader.use();
+    fade_shader.uniform1i("u_frame", 0);
+    fade_shader.uniform1i("u_previous", 1);
+    fade_shader.uniform1f("u_fade_rate", fade_rate / 255.0f);
+    display_texture.bind(0);
+    previous.bind_texture(1);
+    simple_mesh.draw();
+
+    --display.fading;
   }
-  // update display texture
-  display_texture.update(display_buffer, kate::SCR_W, kate::SCR_H);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+  glViewport(0, 0, width, height);
+
+  glClear(GL_COLOR_BUFFER_BIT);
 
   main_shader.use();
-  display_texture.bind();
+  display.persistence[display.current].bind_texture(0);
   simple_mesh.draw();
 
   glfwSwapBuffers(window);
 }
+
+void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
+  window_refresh_callback(window);
+}
+
+void window_refresh_callback(GLFWwindow *window) {
+  static_cast<DisplayState *>(glfwGetWindowUserPointer(window))->redraw = true;
+}
@@ -0,0 +1,95 @@
+#include <utility>
+
+#include <cstring> // std::memcpy
+
+#include "bit_texture.hpp"
+#include "exceptions.hpp"
+
+openglwrapper::BitTexture::BitTexture()
+: id(0), words_per_row(0), streaming(false) {}
+
+openglwrapper::BitTexture::BitTexture(
+  int width, int height, std::size_t stream_slots
+) : id(0), words_per_row(width / 64), streaming(stream_slots > 0) {
+  if ((width <= 0) || (width % 64 != 0)) {
+    throw texture_error("bit texture width must be a multiple of 64");
+  }
+
+  glGenTextures(1, &id);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, id);
+
+  // integer textures can't be filtered
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glTexImage2D(
+    GL_TEXTURE_2D, 0, GL_RG32UI, words_per_row, height, 0, GL_RG_INTEGER,
+    GL_UNSIGNED_INT, nullptr
+  );
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  if (streaming) {
+    stream = {
+      sizeof(std::uint64_t) * words_per_row * height, stream_slots
+    };
+  }
+}
+
+openglwrapper::BitTexture::~BitTexture() {
+  glDeleteTextures(1, &id);
+}
+
+openglwrapper::BitTexture::BitTexture(BitTexture &&other)
+: id(std::exchange(other.id, 0)), words_per_row(other.words_per_row),
+  streaming(other.streaming),
+  stream(std::move(other.stream)) {}
+
+openglwrapper::BitTexture &openglwrapper::BitTexture::operator=(
+  BitTexture &&other
+) {
+  id = std::exchange(other.id, 0);
+  words_per_row = other.words_per_row;
+  streaming = other.streaming;
+  stream = std::move(other.stream);
+
+  return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void openglwrapper::BitTexture::bind(GLuint unit) const {
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_2D, id);
+}
+
+void openglwrapper::BitTexture::update_rows(
+  const std::uint64_t *data, int first, int count
+) {
+  glBindTexture(GL_TEXTURE_2D, id);
+
+  if (!streaming) {
+    glTexSubImage2D(
+      GL_TEXTURE_2D, 0, 0, first, words_per_row, count, GL_RG_INTEGER,
+      GL_UNSIGNED_INT, data + first * words_per_row
+    );
+    return;
+  }
+
+  // the rows go to the start of the slot, the upload then reads them from
+  // there once the GPU gets to it
+  std::memcpy(
+    stream.acquire(), data + first * words_per_row,
+    sizeof(std::uint64_t) * words_per_row * count
+  );
+
+  stream.bind();
+  glTexSubImage2D(
+    GL_TEXTURE_2D, 0, 0, first, words_per_row, count, GL_RG_INTEGER,
+    GL_UNSIGNED_INT, stream.offset()
+  );
+  stream.unbind();
+  stream.release();
+}
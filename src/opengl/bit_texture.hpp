@@ -0,0 +1,50 @@
+#ifndef __BIT_TEXTURE_HPP__
+#define __BIT_TEXTURE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glad/glad.h>
+
+#include "stream_buffer.hpp"
+
+namespace openglwrapper {
+  // A one bit per pixel image, stored as an unsigned integer texture and
+  // unpacked by the shader that reads it.
+  //
+  // Each row is a run of std::uint64_t with the leftmost pixel in the most
+  // significant bit. Every word becomes one GL_RG32UI texel, so with a little
+  // endian host .r holds the low half of the word and .g the high half.
+  //
+  // Given `stream_slots`, updates go through a persistently mapped
+  // StreamBuffer with that many slots instead of from client memory.
+  class BitTexture {
+  public:
+    BitTexture();
+    // `width` is in pixels and must be a multiple of 64
+    BitTexture(int width, int height, std::size_t stream_slots=0);
+    ~BitTexture();
+
+    // delete copy constructor/asignment
+    BitTexture(BitTexture &other) = delete;
+    BitTexture &operator=(BitTexture &other) = delete;
+
+    // need to explicitly define move constructor
+    BitTexture(BitTexture &&other);
+    BitTexture &operator=(BitTexture &&other);
+
+    ///////////////////////////////////////////////////////////////////////////
+    void bind(GLuint unit=0) const;
+    // update only rows [first, first + count), `data` holds the whole image
+    void update_rows(const std::uint64_t *data, int first, int count);
+
+  private:
+    GLuint id = 0;
+    int words_per_row;
+
+    bool streaming;
+    StreamBuffer stream;
+  };
+}
+
+#endif // __BIT_TEXTURE_HPP__
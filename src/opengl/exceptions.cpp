@@ -19,3 +19,13 @@ openglwrapper::shader_error::shader_error(const std::string& msg)
 : openglwrapper_error(msg) {}
 openglwrapper::shader_error::shader_error(const char* msg)
 : openglwrapper_error(msg) {}
+
+openglwrapper::framebuffer_error::framebuffer_error(const std::string& msg)
+: openglwrapper_error(msg) {}
+openglwrapper::framebuffer_error::framebuffer_error(const char* msg)
+: openglwrapper_error(msg) {}
+
+openglwrapper::buffer_error::buffer_error(const std::string& msg)
+: openglwrapper_error(msg) {}
+openglwrapper::buffer_error::buffer_error(const char* msg)
+: openglwrapper_error(msg) {}
@@ -27,6 +27,18 @@ namespace openglwrapper {
     explicit shader_error(const std::string& msg);
     explicit shader_error(const char* msg);
   };
+
+  class framebuffer_error : public openglwrapper_error {
+  public:
+    explicit framebuffer_error(const std::string& msg);
+    explicit framebuffer_error(const char* msg);
+  };
+
+  class buffer_error : public openglwrapper_error {
+  public:
+    explicit buffer_error(const std::string& msg);
+    explicit buffer_error(const char* msg);
+  };
 }
 
 #endif // __GLW_EXCEPTIONS__
@@ -0,0 +1,86 @@
+#include <utility>
+
+#include "exceptions.hpp"
+#include "render_target.hpp"
+
+openglwrapper::RenderTarget::RenderTarget()
+: fbo(0), texture(0), width(0), height(0) {}
+
+openglwrapper::RenderTarget::RenderTarget(int width, int height)
+: fbo(0), texture(0), width(width), height(height) {
+  glGenTextures(1, &texture);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glTexImage2D(
+    GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE,
+    nullptr
+  );
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(
+    GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0
+  );
+
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &texture);
+    throw framebuffer_error("render target framebuffer is incomplete");
+  }
+
+  // start out black, the texture's contents are otherwise undefined
+  const GLfloat black[] = {0.0, 0.0, 0.0, 1.0};
+  glClearBufferfv(GL_COLOR, 0, black);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+openglwrapper::RenderTarget::~RenderTarget() {
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteTextures(1, &texture);
+}
+
+openglwrapper::RenderTarget::RenderTarget(RenderTarget &&other)
+: fbo(std::exchange(other.fbo, 0)),
+  texture(std::exchange(other.texture, 0)),
+  width(other.width),
+  height(other.height)
+{}
+
+openglwrapper::RenderTarget &openglwrapper::RenderTarget::operator=(
+  RenderTarget &&other
+) {
+  fbo = std::exchange(other.fbo, 0);
+  texture = std::exchange(other.texture, 0);
+  width = other.width;
+  height = other.height;
+
+  return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void openglwrapper::RenderTarget::bind() const {
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glViewport(0, 0, width, height);
+}
+
+void openglwrapper::RenderTarget::bind_texture(GLuint unit) const {
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+int openglwrapper::RenderTarget::get_width() const {
+  return width;
+}
+
+int openglwrapper::RenderTarget::get_height() const {
+  return height;
+}
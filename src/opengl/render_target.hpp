@@ -0,0 +1,40 @@
+#ifndef __RENDER_TARGET_HPP__
+#define __RENDER_TARGET_HPP__
+
+#include <glad/glad.h>
+
+namespace openglwrapper {
+  // A single channel texture attached to its own framebuffer, so it can be
+  // drawn into and then sampled like any other texture.
+  class RenderTarget {
+  public:
+    RenderTarget();
+    RenderTarget(int width, int height);
+    ~RenderTarget();
+
+    // delete copy constructor/asignment
+    RenderTarget(RenderTarget &other) = delete;
+    RenderTarget &operator=(RenderTarget &other) = delete;
+
+    // need to explicitly define move constructor
+    RenderTarget(RenderTarget &&other);
+    RenderTarget &operator=(RenderTarget &&other);
+
+    ///////////////////////////////////////////////////////////////////////////
+    // draw into this target, the viewport is set to cover it
+    void bind() const;
+    // bind the texture for sampling
+    void bind_texture(GLuint unit=0) const;
+
+    int get_width() const;
+    int get_height() const;
+
+  private:
+    GLuint fbo = 0;
+    GLuint texture = 0;
+    int width;
+    int height;
+  };
+}
+
+#endif // __RENDER_TARGET_HPP__
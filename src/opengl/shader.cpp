@@ -73,6 +73,20 @@ void openglwrapper::Shader::use() const {
 }
 
 // scalar uniforms
+void openglwrapper::Shader::uniform1i(
+  const std::string &name, GLint value
+) const {
+  GLint location = glGetUniformLocation(id, name.c_str());
+  glUniform1i(location, value);
+}
+
+void openglwrapper::Shader::uniform1f(
+  const std::string &name, GLfloat value
+) const {
+  GLint location = glGetUniformLocation(id, name.c_str());
+  glUniform1f(location, value);
+}
+
 void openglwrapper::Shader::uniform4f(
   const std::string &name, const glm::vec4 &value
 ) const {
@@ -30,6 +30,8 @@ namespace openglwrapper {
     void use() const;
 
     // scalar uniforms
+    void uniform1i(const std::string &name, GLint value) const;
+    void uniform1f(const std::string &name, GLfloat value) const;
     void uniform4f(const std::string &name, const glm::vec4 &value) const;
 
     // matrix uniforms
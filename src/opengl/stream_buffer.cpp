@@ -0,0 +1,129 @@
+#include <utility>
+
+#include "exceptions.hpp"
+#include "stream_buffer.hpp"
+
+// buffer offsets must suit any pixel type
+constexpr std::size_t slot_alignment = 64;
+
+// how long to block on a fence before checking it again
+constexpr GLuint64 fence_timeout_ns = 1000000;
+
+openglwrapper::StreamBuffer::StreamBuffer()
+: id(0), mapped(nullptr), slot_size(0), current(0) {}
+
+openglwrapper::StreamBuffer::StreamBuffer(
+  std::size_t slot_size, std::size_t slots
+) : id(0), mapped(nullptr), current(0), fences(slots, nullptr) {
+  if (slots == 0) {
+    throw buffer_error("stream buffer needs at least one slot");
+  }
+
+  this->slot_size =
+    (slot_size + slot_alignment - 1) / slot_alignment * slot_alignment;
+  GLsizeiptr size = this->slot_size * slots;
+
+  GLbitfield flags =
+    GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+  glGenBuffers(1, &id);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, id);
+  glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+  mapped = static_cast<std::uint8_t *>(
+    glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags)
+  );
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  if (mapped == nullptr) {
+    glDeleteBuffers(1, &id);
+    throw buffer_error("unable to map stream buffer");
+  }
+}
+
+openglwrapper::StreamBuffer::~StreamBuffer() {
+  destroy();
+}
+
+openglwrapper::StreamBuffer::StreamBuffer(StreamBuffer &&other)
+: id(std::exchange(other.id, 0)),
+  mapped(std::exchange(other.mapped, nullptr)),
+  slot_size(other.slot_size),
+  current(other.current),
+  fences(std::move(other.fences))
+{}
+
+openglwrapper::StreamBuffer &openglwrapper::StreamBuffer::operator=(
+  StreamBuffer &&other
+) {
+  destroy();
+
+  id = std::exchange(other.id, 0);
+  mapped = std::exchange(other.mapped, nullptr);
+  slot_size = other.slot_size;
+  current = other.current;
+  fences = std::move(other.fences);
+
+  return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::uint8_t *openglwrapper::StreamBuffer::acquire() {
+  GLsync &fence = fences[current];
+
+  if (fence != nullptr) {
+    GLenum result;
+    do {
+      result = glClientWaitSync(
+        fence, GL_SYNC_FLUSH_COMMANDS_BIT, fence_timeout_ns
+      );
+    } while (result == GL_TIMEOUT_EXPIRED);
+
+    glDeleteSync(fence);
+    fence = nullptr;
+
+    if (result == GL_WAIT_FAILED) {
+      throw buffer_error("waiting for stream buffer fence failed");
+    }
+  }
+
+  return mapped + current * slot_size;
+}
+
+const void *openglwrapper::StreamBuffer::offset() const {
+  return reinterpret_cast<const void *>(current * slot_size);
+}
+
+void openglwrapper::StreamBuffer::release() {
+  fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  current = (current + 1) % fences.size();
+}
+
+void openglwrapper::StreamBuffer::bind() const {
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, id);
+}
+
+void openglwrapper::StreamBuffer::unbind() const {
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+std::size_t openglwrapper::StreamBuffer::get_slot_size() const {
+  return slot_size;
+}
+
+void openglwrapper::StreamBuffer::destroy() {
+  for (GLsync &fence : fences) {
+    if (fence != nullptr) {
+      glDeleteSync(fence);
+      fence = nullptr;
+    }
+  }
+
+  if (id != 0) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, id);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &id);
+    id = 0;
+  }
+  mapped = nullptr;
+}
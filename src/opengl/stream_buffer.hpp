@@ -0,0 +1,65 @@
+#ifndef __STREAM_BUFFER_HPP__
+#define __STREAM_BUFFER_HPP__
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glad/glad.h>
+
+namespace openglwrapper {
+  // A ring of pixel unpack buffers that stay mapped for their whole life.
+  //
+  // Data is written straight into memory the GPU reads from, and the upload
+  // that reads it runs asynchronously instead of being copied out of client
+  // memory when glTexSubImage2D is called. Each slot gets a fence once its
+  // upload has been queued, and is only written again once the GPU is done
+  // with it, so with a few slots the CPU never has to wait.
+  //
+  //   std::uint8_t *p = stream.acquire();
+  //   // ... fill p ...
+  //   stream.bind();
+  //   glTexSubImage2D(..., stream.offset());
+  //   stream.unbind();
+  //   stream.release();
+  class StreamBuffer {
+  public:
+    StreamBuffer();
+    StreamBuffer(std::size_t slot_size, std::size_t slots);
+    ~StreamBuffer();
+
+    // delete copy constructor/asignment
+    StreamBuffer(StreamBuffer &other) = delete;
+    StreamBuffer &operator=(StreamBuffer &other) = delete;
+
+    // need to explicitly define move constructor
+    StreamBuffer(StreamBuffer &&other);
+    StreamBuffer &operator=(StreamBuffer &&other);
+
+    ///////////////////////////////////////////////////////////////////////////
+    // waits until the GPU has finished with the current slot, then returns
+    // where to write to
+    std::uint8_t *acquire();
+    // the current slot, as an offset into the bound buffer
+    const void *offset() const;
+    // fences the current slot after the commands reading it and moves on
+    void release();
+
+    void bind() const;
+    void unbind() const;
+
+    std::size_t get_slot_size() const;
+
+  private:
+    void destroy();
+
+    GLuint id = 0;
+    std::uint8_t *mapped = nullptr;
+    std::size_t slot_size;
+    std::size_t current;
+    std::vector<GLsync> fences;
+  };
+}
+
+#endif // __STREAM_BUFFER_HPP__
@@ -0,0 +1,96 @@
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include <cstdlib> // std::system
+#include <unistd.h> // getpid
+
+#include "kate/interpreter.hpp"
+#include "kate/recompiler.hpp"
+#include "util/io.hpp"
+#include "util/options.hpp"
+
+// Compiles a rom ahead of time into a shared library that `kate` and
+// `kate-headless` can load with --native, see kate/native.hpp. The code is
+// found by static analysis from the entry point, the interpreter still runs
+// anything that wasn't found or has been modified since.
+
+static std::string shell_quote(const std::string &s) {
+  std::string quoted = "'";
+  for (char c : s) {
+    if (c == '\'') {
+      quoted += "'\\''";
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "'";
+}
+
+int main(int argc, const char *argv[]) {
+  utils::RECOMPILE_OPTIONS options = utils::parse_recompile_command_line(
+    argc, argv
+  );
+
+  if (options.err) {
+    return options.err;
+  } else if (options.called_for_help) {
+    return 0;
+  }
+
+  std::vector<std::uint8_t> rom = utils::read_binary(options.rom_path);
+  if (rom.empty()) {
+    return 1;
+  }
+
+  std::filesystem::path output = options.output_path;
+  if (output.empty()) {
+    output = options.rom_path;
+    output.replace_extension(".so");
+  }
+
+  kate::QUIRKS quirks = kate::quirks_from_string(options.quirks);
+  std::string source = kate::recompile_rom(
+    rom, quirks, options.rom_path.filename().string()
+  );
+
+  bool keep_source = !options.source_path.empty();
+  std::filesystem::path source_path = options.source_path;
+  if (!keep_source) {
+    source_path = std::filesystem::temp_directory_path() /
+                  ("kate-recompile-" + std::to_string(getpid()) + ".cpp");
+  }
+  if (utils::write_file(source_path, source, true)) {
+    return 1;
+  }
+
+  std::string command = options.compiler +
+    " -std=gnu++17 -O2 -shared -fPIC -I " +
+    shell_quote(options.include_path.string()) + " -o " +
+    shell_quote(output.string()) + " " + shell_quote(source_path.string());
+  int status = std::system(command.c_str());
+
+  if (!keep_source) {
+    std::filesystem::remove(source_path);
+  }
+  if (status != 0) {
+    std::cerr << "failed to compile: " << command << std::endl;
+    return 1;
+  }
+
+  kate::CodeMap map = kate::analyse_rom(rom);
+  std::size_t reachable = 0;
+  std::size_t leaders = 0;
+  for (std::size_t i = 0; i < map.reachable.size(); ++i) {
+    reachable += map.reachable[i];
+    leaders += map.leaders[i];
+  }
+
+  std::cout << "rom        : " << options.rom_path.string() << '\n';
+  std::cout << "quirks     : " << options.quirks << '\n';
+  std::cout << "reachable  : " << reachable << " instructions\n";
+  std::cout << "blocks     : " << leaders << '\n';
+  std::cout << "output     : " << output.string() << std::endl;
+
+  return 0;
+}
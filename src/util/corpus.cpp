@@ -0,0 +1,69 @@
+#include <algorithm> // std::sort
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "corpus.hpp"
+#include "io.hpp"
+
+std::vector<utils::CORPUS_ENTRY> utils::read_corpus(
+  const std::filesystem::path &path, std::uint64_t default_frames
+) {
+  std::vector<CORPUS_ENTRY> entries;
+
+  if (std::filesystem::is_directory(path)) {
+    for (const auto &f : std::filesystem::directory_iterator(path)) {
+      if (f.is_regular_file() && (f.path().extension() == ".ch8")) {
+        entries.push_back({f.path(), default_frames});
+      }
+    }
+
+    // directory order is unspecified, keep the output stable
+    std::sort(
+      entries.begin(), entries.end(),
+      [](const CORPUS_ENTRY &a, const CORPUS_ENTRY &b) {
+        return a.rom_path < b.rom_path;
+      }
+    );
+    return entries;
+  }
+
+  std::string manifest = read_file(path);
+  std::stringstream ss(manifest);
+  std::string line;
+  std::size_t line_number = 0;
+
+  while (std::getline(ss, line)) {
+    ++line_number;
+
+    std::stringstream ls(line);
+    std::string rom;
+    if (!(ls >> rom) || (rom[0] == '#')) {
+      continue;
+    }
+
+    CORPUS_ENTRY entry {rom, default_frames};
+    if (entry.rom_path.is_relative()) {
+      entry.rom_path = path.parent_path() / entry.rom_path;
+    }
+
+    std::string frames;
+    if (ls >> frames) {
+      try {
+        std::size_t end;
+        entry.frames = std::stoull(frames, &end);
+        if (end != frames.size()) {
+          throw std::invalid_argument(frames);
+        }
+      } catch (std::logic_error &e) {
+        std::cerr << path.string() << ":" << line_number;
+        std::cerr << ": invalid frame count '" << frames << "'" << std::endl;
+        return {};
+      }
+    }
+
+    entries.push_back(entry);
+  }
+
+  return entries;
+}
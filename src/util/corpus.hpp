@@ -0,0 +1,27 @@
+#ifndef __CORPUS_HPP__
+#define __CORPUS_HPP__
+
+#include <filesystem>
+#include <vector>
+
+#include <cstdint>
+
+namespace utils {
+  struct CORPUS_ENTRY {
+    std::filesystem::path rom_path;
+    std::uint64_t frames;
+  };
+
+  // `path` is either a directory, in which case every `.ch8` file in it is
+  // run for `default_frames`, or a manifest with one rom per line:
+  //
+  //   path/to/rom.ch8 [frames]
+  //
+  // Relative paths are relative to the manifest, blank lines and lines
+  // starting with `#` are ignored. Returns an empty list on error.
+  std::vector<CORPUS_ENTRY> read_corpus(
+    const std::filesystem::path &path, std::uint64_t default_frames
+  );
+}
+
+#endif // __CORPUS_HPP__
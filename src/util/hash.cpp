@@ -0,0 +1,12 @@
+#include "hash.hpp"
+
+std::uint64_t utils::fnv1a(const std::vector<std::uint8_t> &data) {
+  std::uint64_t hash = 0xcbf29ce484222325;
+
+  for (std::uint8_t b : data) {
+    hash ^= b;
+    hash *= 0x00000100000001b3;
+  }
+
+  return hash;
+}
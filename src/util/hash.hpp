@@ -0,0 +1,13 @@
+#ifndef __HASH_HPP__
+#define __HASH_HPP__
+
+#include <vector>
+
+#include <cstdint>
+
+namespace utils {
+  // 64-bit FNV-1a, used to fingerprint framebuffers
+  std::uint64_t fnv1a(const std::vector<std::uint8_t> &data);
+}
+
+#endif // __HASH_HPP__
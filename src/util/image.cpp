@@ -32,8 +32,12 @@ int utils::save_pnm(
   std::copy(h_str.begin(), h_str.end(), std::back_inserter(header));
 
   header.push_back('\n');
-  std::copy(max_value.begin(), max_value.end(), std::back_inserter(header));
-  header.push_back('\n');
+
+  // bitmaps have no maximum value
+  if ((file_format != PBM_PLAIN) && (file_format != PBM_RAW)) {
+    std::copy(max_value.begin(), max_value.end(), std::back_inserter(header));
+    header.push_back('\n');
+  }
 
   std::copy(header.begin(), header.end(), std::back_inserter(image_data));
 
@@ -56,3 +60,32 @@ int utils::save_pnm(
   std::filesystem::path filepath = directory / ss.str();
   return write_binary(filepath, image_data, create_dirs);
 }
+
+int utils::save_pnm_packed(
+  const std::vector<std::uint8_t> &data, std::size_t width, std::size_t height,
+  const std::filesystem::path &directory, const std::string &name,
+  FORMAT file_format, bool create_dirs, const std::string &max_value
+) {
+  if (file_format == PBM_RAW) {
+    return save_pnm(
+      data, width, height, directory, name, file_format, create_dirs,
+      max_value
+    );
+  }
+
+  std::size_t stride = (width + 7) / 8;
+  std::vector<std::uint8_t> pixels;
+  pixels.reserve(width * height);
+
+  for (std::size_t y = 0; y < height; ++y) {
+    for (std::size_t x = 0; x < width; ++x) {
+      std::uint8_t byte = data[(y * stride) + (x / 8)];
+      pixels.push_back((byte >> (7 - (x % 8))) & 1);
+    }
+  }
+
+  return save_pnm(
+    pixels, width, height, directory, name, file_format, create_dirs,
+    max_value
+  );
+}
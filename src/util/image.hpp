@@ -23,6 +23,16 @@ namespace utils {
     FORMAT file_format=PGM_RAW, bool create_dirs=false,
     const std::string &max_value="255"
   );
+
+  // `data` holds one bit per pixel, most significant bit first, with each row
+  // padded to a whole byte. Raw PBM is written as is (note that a set bit is
+  // black in PBM), any other format is unpacked to one value per pixel.
+  int save_pnm_packed(
+    const std::vector<std::uint8_t> &data, std::size_t width, std::size_t height,
+    const std::filesystem::path &directory, const std::string &name,
+    FORMAT file_format=PBM_RAW, bool create_dirs=false,
+    const std::string &max_value="1"
+  );
 }
 
 #endif // __IMAGE_HPP__
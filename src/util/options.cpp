@@ -2,13 +2,177 @@
 
 #include "options.hpp"
 
+static CLI::Option *add_quirks_option(CLI::App &app, std::string &quirks) {
+  quirks = "cosmac-vip";
+  return app.add_option(
+    "-q,--quirks", quirks, "quirks profile (cosmac-vip, super-chip, xo-chip)"
+  )->check(CLI::IsMember({"cosmac-vip", "super-chip", "xo-chip"}));
+}
+
 utils::OPTIONS utils::parse_command_line(int argc, const char *argv[]) {
   OPTIONS options;
   CLI::App app;
 
   options.err = 0;
   options.called_for_help = false;
+  options.audio_buffer_samples = 0;
+  app.add_option("-r,--rom", options.rom_path, "path to rom")->required();
+  CLI::Option *quirks = add_quirks_option(app, options.quirks);
+  CLI::Option *record = app.add_option(
+    "--record", options.record_path, "record input to a movie file"
+  );
+  app.add_option(
+    "--replay", options.replay_path, "play back a movie file"
+  )->excludes(record)->excludes(quirks);
+  app.add_option(
+    "--audio-buffer", options.audio_buffer_samples,
+    "samples per audio buffer, lower for less latency"
+  )->check(CLI::Range(64, 16384));
+  app.add_option(
+    "--native", options.native_path, "run code compiled by kate-recompile"
+  );
+
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::CallForHelp &e) {
+    options.called_for_help = true;
+    options.err = app.exit(e);
+  } catch (const CLI::ParseError &e) {
+    options.err = app.exit(e);
+  }
+
+  return options;
+}
+
+utils::HEADLESS_OPTIONS utils::parse_headless_command_line(
+  int argc, const char *argv[]
+) {
+  HEADLESS_OPTIONS options;
+  CLI::App app;
+
+  options.err = 0;
+  options.called_for_help = false;
+  options.frames = 600;
+  options.cycles = 0;
+  options.lanes = 1;
+  options.jobs = 0;
+  options.rewind = false;
+  CLI::Option *rom = app.add_option(
+    "-r,--rom", options.rom_path, "path to rom"
+  );
+  CLI::Option *corpus = app.add_option(
+    "--corpus", options.corpus_path,
+    "directory of roms, or a manifest listing `path [frames]` per line"
+  );
+  rom->excludes(corpus);
+  CLI::Option *quirks = add_quirks_option(app, options.quirks);
+  CLI::Option *frames = app.add_option(
+    "-f,--frames", options.frames, "number of frames to run"
+  );
+  CLI::Option *cycles = app.add_option(
+    "-c,--cycles", options.cycles, "number of cycles to run"
+  );
+  frames->excludes(cycles);
+  cycles->excludes(corpus);
+  CLI::Option *lanes = app.add_option(
+    "-l,--lanes", options.lanes, "number of copies of the rom to run at once"
+  )->check(CLI::Range(1, 4096))->excludes(corpus);
+  app.add_option(
+    "-j,--jobs", options.jobs, "threads to run a corpus on (default: all)"
+  );
+  app.add_flag(
+    "--rewind", options.rewind, "record rewind history and report its size"
+  )->excludes(corpus)->excludes(lanes);
+  app.add_option(
+    "--replay", options.replay_path,
+    "play back a movie, to its end unless --cycles is given"
+  )->needs(rom)->excludes(lanes)->excludes(frames)->excludes(quirks);
+  app.add_option(
+    "--native", options.native_path, "run code compiled by kate-recompile"
+  )->needs(rom)->excludes(lanes);
+
+  try {
+    app.parse(argc, argv);
+    if (!rom->count() && !corpus->count()) {
+      throw CLI::RequiredError("--rom or --corpus");
+    }
+  } catch (const CLI::CallForHelp &e) {
+    options.called_for_help = true;
+    options.err = app.exit(e);
+  } catch (const CLI::ParseError &e) {
+    options.err = app.exit(e);
+  }
+
+  return options;
+}
+
+utils::BENCH_OPTIONS utils::parse_bench_command_line(
+  int argc, const char *argv[]
+) {
+  BENCH_OPTIONS options;
+  CLI::App app;
+
+  options.err = 0;
+  options.called_for_help = false;
+  options.save = false;
+  options.tolerance = 10.0;
+  options.runs = 5;
+  app.add_option(
+    "-b,--baseline", options.baseline_path,
+    "compare against this baseline, or create it if it doesn't exist"
+  );
+  app.add_flag(
+    "--save", options.save, "overwrite the baseline with this run's results"
+  );
+  app.add_option(
+    "-t,--tolerance", options.tolerance,
+    "percent slower than the baseline that counts as a regression"
+  )->check(CLI::NonNegativeNumber);
+  app.add_option(
+    "-n,--runs", options.runs, "timed runs per benchmark, the best is kept"
+  )->check(CLI::Range(1, 1000));
+  app.add_option(
+    "-f,--filter", options.filter, "only run benchmarks whose name has this"
+  );
+
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::CallForHelp &e) {
+    options.called_for_help = true;
+    options.err = app.exit(e);
+  } catch (const CLI::ParseError &e) {
+    options.err = app.exit(e);
+  }
+
+  return options;
+}
+
+utils::RECOMPILE_OPTIONS utils::parse_recompile_command_line(
+  int argc, const char *argv[]
+) {
+  RECOMPILE_OPTIONS options;
+  CLI::App app;
+
+  options.err = 0;
+  options.called_for_help = false;
+  options.compiler = "g++";
+  options.include_path = "src";
   app.add_option("-r,--rom", options.rom_path, "path to rom")->required();
+  add_quirks_option(app, options.quirks);
+  app.add_option(
+    "-o,--output", options.output_path,
+    "library to write (default: the rom with a .so extension)"
+  );
+  app.add_option(
+    "--source", options.source_path, "also keep the generated C++ here"
+  );
+  app.add_option(
+    "--cxx", options.compiler, "compiler to build the library with"
+  );
+  app.add_option(
+    "-I,--include", options.include_path,
+    "directory holding the kate/ headers (default: src)"
+  );
 
   try {
     app.parse(argc, argv);
@@ -1,6 +1,7 @@
 #ifndef __OPTIONS_HPP__
 #define __OPTIONS_HPP__
 #include <filesystem>
+#include <string>
 
 #include <cstdint>
 
@@ -9,9 +10,89 @@ namespace utils {
     int err;
     bool called_for_help;
     std::filesystem::path rom_path;
+    std::string quirks;
+
+    // at most one of these is given
+    std::filesystem::path record_path;
+    std::filesystem::path replay_path;
+
+    // samples per audio buffer, fewer lowers latency but risks gaps. 0 for
+    // the default.
+    std::size_t audio_buffer_samples;
+
+    // a library built by kate-recompile, empty to only interpret
+    std::filesystem::path native_path;
+  };
+
+  struct HEADLESS_OPTIONS {
+    int err;
+    bool called_for_help;
+
+    // exactly one of these is given
+    std::filesystem::path rom_path;
+    std::filesystem::path corpus_path;
+    std::string quirks;
+
+    // only one of these may be given, frames takes priority if neither is
+    std::uint64_t frames;
+    std::uint64_t cycles;
+
+    // more than one runs that many copies of the rom side by side
+    std::size_t lanes;
+
+    // worker threads for a corpus, 0 for one per hardware thread
+    std::size_t jobs;
+
+    // record rewind history while running, to measure its cost
+    bool rewind;
+
+    // play a recorded movie back instead of running unattended
+    std::filesystem::path replay_path;
+
+    // a library built by kate-recompile, empty to only interpret
+    std::filesystem::path native_path;
+  };
+
+  struct BENCH_OPTIONS {
+    int err;
+    bool called_for_help;
+
+    // results are compared against this file, or saved to it if it doesn't
+    // exist yet (or `save` is set)
+    std::filesystem::path baseline_path;
+    bool save;
+    // a benchmark more than this many percent slower than its baseline
+    // counts as a regression
+    double tolerance;
+
+    // the best of this many timed runs is kept
+    std::size_t runs;
+    // only run benchmarks whose name contains this
+    std::string filter;
+  };
+
+  struct RECOMPILE_OPTIONS {
+    int err;
+    bool called_for_help;
+
+    std::filesystem::path rom_path;
+    std::string quirks;
+    // the library to write, the rom's path with a .so extension if empty
+    std::filesystem::path output_path;
+    // keep the generated C++ here, it's thrown away if empty
+    std::filesystem::path source_path;
+
+    // the compiler, and the directory holding the kate/ headers
+    std::string compiler;
+    std::filesystem::path include_path;
   };
 
   OPTIONS parse_command_line(int argc, const char *argv[]);
+  HEADLESS_OPTIONS parse_headless_command_line(int argc, const char *argv[]);
+  BENCH_OPTIONS parse_bench_command_line(int argc, const char *argv[]);
+  RECOMPILE_OPTIONS parse_recompile_command_line(
+    int argc, const char *argv[]
+  );
 }
 
 #endif // __OPTIONS_HPP__
@@ -0,0 +1,52 @@
+#ifndef __SPSC_QUEUE_HPP__
+#define __SPSC_QUEUE_HPP__
+
+#include <array>
+#include <atomic>
+
+#include <cstddef>
+
+namespace utils {
+  // A fixed size, lock-free queue for one producer thread and one consumer
+  // thread. `N` must be a power of two, and one slot is always left empty.
+  template <typename T, std::size_t N>
+  class SPSCQueue {
+    static_assert((N > 1) && ((N & (N - 1)) == 0), "N must be a power of 2");
+
+  public:
+    SPSCQueue() : items(), head(0), tail(0) {}
+
+    // producer only, returns false (and drops `item`) if the queue is full
+    bool push(const T &item) {
+      std::size_t t = tail.load(std::memory_order_relaxed);
+      std::size_t next = (t + 1) & (N - 1);
+      if (next == head.load(std::memory_order_acquire)) {
+        return false;
+      }
+
+      items[t] = item;
+      tail.store(next, std::memory_order_release);
+      return true;
+    }
+
+    // consumer only, returns false if the queue is empty
+    bool pop(T &item) {
+      std::size_t h = head.load(std::memory_order_relaxed);
+      if (h == tail.load(std::memory_order_acquire)) {
+        return false;
+      }
+
+      item = items[h];
+      head.store((h + 1) & (N - 1), std::memory_order_release);
+      return true;
+    }
+
+  private:
+    std::array<T, N> items;
+    // kept on separate cache lines so the two threads don't contend
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+  };
+}
+
+#endif // __SPSC_QUEUE_HPP__
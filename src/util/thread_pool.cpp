@@ -0,0 +1,94 @@
+#include <algorithm> // std::min, std::max
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace {
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<std::size_t> tasks;
+  };
+
+  bool pop_front(WorkQueue &q, std::size_t &task) {
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) {
+      return false;
+    }
+    task = q.tasks.front();
+    q.tasks.pop_front();
+    return true;
+  }
+
+  bool pop_back(WorkQueue &q, std::size_t &task) {
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) {
+      return false;
+    }
+    task = q.tasks.back();
+    q.tasks.pop_back();
+    return true;
+  }
+}
+
+void utils::work_stealing_for(
+  std::size_t count, std::size_t threads,
+  const std::function<void(std::size_t)> &task
+) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min(threads, count);
+
+  if (threads <= 1) {
+    for (std::size_t i = 0; i < count; ++i) {
+      task(i);
+    }
+    return;
+  }
+
+  // std::mutex can't be moved, so the queues can't live in a plain vector
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  for (std::size_t i = 0; i < threads; ++i) {
+    queues.push_back(std::make_unique<WorkQueue>());
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    queues[i % threads]->tasks.push_back(i);
+  }
+
+  auto worker = [&](std::size_t self) {
+    std::size_t t;
+
+    while (true) {
+      if (pop_front(*queues[self], t)) {
+        task(t);
+        continue;
+      }
+
+      // nothing left locally, try everyone else starting with our neighbour.
+      // No new tasks are ever queued, so once every queue is empty we're done.
+      bool stolen = false;
+      for (std::size_t i = 1; (i < threads) && !stolen; ++i) {
+        stolen = pop_back(*queues[(self + i) % threads], t);
+      }
+
+      if (!stolen) {
+        return;
+      }
+      task(t);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < threads; ++i) {
+    workers.emplace_back(worker, i);
+  }
+  worker(0);
+
+  for (auto &w : workers) {
+    w.join();
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef __THREAD_POOL_HPP__
+#define __THREAD_POOL_HPP__
+
+#include <functional>
+
+#include <cstddef>
+
+namespace utils {
+  // Calls `task(i)` for every i in [0, count) using `threads` worker threads
+  // (0 picks one per hardware thread) and returns once all have finished.
+  //
+  // The tasks are dealt out round-robin, each worker then takes from the
+  // front of its own queue and, once that is empty, steals from the back of
+  // another's. Long tasks therefore don't hold up the short ones queued
+  // behind them.
+  //
+  // `task` must not throw.
+  void work_stealing_for(
+    std::size_t count, std::size_t threads,
+    const std::function<void(std::size_t)> &task
+  );
+}
+
+#endif // __THREAD_POOL_HPP__
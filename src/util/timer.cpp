@@ -1,3 +1,6 @@
+#include <algorithm> // std::max
+#include <thread>
+
 #include "timer.hpp"
 
 utils::Clock::Clock() : epoch(utils::hires_clock::now()) {}
@@ -6,3 +9,38 @@ utils::seconds utils::Clock::get() const {
   time_point now = hires_clock::now();
   return seconds(now - epoch);
 }
+
+utils::FrameScheduler::FrameScheduler(
+  std::size_t rate, std::size_t max_frames
+)
+: period(std::chrono::duration_cast<steady_clock::duration>(
+    std::chrono::duration<double>(1.0 / rate)
+  )),
+  max_frames(std::max<std::size_t>(max_frames, 1)),
+  next(steady_clock::now()),
+  dropped(0) {}
+
+std::size_t utils::FrameScheduler::wait() {
+  steady_clock::time_point now = steady_clock::now();
+  if (now < next) {
+    std::this_thread::sleep_until(next);
+    now = steady_clock::now();
+  }
+
+  // sleeping can overshoot, and the caller may have been slow
+  std::size_t frames = 1 + (now - next) / period;
+
+  if (frames > max_frames) {
+    dropped += frames - max_frames;
+    frames = max_frames;
+    next = now + period;
+  } else {
+    next += frames * period;
+  }
+
+  return frames;
+}
+
+std::uint64_t utils::FrameScheduler::get_dropped() const {
+  return dropped;
+}
@@ -2,6 +2,9 @@
 #define __TIMER_HPP__
 #include <chrono>
 
+#include <cstddef>
+#include <cstdint>
+
 namespace utils {
   using hires_clock = std::chrono::high_resolution_clock;
   using time_point  = std::chrono::system_clock::time_point;
@@ -14,6 +17,30 @@ namespace utils {
   private:
     time_point epoch;
   };
+
+  // Paces a loop at a fixed number of frames per second.
+  //
+  // wait() sleeps until the next frame is due and returns how many frames
+  // are due, normally one. If the loop falls behind it returns more so the
+  // caller can catch up, but never more than `max_frames`; time beyond that
+  // is dropped rather than made up, so a long stall doesn't turn into a
+  // burst of fast forward.
+  class FrameScheduler {
+  public:
+    FrameScheduler(std::size_t rate, std::size_t max_frames);
+
+    std::size_t wait();
+    // the number of frames skipped so far because the loop was too slow
+    std::uint64_t get_dropped() const;
+
+  private:
+    using steady_clock = std::chrono::steady_clock;
+
+    steady_clock::duration period;
+    std::size_t max_frames;
+    steady_clock::time_point next;
+    std::uint64_t dropped;
+  };
 }
 
 #endif // __TIMER_HPP__
@@ -0,0 +1,59 @@
+#ifndef __TRIPLE_BUFFER_HPP__
+#define __TRIPLE_BUFFER_HPP__
+
+#include <array>
+#include <atomic>
+
+#include <cstdint>
+
+namespace utils {
+  // Hands the latest value of `T` from one producer thread to one consumer
+  // thread without locking.
+  //
+  // The producer fills in get_back() and then publish()es it, the consumer
+  // calls update() and reads get_front(). Neither side ever waits for the
+  // other: the producer always has a buffer to write to, and the consumer
+  // always sees the most recently published value (older ones that were
+  // never read are skipped).
+  template <typename T>
+  class TripleBuffer {
+  public:
+    TripleBuffer() : buffers(), middle(1), back(0), front(2) {}
+
+    // producer only
+    T &get_back() {
+      return buffers[back];
+    }
+
+    void publish() {
+      // swap the back buffer with the middle one and flag it as new
+      back = middle.exchange(back | fresh, std::memory_order_acq_rel) & index;
+    }
+
+    // consumer only, returns true if there was anything new
+    bool update() {
+      if (!(middle.load(std::memory_order_relaxed) & fresh)) {
+        return false;
+      }
+
+      front = middle.exchange(front, std::memory_order_acq_rel) & index;
+      return true;
+    }
+
+    const T &get_front() const {
+      return buffers[front];
+    }
+
+  private:
+    static constexpr std::uint8_t index = 0x3;
+    static constexpr std::uint8_t fresh = 0x4;
+
+    std::array<T, 3> buffers;
+    // the index of the buffer between the two threads, plus the fresh flag
+    std::atomic<std::uint8_t> middle;
+    std::uint8_t back;
+    std::uint8_t front;
+  };
+}
+
+#endif // __TRIPLE_BUFFER_HPP__